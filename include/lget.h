@@ -4,16 +4,41 @@
 
 #include <arpa/inet.h>
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
+#include <linux/fs.h>
+
+#ifndef DISABLE_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#ifndef DISABLE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "dns.h"
 
@@ -22,6 +47,396 @@
 
 #define HOSTNAME_SIZE 256
 
+/**
+ * Segmented download limits
+ */
+#define SEGMENTS_MAX 64
+#define SEGMENT_SIZE_MIN 262144
+#define SEGMENT_BUFFER_SIZE 32768
+
+/**
+ * Batch download limits
+ */
+#define BATCH_JOBS_DEFAULT 4
+#define BATCH_JOBS_MAX 256
+
+/**
+ * Transfer engines
+ */
+#define ENGINE_THREADS 0
+#define ENGINE_EPOLL 1
+
+/**
+ * Event loop engine settings
+ */
+#define ENGINE_TRANSFERS_MAX 65536
+#define ENGINE_EVENTS_MAX 256
+#define ENGINE_WHEEL_SLOTS 256
+#define ENGINE_TICK_MSEC 100
+#define ENGINE_TIMEOUT_MSEC 4000
+#define ENGINE_BUFFER_SIZE 4096
+
+/**
+ * Http response buffer initial size and header size limits
+ */
+#define HTTP_BUFFER_SIZE 32768
+#define HTTP_HEADER_MIN 1024
+#define HTTP_HEADER_MAX 65536
+#define HTTP_HEADER_LIMIT 16777216
+
+/**
+ * Http url size limit, redirects followed by default and limit, redirect body drain limit
+ */
+#define HTTP_URL_SIZE 4096
+#define HTTP_REDIRECT 1
+#define REDIRECTS_DEFAULT 16
+#define REDIRECTS_LIMIT 256
+#define REDIRECT_DRAIN_MAX 65536
+
+/**
+ * Http response connection header
+ */
+#define CONNECTION_DEFAULT 0
+#define CONNECTION_CLOSE 1
+#define CONNECTION_KEEPALIVE 2
+
+/**
+ * Http response body framing
+ */
+#define BODY_LENGTH 0
+#define BODY_CHUNKED 1
+#define BODY_CLOSE 2
+
+/**
+ * Http response content encoding and decoded output buffer size
+ */
+#define ENCODING_IDENTITY 0
+#define ENCODING_GZIP 1
+#define ENCODING_DEFLATE 2
+#define ENCODING_BUFFER_SIZE 65536
+
+/**
+ * Checksum algorithms, digest size limit, read back buffer and wake up step
+ */
+#define DIGEST_CRC32C 0
+#define DIGEST_MD5 1
+#define DIGEST_SHA256 2
+#define DIGEST_SIZE_MAX 32
+#define CHECKSUM_BUFFER_SIZE 65536
+#define CHECKSUM_STEP 1048576
+
+/**
+ * Retry policy defaults, backoff cap and retry after limit
+ */
+#define RETRY_DELAY_MSEC 1000
+#define RETRY_DELAY_MAX_MSEC 60000
+#define RETRY_AFTER_MAX_SEC 300
+#define RETRY_STATUS_MAX 16
+#define RETRY_STATUS_DEFAULT "408,429,500,502,503,504"
+
+/**
+ * File copy buffer and kernel copy step
+ */
+#define FILE_COPY_BUFFER_SIZE 65536
+#define FILE_COPY_CHUNK_SIZE 1073741824
+
+/**
+ * Zero copy receive pipe size
+ */
+#define SPLICE_PIPE_SIZE 1048576
+
+/**
+ * Body receive backends
+ */
+#define BACKEND_COPY 0
+#define BACKEND_SPLICE 1
+#define BACKEND_URING 2
+
+/**
+ * Io_uring backend registered buffers
+ */
+#define URING_BUFFERS 8
+#define URING_BUFFER_SIZE 65536
+
+/**
+ * Progress report intervals for terminal and line output
+ */
+#define PROGRESS_INTERVAL_MSEC 250
+#define PROGRESS_LINE_MSEC 5000
+
+/**
+ * Http pipelining limits and item results
+ */
+#define PIPELINE_DEPTH_MAX 64
+#define PIPELINE_OK 0
+#define PIPELINE_FAILED -1
+#define PIPELINE_RETRY 1
+
+/**
+ * Persistent connections pool limits
+ */
+#define POOL_SIZE 64
+#define POOL_HOST_MAX 8
+#define POOL_IDLE_SEC 30
+
+/**
+ * Resolved hostnames cache size
+ */
+#define RESOLVE_CACHE_SIZE 64
+
+/**
+ * Permanent redirects cache size
+ */
+#define REDIRECT_CACHE_SIZE 64
+
+/**
+ * Addresses kept per resolved hostname
+ */
+#define RESOLVE_ADDRS_MAX 16
+
+/**
+ * Address family policies, preferred family is tried first
+ */
+#define FAMILY_PREFER_IPV6 0
+#define FAMILY_PREFER_IPV4 1
+#define FAMILY_IPV4 2
+#define FAMILY_IPV6 3
+
+/**
+ * Resolved IPv4 or IPv6 address
+ */
+struct address_t
+{
+    int family;
+    union
+    {
+        struct in_addr v4;
+        struct in6_addr v6;
+    } addr;
+};
+
+/**
+ * Parallel connect timing, next address is tried after delay
+ */
+#define CONNECT_DELAY_MSEC 250
+#define CONNECT_TIMEOUT_MSEC 4000
+
+/**
+ * Mirror selection, probed prefix and probe timeout, throughput floor window
+ */
+#define MIRRORS_MAX 8
+#define MIRROR_PROBE_SIZE 262144
+#define MIRROR_PROBE_TIMEOUT_MSEC 5000
+#define STALL_WINDOW_MSEC 5000
+
+/**
+ * Local http cache, entries are named by url hash, validators are kept aside
+ */
+#define CACHE_NAME_SIZE 65
+#define CACHE_VALUE_SIZE 256
+#define CACHE_HEADERS_SIZE 640
+#define CACHE_META_SUFFIX ".meta"
+#define CACHE_SIZE_DEFAULT 1073741824
+
+/**
+ * Multi-source range sizing, ranges last about chunk time at observed throughput
+ */
+#define SWARM_CHUNK_MIN 262144
+#define SWARM_CHUNK_MAX 16777216
+#define SWARM_CHUNK_MSEC 2000
+#define SWARM_STEAL_MSEC 500
+
+/**
+ * Delta download blocks, block size grows with file so manifest stays small,
+ * missing ranges closer than gap size are fetched as one
+ */
+#define DELTA_MAGIC "lget-manifest 1"
+#define DELTA_BLOCK_MIN 4096
+#define DELTA_BLOCK_MAX 67108864
+#define DELTA_BLOCKS_TARGET 65536
+#define DELTA_BLOCKS_MAX 16777216
+#define DELTA_STRONG_SIZE 16
+#define DELTA_GAP_SIZE 262144
+
+/**
+ * Http response header parser state and parsed fields, values are buffer offsets
+ */
+struct response_t
+{
+    int state;
+    size_t pos;
+    size_t line;
+    size_t header_len;
+    unsigned int version;
+    unsigned int status;
+    int connection;
+    int chunked;
+    int has_length;
+    size_t content_len;
+    int has_range;
+    size_t range_begin;
+    size_t range_end;
+    size_t range_total;
+    int has_complete;
+    size_t complete_len;
+    size_t location;
+    size_t location_len;
+    size_t etag;
+    size_t etag_len;
+    size_t last_modified;
+    size_t last_modified_len;
+    size_t encoding;
+    size_t encoding_len;
+    int has_retry_after;
+    size_t retry_after;
+};
+
+/**
+ * Failed download attempt details, written prefix may be resumed
+ */
+struct retry_t
+{
+    unsigned int status;
+    int has_retry_after;
+    size_t retry_after;
+    int opened;
+    int resumable;
+    size_t offset;
+    int error;
+};
+
+/**
+ * Validators of cached copy or of fresh response
+ */
+struct cache_t
+{
+    int found;
+    size_t length;
+    char etag[CACHE_VALUE_SIZE];
+    char modified[CACHE_VALUE_SIZE];
+};
+
+/**
+ * Transfer throughput watch over fixed windows
+ */
+struct stall_t
+{
+    size_t floor;
+    size_t base;
+    unsigned long since;
+};
+
+/**
+ * Http response body decoder state
+ */
+struct body_t
+{
+    int mode;
+    int state;
+    int done;
+    unsigned int digits;
+    size_t remaining;
+};
+
+/**
+ * Content decoder state, output buffer is allocated for compressed bodies only
+ */
+struct encoding_t
+{
+    int mode;
+    int done;
+    int probe;
+    size_t decoded;
+    char *buffer;
+#ifndef DISABLE_ZLIB
+    z_stream stream;
+#endif
+};
+
+/**
+ * Expected message digest
+ */
+struct digest_t
+{
+    int algorithm;
+    size_t len;
+    unsigned char value[DIGEST_SIZE_MAX];
+};
+
+/**
+ * Message digest state, crc32c uses the first state word only
+ */
+struct hash_t
+{
+    int algorithm;
+    uint32_t state[8];
+    uint64_t count;
+    unsigned char block[64];
+};
+
+/**
+ * Streaming checksum state, thread hashes output file behind the download
+ */
+struct checksum_t
+{
+    const struct digest_t *expected;
+    struct hash_t hash;
+    int fd;
+    int running;
+    int stop;
+    int error;
+    size_t hashed;
+    size_t ready;
+    char *buffer;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+/**
+ * Zero copy receive pipe
+ */
+struct splice_t
+{
+    int pipe[2];
+    int broken;
+    size_t size;
+};
+
+/**
+ * Download progress reporter state
+ */
+struct progress_t
+{
+    const char *name;
+    size_t offset;
+    size_t total;
+    size_t sum;
+    size_t decoded;
+    size_t last_sum;
+    unsigned long started;
+    unsigned long last_time;
+    int enabled;
+    int running;
+    int printed;
+    int stop;
+    int tty;
+    int encoded;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+/**
+ * Pipelined download item
+ */
+struct pipeline_item_t
+{
+    const char *url;
+    const char *filepath;
+    int result;
+};
+
 /**
  * Socks5 proxy details with hostname unresolved
  */
@@ -36,14 +451,423 @@ struct socks5h_t
  */
 struct socks5_t
 {
-    unsigned int addr;
+    struct address_t addrs[RESOLVE_ADDRS_MAX];
+    size_t count;
     unsigned short port;
 };
 
+/**
+ * Program options
+ */
+struct options_t
+{
+    struct socks5_t *socks5;
+    unsigned int connections;
+    unsigned int jobs;
+    unsigned int pipeline;
+    size_t header_max;
+    int engine;
+    int backend;
+    int family;
+    int fastopen;
+    int nodelay;
+    int quickack;
+    unsigned int rcvbuf;
+    const char *congestion;
+    int keepalive;
+    int nocache;
+    int resume;
+    int compressed;
+    int progress;
+    unsigned int redirects;
+    unsigned int retries;
+    unsigned int retry_delay;
+    unsigned int retry_status[RETRY_STATUS_MAX];
+    size_t retry_status_count;
+    const struct digest_t *checksum;
+    const char *input;
+    const char *mirrors[MIRRORS_MAX];
+    size_t mirror_count;
+    int swarm;
+    size_t min_speed;
+    unsigned int recv_timeout;
+    const char *cache;
+    size_t cache_max;
+    const char *store;
+    const char *delta;
+};
+
 /**
  * Download file via Http
  */
-extern int http_get ( const char *url, const char *filepath, struct socks5_t *socks5 );
+extern int http_get ( const char *url, const char *filepath, const struct options_t *options );
+
+/**
+ * Download file via Http, transient failures are retried, state is carried between calls
+ */
+extern int http_transfer ( const char *url, const char *filepath,
+    const struct options_t *options, struct options_t *current, struct retry_t *retry );
+
+/**
+ * Parse http url into hostname, port and path
+ */
+extern int http_parse_url ( const char *url, char *hostname, size_t limit, unsigned short *port,
+    const char **path );
+
+/**
+ * Format http request with optional extra headers
+ */
+extern ssize_t http_format_request ( char *buffer, size_t size, const char *hostname,
+    unsigned short port, const char *path, const char *headers, int keepalive, int compressed );
+
+/**
+ * Setup response parser
+ */
+extern void response_init ( struct response_t *response );
+
+/**
+ * Feed received bytes to response parser, each byte is scanned once
+ */
+extern int response_parse ( struct response_t *response, const char *buffer, size_t len );
+
+/**
+ * Check if connection persists after response
+ */
+extern int response_keepalive ( const struct response_t *response );
+
+/**
+ * Check if response redirects to location
+ */
+extern int response_redirect ( const struct response_t *response );
+
+/**
+ * Check if redirect is permanent and may be cached
+ */
+extern int response_permanent ( const struct response_t *response );
+
+/**
+ * Build absolute redirect url from response location relative to request url
+ */
+extern int response_location ( const struct response_t *response, const char *buffer,
+    const char *base, char *url, size_t size );
+
+/**
+ * Fill socket address from resolved address and port
+ */
+extern socklen_t connect_sockaddr ( const struct address_t *address, unsigned short port,
+    struct sockaddr_storage *saddr );
+
+/**
+ * Apply socket options selected on command line before connect
+ */
+extern int connect_setup ( int sock, const struct options_t *options );
+
+/**
+ * Connect with first responding of server addresses, attempts are staggered
+ */
+extern int connect_race ( const struct address_t *addrs, size_t count, unsigned short port,
+    const struct options_t *options );
+
+/**
+ * Connect with http server directly or via proxy
+ */
+extern int http_connect ( const char *hostname, unsigned short port,
+    const struct options_t *options );
+
+/**
+ * Open connection with http server, reuse idle one if possible
+ */
+extern int http_open ( const char *hostname, unsigned short port,
+    const struct options_t *options, int *reused );
+
+/**
+ * Open connection and exchange http request for response header
+ */
+extern int http_query ( const char *url, const char *headers, const struct options_t *options,
+    char **buffer, size_t *size, size_t *len, struct response_t *response );
+
+/**
+ * Setup body decoder from response header
+ */
+extern void body_init ( struct body_t *decoder, const struct response_t *response );
+
+/**
+ * Decode received body data, payload is returned as a span of the input
+ */
+extern ssize_t body_decode ( struct body_t *decoder, const char *data, size_t len,
+    const char **payload, size_t *payload_len );
+
+/**
+ * Handle connection close while receiving body
+ */
+extern int body_eof ( struct body_t *decoder );
+
+/**
+ * Get body length that may be moved without decoding
+ */
+extern size_t body_direct_len ( const struct body_t *decoder, size_t size );
+
+/**
+ * Account body data moved past the decoder
+ */
+extern void body_skip ( struct body_t *decoder, size_t len );
+
+/**
+ * Setup content decoder from response header
+ */
+extern int encoding_init ( struct encoding_t *encoding, const struct response_t *response,
+    const char *buffer );
+
+/**
+ * Decode body payload and write result to output file
+ */
+extern int encoding_write ( struct encoding_t *encoding, int fd, const char *data, size_t len );
+
+/**
+ * Check if compressed stream ended with the body
+ */
+extern int encoding_finish ( const struct encoding_t *encoding );
+
+/**
+ * Release content decoder
+ */
+extern void encoding_close ( struct encoding_t *encoding );
+
+/**
+ * Setup pipe for moving data from socket into file
+ */
+extern int splice_open ( struct splice_t *relay );
+
+/**
+ * Release pipe used for moving data
+ */
+extern void splice_close ( struct splice_t *relay );
+
+/**
+ * Move data from socket into file at offset or current position, zero means connection closed
+ */
+extern ssize_t splice_recv ( struct splice_t *relay, int sock, int fd, size_t *offset,
+    size_t len );
+
+/**
+ * Setup io_uring instance with registered buffers
+ */
+extern struct uring_t *uring_open ( void );
+
+/**
+ * Release io_uring instance
+ */
+extern void uring_close ( struct uring_t *ring );
+
+/**
+ * Move data from socket into file at offset, zero means connection closed
+ */
+extern ssize_t uring_recv ( struct uring_t *ring, int sock, int fd, size_t offset, size_t len );
+
+/**
+ * Reserve disk space for the rest of output file
+ */
+extern int file_preallocate ( int fd, size_t offset, size_t total );
+
+/**
+ * Verify final size of output file and release its cached pages if requested
+ */
+extern int file_finish ( int fd, size_t size, const struct options_t *options );
+
+/**
+ * Place copy of file at new path, sharing data by reflink or hard link if possible
+ */
+extern int file_clone ( const char *src, const char *dst );
+
+/**
+ * Place copy of file at output path, regular output is replaced, devices and pipes written
+ */
+extern int file_place ( const char *src, const char *filepath );
+
+/**
+ * Release output file from shared copies, a hard link must not be written through,
+ * data kept for resume is copied into a private file first
+ */
+extern int file_detach ( const char *filepath, int keep );
+
+/**
+ * Setup hash state for algorithm
+ */
+extern void hash_init ( struct hash_t *hash, int algorithm );
+
+/**
+ * Add data to hash
+ */
+extern void hash_update ( struct hash_t *hash, const void *data, size_t len );
+
+/**
+ * Complete hash and store digest, returns digest length
+ */
+extern size_t hash_final ( struct hash_t *hash, unsigned char *digest );
+
+/**
+ * Parse expected digest given as algorithm:hex
+ */
+extern int digest_parse ( const char *spec, struct digest_t *digest );
+
+/**
+ * Get digest algorithm name
+ */
+extern const char *digest_name ( int algorithm );
+
+/**
+ * Format digest value as lowercase hex, buffer holds twice the length plus one
+ */
+extern void digest_hex ( const struct digest_t *digest, char *buffer );
+
+/**
+ * Parse comma separated list of retried http statuses
+ */
+extern int retry_parse_status ( const char *list, struct options_t *options );
+
+/**
+ * Check if failed download attempt may be retried
+ */
+extern int retry_allowed ( const struct options_t *options, const struct retry_t *retry,
+    int error );
+
+/**
+ * Get jittered delay before next download attempt in milliseconds
+ */
+extern unsigned long retry_delay ( const struct options_t *options, const struct retry_t *retry,
+    unsigned int attempt );
+
+/**
+ * Sleep for given milliseconds
+ */
+extern void retry_sleep ( unsigned long delay );
+
+/**
+ * Prepare next attempt to continue after written prefix of failed one
+ */
+extern int retry_resume ( const char *filepath, const struct options_t *options,
+    const struct retry_t *retry, struct options_t *current );
+
+/**
+ * Start throughput watch at given byte count, zero floor disables it
+ */
+extern void mirror_stall_start ( struct stall_t *stall, size_t sum, size_t floor );
+
+/**
+ * Check transfer throughput against floor once window elapses
+ */
+extern int mirror_stall_check ( struct stall_t *stall, size_t sum );
+
+/**
+ * Download file from fastest of mirrors, failing over to next ones
+ */
+extern int mirror_get ( const char *url, const char *filepath, const struct options_t *options );
+
+/**
+ * Download file ranges from several sources at once
+ */
+extern int swarm_get ( const char *const *urls, size_t sources, size_t total,
+    const char *filepath, const struct options_t *options );
+
+/**
+ * Load validators of cached copy of url
+ */
+extern int cache_lookup ( const char *dir, const char *url, struct cache_t *entry );
+
+/**
+ * Append conditional request headers for cached copy
+ */
+extern void cache_conditional ( const struct cache_t *entry, char *headers, size_t size );
+
+/**
+ * Copy validators out of response header, as buffer gets reused for body
+ */
+extern void cache_validators ( struct cache_t *entry, const struct response_t *response,
+    const char *buffer );
+
+/**
+ * Place cached copy of unchanged url at output path
+ */
+extern int cache_restore ( const char *dir, const char *url, const char *filepath );
+
+/**
+ * Store downloaded file with its validators, then evict least recently used entries
+ */
+extern int cache_store ( const char *dir, const char *url, const struct cache_t *entry,
+    const char *filepath, size_t max );
+
+/**
+ * Place stored blob with expected digest at output path, so download may be skipped
+ */
+extern int store_fetch ( const char *filepath, const struct options_t *options );
+
+/**
+ * Store completed download under its digest, output of known content links to stored blob
+ */
+extern int store_put ( const char *filepath, const struct options_t *options );
+
+/**
+ * Generate block manifest of file, weak and strong checksum per block and whole file digest
+ */
+extern int delta_manifest ( const char *filepath, const char *manifest );
+
+/**
+ * Download file as delta against its local copy, only blocks missing from it are fetched
+ */
+extern int delta_get ( const char *url, const char *filepath, const struct options_t *options );
+
+/**
+ * Start checksum of output file, prefix up to ready offset is already written
+ */
+extern int checksum_start ( struct checksum_t *checksum, const struct digest_t *expected,
+    const char *filepath, size_t ready );
+
+/**
+ * Advance written prefix of output file, wakes checksum thread in steps
+ */
+extern void checksum_update ( struct checksum_t *checksum, size_t ready );
+
+/**
+ * Complete checksum of output file with final size and compare it
+ */
+extern int checksum_finish ( struct checksum_t *checksum, size_t total );
+
+/**
+ * Abandon checksum of failed download
+ */
+extern void checksum_cancel ( struct checksum_t *checksum );
+
+/**
+ * Start progress reporting for download
+ */
+extern void progress_start ( struct progress_t *progress, const char *name, size_t offset,
+    size_t total, int enabled );
+
+/**
+ * Set downloaded bytes count, single writer only
+ */
+extern void progress_set ( struct progress_t *progress, size_t sum );
+
+/**
+ * Add downloaded bytes count, safe for many writers
+ */
+extern void progress_add ( struct progress_t *progress, size_t len );
+
+/**
+ * Set decoded bytes count of compressed body, single writer only
+ */
+extern void progress_decoded ( struct progress_t *progress, size_t decoded );
+
+/**
+ * Stop progress reporting, print summary if download succeeded
+ */
+extern void progress_stop ( struct progress_t *progress, int result );
+
+/**
+ * Download file in segments over parallel connections
+ */
+extern int segment_get ( int sock, const char *url, const char *filepath, const char *data,
+    size_t len, size_t offset, size_t total, const struct options_t *options );
 
 /*
  * Perform Socks5 handshake
@@ -55,11 +879,72 @@ extern int socks5_handshake ( int sock );
  */
 extern int socks5_request_hostname ( int sock, const char *hostname, unsigned short port );
 
+/**
+ * Format Socks5 greeting message
+ */
+extern size_t socks5_format_greeting ( char *buffer );
+
+/**
+ * Validate Socks5 greeting response
+ */
+extern int socks5_check_greeting ( const char *buffer, size_t len );
+
+/**
+ * Format Socks5 connect request with hostname
+ */
+extern ssize_t socks5_format_request_hostname ( char *buffer, size_t size, const char *hostname,
+    unsigned short port );
+
+/**
+ * Get Socks5 connect response length, zero if more data is needed
+ */
+extern size_t socks5_reply_len ( const char *buffer, size_t len );
+
+/**
+ * Validate Socks5 connect response
+ */
+extern int socks5_check_reply ( const char *buffer, size_t len );
+
+/**
+ * Download files listed in input file
+ */
+extern int batch_get ( const char *input, const struct options_t *options );
+
+/**
+ * Download items from the same endpoint over one pipelined connection
+ */
+extern void pipeline_get ( struct pipeline_item_t *items, size_t count,
+    const struct options_t *options );
+
+/**
+ * Run transfers on event loop engine
+ */
+extern int engine_run ( const struct options_t *options, unsigned int limit,
+    int ( *next ) ( void *arg, char **url, char **filepath ),
+    void ( *done ) ( void *arg, const char *url, const char *filepath, int result ), void *arg );
+
+/**
+ * Take idle connection to the endpoint from pool
+ */
+extern int pool_acquire ( const char *hostname, unsigned short port,
+    const struct socks5_t *socks5 );
+
+/**
+ * Put connection into pool for reuse
+ */
+extern void pool_release ( int sock, const char *hostname, unsigned short port,
+    const struct socks5_t *socks5 );
+
 /**
  * Parse host name and port
  */
 extern int parse_host ( const char *input, char *host, size_t host_len, unsigned short *port );
 
+/**
+ * Format host with optional port, IPv6 literals are bracketed
+ */
+extern int format_host ( char *buffer, size_t size, const char *hostname, unsigned short port );
+
 /**
  * Get basename of file path
  */
@@ -71,8 +956,35 @@ extern const char *get_basename ( const char *path );
 extern char *lget_strcasestr ( const char *haystack, const char *needle );
 
 /**
- * Resolve hostname into IPv4 address
+ * Find line feed within buffer
+ */
+extern const char *scan_lf ( const char *ptr, size_t len );
+
+/**
+ * Compare buffers of equal length ignoring ASCII letter case
+ */
+extern int scan_casecmp ( const char *a, const char *b, size_t len );
+
+/**
+ * Find string within buffer ignoring ASCII letter case
+ */
+extern const char *scan_casestr ( const char *ptr, size_t len, const char *needle,
+    size_t needle_len );
+
+/**
+ * Resolve hostname into addresses ordered by family policy, returns addresses count
+ */
+extern int resolve_host ( const char *hostname, int family, struct address_t *addrs,
+    size_t size );
+
+/**
+ * Look up redirect target of url in permanent redirects cache
+ */
+extern int redirect_cache_lookup ( const char *url, char *target, size_t size );
+
+/**
+ * Store permanent redirect in cache
  */
-extern int resolve_ipv4 ( const char *hostname, unsigned int *addr );
+extern void redirect_cache_store ( const char *url, const char *target );
 
 #endif
@@ -141,19 +141,30 @@ static ssize_t dns_decompress_name ( const unsigned char *in, size_t ipos,
     return opos;
 }
 
+/**
+ * Get address length of A or AAAA record
+ */
+static size_t dns_addr_len ( unsigned short qtype )
+{
+    return qtype == T_AAAA ? 16 : 4;
+}
+
 /**
  * Resolve encoded hostname via Root Servers
  */
 static int dns_resolve_root ( const unsigned char *encoded, size_t enclen, size_t *querycnt,
-    unsigned int *addr );
+    unsigned short qtype, void *addrs, size_t size );
 
 /**
- * Perform DNS query with recursion
+ * Perform DNS query with recursion, returns addresses count
  */
 static int dns_recursive_query ( const unsigned char *encoded, size_t enclen, size_t *querycnt,
-    unsigned int ns, unsigned int *addr )
+    unsigned int ns, unsigned short qtype, void *addrs, size_t size )
 {
     int sock;
+    int ret;
+    size_t count = 0;
+    size_t addrlen;
     unsigned short i;
     unsigned short query_id;
     unsigned short ans_count;
@@ -221,7 +232,7 @@ static int dns_recursive_query ( const unsigned char *encoded, size_t enclen, si
 
     /* Prepare DNS question */
     question = ( struct dns_question_t * ) ( buffer + sizeof ( struct dns_header_t ) + enclen );
-    question->qtype = htons ( T_A );    /* set query type: A, MX, CNAME, NS, etc */
+    question->qtype = htons ( qtype );  /* set query type: A, AAAA, MX, CNAME, NS, etc */
     question->qclass = htons ( 1 );     /* set query internet */
 
     /* Prepare socket address */
@@ -282,25 +293,30 @@ static int dns_recursive_query ( const unsigned char *encoded, size_t enclen, si
     ptr = buffer + query_len;
     limit = buffer + len;
 
-    /* Look up for A records in ANSWER section */
+    /* Collect all records of queried type in ANSWER section */
+    addrlen = dns_addr_len ( qtype );
+
     for ( i = 0; i < ans_count; i++ )
     {
         if ( !( answer = dns_nearby_answer ( &ptr, limit ) ) )
         {
-            return -1;
+            return count ? ( int ) count : -1;
         }
 
-        if ( ntohs ( answer->type ) == T_A
-            && ntohs ( answer->rd_length ) == sizeof ( unsigned int ) )
+        if ( ntohs ( answer->type ) == qtype
+            && ntohs ( answer->rd_length ) == addrlen && count < size )
         {
-            addrptr =
-                ( const unsigned int * ) ( ( const unsigned char * ) answer +
-                sizeof ( struct dns_answer_t ) );
-            *addr = *addrptr;
-            return 0;
+            memcpy ( ( unsigned char * ) addrs + count * addrlen,
+                ( const unsigned char * ) answer + sizeof ( struct dns_answer_t ), addrlen );
+            count++;
         }
     }
 
+    if ( count )
+    {
+        return count;
+    }
+
     /* Backup AUTHORITY section position */
     ptrbackup = ptr;
 
@@ -328,9 +344,11 @@ static int dns_recursive_query ( const unsigned char *encoded, size_t enclen, si
                 ( const unsigned int * ) ( ( const unsigned char * ) answer +
                 sizeof ( struct dns_answer_t ) );
 
-            if ( dns_recursive_query ( encoded, enclen, querycnt, *addrptr, addr ) >= 0 )
+            if ( ( ret =
+                    dns_recursive_query ( encoded, enclen, querycnt, *addrptr, qtype, addrs,
+                        size ) ) > 0 )
             {
-                return 0;
+                return ret;
             }
         }
     }
@@ -357,11 +375,13 @@ static int dns_recursive_query ( const unsigned char *encoded, size_t enclen, si
                     dns_decompress_name ( buffer, hostptr - buffer, len, hostbuf,
                         sizeof ( hostbuf ) ) ) >= 0 )
             {
-                if ( dns_resolve_root ( hostbuf, hostlen, querycnt, &ns_addr ) >= 0 )
+                if ( dns_resolve_root ( hostbuf, hostlen, querycnt, T_A, &ns_addr, 1 ) > 0 )
                 {
-                    if ( dns_recursive_query ( encoded, enclen, querycnt, ns_addr, addr ) >= 0 )
+                    if ( ( ret =
+                            dns_recursive_query ( encoded, enclen, querycnt, ns_addr, qtype,
+                                addrs, size ) ) > 0 )
                     {
-                        return 0;
+                        return ret;
                     }
                 }
             }
@@ -390,9 +410,11 @@ static int dns_recursive_query ( const unsigned char *encoded, size_t enclen, si
                     dns_decompress_name ( buffer, hostptr - buffer, len, hostbuf,
                         sizeof ( hostbuf ) ) ) >= 0 )
             {
-                if ( dns_resolve_root ( hostbuf, hostlen, querycnt, addr ) >= 0 )
+                if ( ( ret =
+                        dns_resolve_root ( hostbuf, hostlen, querycnt, qtype, addrs,
+                            size ) ) > 0 )
                 {
-                    return 0;
+                    return ret;
                 }
             }
         }
@@ -406,8 +428,9 @@ static int dns_recursive_query ( const unsigned char *encoded, size_t enclen, si
  * Resolve encoded hostname via Root Servers
  */
 static int dns_resolve_root ( const unsigned char *encoded, size_t enclen, size_t *querycnt,
-    unsigned int *addr )
+    unsigned short qtype, void *addrs, size_t size )
 {
+    int ret;
     unsigned int ns;
     struct timeval tv = { 0 };
 
@@ -416,18 +439,19 @@ static int dns_resolve_root ( const unsigned char *encoded, size_t enclen, size_
 
     ns = htonl ( dns_servers[( tv.tv_sec ^ tv.tv_usec ) % DNS_N_SERVERS] );
 
-    if ( dns_recursive_query ( encoded, enclen, querycnt, ns, addr ) >= 0 )
+    if ( ( ret = dns_recursive_query ( encoded, enclen, querycnt, ns, qtype, addrs, size ) ) > 0 )
     {
-        return 0;
+        return ret;
     }
 
     return -1;
 }
 
 /**
- * Resolve hostname into IPv4 address
+ * Resolve hostname into A or AAAA record addresses
  */
-int nsaddr ( const char *hostname, unsigned int *addr )
+static int dns_resolve_hostname ( const char *hostname, unsigned short qtype, void *addrs,
+    size_t size )
 {
     size_t querycnt = 0;
     unsigned char encoded[DNS_NAME_SIZE_MAX];
@@ -437,5 +461,21 @@ int nsaddr ( const char *hostname, unsigned int *addr )
         return -1;
     }
 
-    return dns_resolve_root ( encoded, strlen ( hostname ) + 2, &querycnt, addr );
+    return dns_resolve_root ( encoded, strlen ( hostname ) + 2, &querycnt, qtype, addrs, size );
+}
+
+/**
+ * Resolve hostname into IPv4 addresses, returns addresses count
+ */
+int nsaddr ( const char *hostname, unsigned int *addrs, size_t size )
+{
+    return dns_resolve_hostname ( hostname, T_A, addrs, size );
+}
+
+/**
+ * Resolve hostname into IPv6 addresses, returns addresses count
+ */
+int nsaddr6 ( const char *hostname, struct in6_addr *addrs, size_t size )
+{
+    return dns_resolve_hostname ( hostname, T_AAAA, addrs, size );
 }
@@ -22,6 +22,7 @@
 #define T_SOA       6   /* Start of authority zone */
 #define T_PTR       12  /* Domain name pointer */
 #define T_MX        15  /* Mail server */
+#define T_AAAA      28  /* IPv6 address */
 
 /**
  * DNS socket timeouts
@@ -110,8 +111,13 @@ struct dns_answer_t
 } __attribute__( ( packed ) );
 
 /**
- * Resolve hostname into IPv4 address
+ * Resolve hostname into IPv4 addresses, returns addresses count
  */
-extern int nsaddr ( const char *hostname, unsigned int *addr );
+extern int nsaddr ( const char *hostname, unsigned int *addrs, size_t size );
+
+/**
+ * Resolve hostname into IPv6 addresses, returns addresses count
+ */
+extern int nsaddr6 ( const char *hostname, struct in6_addr *addrs, size_t size );
 
 #endif
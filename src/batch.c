@@ -0,0 +1,407 @@
+/* ------------------------------------------------------------------
+ * Lget - Batch Download Support
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Batch download shared state
+ */
+struct batch_t
+{
+    FILE *input;
+    const struct options_t *options;
+    pthread_mutex_t mutex;
+    unsigned int lineno;
+    unsigned int succeeded;
+    unsigned int failed;
+    char line[8192];
+};
+
+/**
+ * Take next download item from input list
+ */
+static int batch_next ( struct batch_t *batch, char *line, size_t size, char **url,
+    char **filepath )
+{
+    char *ptr;
+    int ret = -1;
+
+    pthread_mutex_lock ( &batch->mutex );
+
+    while ( fgets ( line, size, batch->input ) )
+    {
+        batch->lineno++;
+
+        /* Strip line terminator */
+        line[strcspn ( line, "\r\n" )] = '\0';
+
+        /* Skip empty lines and comments */
+        if ( !*line || *line == '#' )
+        {
+            continue;
+        }
+
+        *url = line;
+
+        /* Output path defaults to url basename */
+        if ( ( ptr = strchr ( line, '\t' ) ) )
+        {
+            *ptr = '\0';
+            *filepath = ptr + 1;
+
+        } else
+        {
+            *filepath = ( char * ) get_basename ( line );
+        }
+
+        ret = 0;
+        break;
+    }
+
+    pthread_mutex_unlock ( &batch->mutex );
+
+    return ret;
+}
+
+/**
+ * Report download item result
+ */
+static void batch_report ( struct batch_t *batch, const char *url, const char *filepath,
+    int result )
+{
+    pthread_mutex_lock ( &batch->mutex );
+
+    if ( result >= 0 )
+    {
+        batch->succeeded++;
+        printf ( "ok: %s\n", filepath );
+
+    } else
+    {
+        batch->failed++;
+        printf ( "failed: %s\n", url );
+    }
+
+    pthread_mutex_unlock ( &batch->mutex );
+}
+
+/**
+ * Download single item without pipelining
+ */
+static void batch_single ( struct batch_t *batch, const char *url, const char *filepath )
+{
+    batch_report ( batch, url, filepath, *filepath
+        && http_get ( url, filepath, batch->options ) >= 0 ? 0 : -1 );
+}
+
+/**
+ * Resolve url through known permanent redirects, chain is limited by redirects count
+ */
+static const char *batch_resolve ( const struct options_t *options, const char *url,
+    char *target, char *scratch )
+{
+    unsigned int hops = 0;
+    const char *current = url;
+
+    while ( hops < options->redirects
+        && redirect_cache_lookup ( current, scratch, HTTP_URL_SIZE ) >= 0 )
+    {
+        strcpy ( target, scratch );
+        current = target;
+        hops++;
+    }
+
+    return current;
+}
+
+/**
+ * Download items taken in one round over pipelined connections, grouped by endpoint
+ */
+static void batch_pipeline ( struct batch_t *batch, struct pipeline_item_t *items, size_t count )
+{
+    size_t i;
+    size_t j;
+    size_t k;
+    size_t group_len;
+    unsigned short port;
+    unsigned short other_port;
+    const char *path;
+    char hostname[HOSTNAME_SIZE];
+    char other[HOSTNAME_SIZE];
+    char *targets;
+    size_t indices[PIPELINE_DEPTH_MAX];
+    char grouped[PIPELINE_DEPTH_MAX];
+    const char *urls[PIPELINE_DEPTH_MAX];
+    struct pipeline_item_t group[PIPELINE_DEPTH_MAX];
+
+    memset ( grouped, '\0', sizeof ( grouped ) );
+
+    /* Items are requested at targets of known permanent redirects, last slot is scratch */
+    if ( !( targets = ( char * ) malloc ( ( count + 1 ) * HTTP_URL_SIZE ) ) )
+    {
+        perror ( "malloc" );
+        memset ( grouped, 1, sizeof ( grouped ) );
+    }
+
+    for ( i = 0; i < count; i++ )
+    {
+        urls[i] = targets ? batch_resolve ( batch->options, items[i].url,
+            targets + i * HTTP_URL_SIZE, targets + count * HTTP_URL_SIZE ) : items[i].url;
+    }
+
+    for ( i = 0; i < count; i++ )
+    {
+        /* Skip items already grouped or not suitable */
+        if ( grouped[i] || !*items[i].filepath
+            || http_parse_url ( urls[i], hostname, sizeof ( hostname ), &port, &path ) < 0 )
+        {
+            continue;
+        }
+
+        group_len = 0;
+
+        /* Collect remaining items for the same endpoint */
+        for ( j = i; j < count; j++ )
+        {
+            if ( !grouped[j] && *items[j].filepath
+                && http_parse_url ( urls[j], other, sizeof ( other ), &other_port,
+                    &path ) >= 0 && other_port == port && !strcasecmp ( other, hostname ) )
+            {
+                grouped[j] = 1;
+                indices[group_len] = j;
+                group[group_len] = items[j];
+                group[group_len].url = urls[j];
+                group_len++;
+            }
+        }
+
+        pipeline_get ( group, group_len, batch->options );
+
+        for ( k = 0; k < group_len; k++ )
+        {
+            items[indices[k]].result = group[k].result;
+        }
+    }
+
+    free ( targets );
+
+    /* Report results, fall back to plain persistent connection if needed */
+    for ( i = 0; i < count; i++ )
+    {
+        if ( items[i].result != PIPELINE_RETRY )
+        {
+            batch_report ( batch, items[i].url, items[i].filepath, items[i].result );
+
+        } else
+        {
+            batch_single ( batch, items[i].url, items[i].filepath );
+        }
+    }
+}
+
+/**
+ * Batch download worker
+ */
+static void *batch_worker ( void *arg )
+{
+    size_t i;
+    size_t count;
+    size_t depth;
+    char *url;
+    char *filepath;
+    char *lines;
+    struct batch_t *batch;
+    struct pipeline_item_t items[PIPELINE_DEPTH_MAX];
+
+    batch = ( struct batch_t * ) arg;
+
+    /* Pipelining does not apply to resumed downloads */
+    depth = batch->options->resume ? 1 : batch->options->pipeline;
+
+    if ( depth <= 1 )
+    {
+        depth = 1;
+    }
+
+    if ( !( lines = ( char * ) malloc ( depth * 8192 ) ) )
+    {
+        perror ( "malloc" );
+        return NULL;
+    }
+
+    for ( ;; )
+    {
+        /* Take up to pipeline depth items at once */
+        for ( count = 0; count < depth; count++ )
+        {
+            if ( batch_next ( batch, lines + count * 8192, 8192, &url, &filepath ) < 0 )
+            {
+                break;
+            }
+
+            items[count].url = url;
+            items[count].filepath = filepath;
+            items[count].result = PIPELINE_RETRY;
+        }
+
+        if ( !count )
+        {
+            break;
+        }
+
+        if ( depth > 1 )
+        {
+            batch_pipeline ( batch, items, count );
+
+        } else
+        {
+            for ( i = 0; i < count; i++ )
+            {
+                batch_single ( batch, items[i].url, items[i].filepath );
+            }
+        }
+    }
+
+    free ( lines );
+
+    return NULL;
+}
+
+/**
+ * Take next download item for event loop engine
+ */
+static int batch_engine_next ( void *arg, char **url, char **filepath )
+{
+    struct batch_t *batch;
+
+    batch = ( struct batch_t * ) arg;
+
+    do
+    {
+        if ( batch_next ( batch, batch->line, sizeof ( batch->line ), url, filepath ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( !**filepath )
+        {
+            batch->failed++;
+            printf ( "failed: %s\n", *url );
+        }
+
+    } while ( !**filepath );
+
+    return 0;
+}
+
+/**
+ * Report download item finished by event loop engine
+ */
+static void batch_engine_done ( void *arg, const char *url, const char *filepath, int result )
+{
+    struct batch_t *batch;
+
+    batch = ( struct batch_t * ) arg;
+
+    if ( result >= 0 )
+    {
+        batch->succeeded++;
+        printf ( "ok: %s\n", filepath );
+
+    } else
+    {
+        batch->failed++;
+        printf ( "failed: %s\n", url );
+    }
+}
+
+/**
+ * Download files listed in input file
+ */
+int batch_get ( const char *input, const struct options_t *options )
+{
+    unsigned int i;
+    unsigned int started;
+    struct batch_t batch;
+    struct options_t worker_options;
+    pthread_t threads[BATCH_JOBS_MAX];
+
+    /* Open input list, dash stands for stdin */
+    if ( !strcmp ( input, "-" ) )
+    {
+        batch.input = stdin;
+
+    } else if ( !( batch.input = fopen ( input, "r" ) ) )
+    {
+        perror ( "fopen" );
+        return -1;
+    }
+
+    /* Progress lines would interleave between workers */
+    memcpy ( &worker_options, options, sizeof ( worker_options ) );
+    worker_options.progress = options->progress && options->jobs <= 1;
+
+    batch.options = &worker_options;
+    batch.lineno = 0;
+    batch.succeeded = 0;
+    batch.failed = 0;
+
+    if ( pthread_mutex_init ( &batch.mutex, NULL ) )
+    {
+        perror ( "pthread_mutex_init" );
+        if ( batch.input != stdin )
+        {
+            fclose ( batch.input );
+        }
+        return -1;
+    }
+
+    /* Run all downloads on single event loop if requested */
+    if ( options->engine == ENGINE_EPOLL )
+    {
+        started = 0;
+
+        if ( engine_run ( options, options->jobs, batch_engine_next, batch_engine_done,
+                &batch ) < 0 )
+        {
+            batch.failed++;
+        }
+
+    } else
+    {
+        /* Start download workers */
+        for ( started = 0; started < options->jobs && started < BATCH_JOBS_MAX; started++ )
+        {
+            if ( pthread_create ( &threads[started], NULL, batch_worker, &batch ) )
+            {
+                perror ( "pthread_create" );
+                break;
+            }
+        }
+
+        /* At least one worker is needed */
+        if ( !started )
+        {
+            batch_worker ( &batch );
+        }
+    }
+
+    /* Wait for workers to drain the list */
+    for ( i = 0; i < started; i++ )
+    {
+        pthread_join ( threads[i], NULL );
+    }
+
+    pthread_mutex_destroy ( &batch.mutex );
+
+    if ( batch.input != stdin )
+    {
+        fclose ( batch.input );
+    }
+
+    printf ( "batch: %u succeeded, %u failed, %u total\n", batch.succeeded, batch.failed,
+        batch.succeeded + batch.failed );
+
+    return batch.failed ? -1 : 0;
+}
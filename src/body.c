@@ -0,0 +1,247 @@
+/* ------------------------------------------------------------------
+ * Lget - Http Body Decoder
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Chunked body parser states
+ */
+#define CHUNK_SIZE 0
+#define CHUNK_EXT 1
+#define CHUNK_DATA 2
+#define CHUNK_DATA_END 3
+#define CHUNK_TRAILER 4
+#define CHUNK_TRAILER_LINE 5
+
+/**
+ * Setup body decoder from response header
+ */
+void body_init ( struct body_t *decoder, const struct response_t *response )
+{
+    decoder->state = CHUNK_SIZE;
+    decoder->digits = 0;
+    decoder->remaining = 0;
+    decoder->done = 0;
+
+    /* Chunked coding overrides content length */
+    if ( response->chunked )
+    {
+        decoder->mode = BODY_CHUNKED;
+
+    } else if ( response->has_length )
+    {
+        decoder->mode = BODY_LENGTH;
+        decoder->remaining = response->content_len;
+        decoder->done = !decoder->remaining;
+
+    } else
+    {
+        /* Body is delimited by connection close */
+        decoder->mode = BODY_CLOSE;
+    }
+}
+
+/**
+ * Parse chunk framing byte
+ */
+static int body_chunk_byte ( struct body_t *decoder, char c )
+{
+    int digit;
+
+    switch ( decoder->state )
+    {
+    case CHUNK_SIZE:
+        if ( c >= '0' && c <= '9' )
+        {
+            digit = c - '0';
+
+        } else if ( ( c | 0x20 ) >= 'a' && ( c | 0x20 ) <= 'f' )
+        {
+            digit = ( c | 0x20 ) - 'a' + 10;
+
+        } else if ( c == ';' || c == ' ' || c == '\t' )
+        {
+            decoder->state = CHUNK_EXT;
+            return 0;
+
+        } else if ( c == '\r' )
+        {
+            return 0;
+
+        } else if ( c == '\n' && decoder->digits )
+        {
+            decoder->state = decoder->remaining ? CHUNK_DATA : CHUNK_TRAILER;
+            return 0;
+
+        } else
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        /* Reject chunk size overflow */
+        if ( decoder->remaining > ( ( size_t ) -1 ) >> 4 )
+        {
+            errno = EOVERFLOW;
+            return -1;
+        }
+
+        decoder->remaining = ( decoder->remaining << 4 ) | digit;
+        decoder->digits++;
+        return 0;
+
+    case CHUNK_EXT:
+        /* Chunk extensions are ignored */
+        if ( c == '\n' )
+        {
+            if ( !decoder->digits )
+            {
+                errno = EINVAL;
+                return -1;
+            }
+
+            decoder->state = decoder->remaining ? CHUNK_DATA : CHUNK_TRAILER;
+        }
+        return 0;
+
+    case CHUNK_DATA_END:
+        if ( c == '\n' )
+        {
+            decoder->state = CHUNK_SIZE;
+            decoder->digits = 0;
+
+        } else if ( c != '\r' )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        return 0;
+
+    case CHUNK_TRAILER:
+        /* Empty line terminates trailer section */
+        if ( c == '\n' )
+        {
+            decoder->done = 1;
+
+        } else if ( c != '\r' )
+        {
+            decoder->state = CHUNK_TRAILER_LINE;
+        }
+        return 0;
+
+    case CHUNK_TRAILER_LINE:
+        if ( c == '\n' )
+        {
+            decoder->state = CHUNK_TRAILER;
+        }
+        return 0;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+/**
+ * Decode received body data, payload is returned as a span of the input
+ */
+ssize_t body_decode ( struct body_t *decoder, const char *data, size_t len,
+    const char **payload, size_t *payload_len )
+{
+    size_t i;
+
+    *payload = data;
+    *payload_len = 0;
+
+    if ( decoder->done )
+    {
+        return 0;
+    }
+
+    if ( decoder->mode == BODY_CLOSE )
+    {
+        *payload_len = len;
+        return len;
+    }
+
+    if ( decoder->mode == BODY_LENGTH )
+    {
+        *payload_len = len < decoder->remaining ? len : decoder->remaining;
+        decoder->remaining -= *payload_len;
+        decoder->done = !decoder->remaining;
+        return *payload_len;
+    }
+
+    /* Skip chunk framing up to the next payload bytes */
+    for ( i = 0; i < len && decoder->state != CHUNK_DATA && !decoder->done; i++ )
+    {
+        if ( body_chunk_byte ( decoder, data[i] ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    if ( decoder->state == CHUNK_DATA && i < len )
+    {
+        *payload = data + i;
+        *payload_len = len - i < decoder->remaining ? len - i : decoder->remaining;
+        decoder->remaining -= *payload_len;
+        i += *payload_len;
+
+        if ( !decoder->remaining )
+        {
+            decoder->state = CHUNK_DATA_END;
+        }
+    }
+
+    return i;
+}
+
+/**
+ * Handle connection close while receiving body
+ */
+int body_eof ( struct body_t *decoder )
+{
+    if ( decoder->mode == BODY_CLOSE )
+    {
+        decoder->done = 1;
+    }
+
+    if ( !decoder->done )
+    {
+        errno = EPIPE;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Get body length that may be moved without decoding
+ */
+size_t body_direct_len ( const struct body_t *decoder, size_t size )
+{
+    if ( decoder->done || decoder->mode == BODY_CHUNKED )
+    {
+        return 0;
+    }
+
+    if ( decoder->mode == BODY_LENGTH && decoder->remaining < size )
+    {
+        return decoder->remaining;
+    }
+
+    return size;
+}
+
+/**
+ * Account body data moved past the decoder
+ */
+void body_skip ( struct body_t *decoder, size_t len )
+{
+    if ( decoder->mode == BODY_LENGTH )
+    {
+        decoder->remaining -= len;
+        decoder->done = !decoder->remaining;
+    }
+}
@@ -0,0 +1,342 @@
+/* ------------------------------------------------------------------
+ * Lget - Local Http Cache
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Cached file considered for eviction
+ */
+struct cache_file_t
+{
+    char name[CACHE_NAME_SIZE];
+    size_t size;
+    struct timespec used;
+};
+
+/**
+ * Build path of cache entry file from url hash, suffix tells data and metadata apart
+ */
+static int cache_path ( const char *dir, const char *url, const char *suffix, char *path,
+    size_t size )
+{
+    size_t i;
+    size_t len;
+    struct hash_t hash;
+    unsigned char digest[DIGEST_SIZE_MAX];
+    char name[CACHE_NAME_SIZE];
+
+    hash_init ( &hash, DIGEST_SHA256 );
+    hash_update ( &hash, url, strlen ( url ) );
+    len = hash_final ( &hash, digest );
+
+    for ( i = 0; i < len; i++ )
+    {
+        snprintf ( name + i * 2, sizeof ( name ) - i * 2, "%02x", digest[i] );
+    }
+
+    if ( ( size_t ) snprintf ( path, size, "%s/%s%s", dir, name, suffix ) >= size )
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Load validators of cached copy of url
+ */
+int cache_lookup ( const char *dir, const char *url, struct cache_t *entry )
+{
+    FILE *file;
+    size_t len;
+    struct stat st;
+    char line[HTTP_URL_SIZE + 8];
+    char path[PATH_MAX];
+
+    memset ( entry, '\0', sizeof ( struct cache_t ) );
+
+    if ( cache_path ( dir, url, CACHE_META_SUFFIX, path, sizeof ( path ) ) < 0
+        || !( file = fopen ( path, "r" ) ) )
+    {
+        return -1;
+    }
+
+    /* One field per line, name separated from value by space */
+    while ( fgets ( line, sizeof ( line ), file ) )
+    {
+        if ( ( len = strlen ( line ) ) && line[len - 1] == '\n' )
+        {
+            line[--len] = '\0';
+        }
+
+        if ( !strncmp ( line, "url ", 4 ) && strcmp ( line + 4, url ) )
+        {
+            fclose ( file );
+            return -1;
+
+        } else if ( !strncmp ( line, "etag ", 5 ) && len - 5 < sizeof ( entry->etag ) )
+        {
+            memcpy ( entry->etag, line + 5, len - 4 );
+
+        } else if ( !strncmp ( line, "modified ", 9 ) && len - 9 < sizeof ( entry->modified ) )
+        {
+            memcpy ( entry->modified, line + 9, len - 8 );
+
+        } else if ( !strncmp ( line, "length ", 7 ) )
+        {
+            sscanf ( line + 7, "%lu", ( unsigned long * ) &entry->length );
+        }
+    }
+
+    fclose ( file );
+
+    /* Data must be present and complete */
+    if ( cache_path ( dir, url, "", path, sizeof ( path ) ) < 0 || stat ( path, &st ) < 0
+        || ( size_t ) st.st_size != entry->length || ( !*entry->etag && !*entry->modified ) )
+    {
+        return -1;
+    }
+
+    entry->found = 1;
+
+    return 0;
+}
+
+/**
+ * Append conditional request headers for cached copy
+ */
+void cache_conditional ( const struct cache_t *entry, char *headers, size_t size )
+{
+    size_t len;
+
+    len = strlen ( headers );
+
+    if ( *entry->etag )
+    {
+        len += snprintf ( headers + len, size - len, "If-None-Match: %s\r\n", entry->etag );
+    }
+
+    /* Server prefers entity tag, date is a fallback for servers without one */
+    if ( *entry->modified && len < size )
+    {
+        snprintf ( headers + len, size - len, "If-Modified-Since: %s\r\n", entry->modified );
+    }
+}
+
+/**
+ * Copy validators out of response header, as buffer gets reused for body
+ */
+void cache_validators ( struct cache_t *entry, const struct response_t *response,
+    const char *buffer )
+{
+    memset ( entry, '\0', sizeof ( struct cache_t ) );
+
+    if ( response->etag_len && response->etag_len < sizeof ( entry->etag ) )
+    {
+        memcpy ( entry->etag, buffer + response->etag, response->etag_len );
+    }
+
+    if ( response->last_modified_len && response->last_modified_len < sizeof ( entry->modified ) )
+    {
+        memcpy ( entry->modified, buffer + response->last_modified,
+            response->last_modified_len );
+    }
+}
+
+/**
+ * Place cached copy of unchanged url at output path
+ */
+int cache_restore ( const char *dir, const char *url, const char *filepath )
+{
+    char path[PATH_MAX];
+
+    if ( cache_path ( dir, url, "", path, sizeof ( path ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( file_place ( path, filepath ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Recently used entries are evicted last */
+    utimensat ( AT_FDCWD, path, NULL, 0 );
+
+    return 0;
+}
+
+/**
+ * Order cached files from least recently used
+ */
+static int cache_compare ( const void *a, const void *b )
+{
+    const struct cache_file_t *file_a;
+    const struct cache_file_t *file_b;
+
+    file_a = ( const struct cache_file_t * ) a;
+    file_b = ( const struct cache_file_t * ) b;
+
+    if ( file_a->used.tv_sec != file_b->used.tv_sec )
+    {
+        return file_a->used.tv_sec < file_b->used.tv_sec ? -1 : 1;
+    }
+
+    return file_a->used.tv_nsec < file_b->used.tv_nsec ? -1
+        : file_a->used.tv_nsec > file_b->used.tv_nsec ? 1 : 0;
+}
+
+/**
+ * Evict least recently used entries until cache fits its size limit
+ */
+static int cache_evict ( const char *dir, size_t max )
+{
+    DIR *handle;
+    size_t i;
+    size_t count = 0;
+    size_t limit = 0;
+    size_t total = 0;
+    struct dirent *ent;
+    struct stat st;
+    struct cache_file_t *files = NULL;
+    struct cache_file_t *grown;
+    char path[PATH_MAX];
+
+    if ( !( handle = opendir ( dir ) ) )
+    {
+        return -1;
+    }
+
+    /* Data files are named by hash only */
+    while ( ( ent = readdir ( handle ) ) )
+    {
+        if ( strlen ( ent->d_name ) != CACHE_NAME_SIZE - 1 || strchr ( ent->d_name, '.' )
+            || ( size_t ) snprintf ( path, sizeof ( path ), "%s/%s", dir,
+                ent->d_name ) >= sizeof ( path ) || stat ( path, &st ) < 0 )
+        {
+            continue;
+        }
+
+        if ( count == limit )
+        {
+            limit = limit ? limit * 2 : 64;
+
+            if ( !( grown =
+                    ( struct cache_file_t * ) realloc ( files,
+                        limit * sizeof ( struct cache_file_t ) ) ) )
+            {
+                free ( files );
+                closedir ( handle );
+                return -1;
+            }
+
+            files = grown;
+        }
+
+        memcpy ( files[count].name, ent->d_name, CACHE_NAME_SIZE );
+        files[count].size = st.st_size;
+        files[count].used = st.st_mtim;
+        total += st.st_size;
+        count++;
+    }
+
+    closedir ( handle );
+
+    qsort ( files, count, sizeof ( struct cache_file_t ), cache_compare );
+
+    /* Entries may be evicted by another download meanwhile */
+    for ( i = 0; i < count && total > max; i++ )
+    {
+        snprintf ( path, sizeof ( path ), "%s/%s" CACHE_META_SUFFIX, dir, files[i].name );
+        unlink ( path );
+        snprintf ( path, sizeof ( path ), "%s/%s", dir, files[i].name );
+        unlink ( path );
+        total -= files[i].size;
+    }
+
+    free ( files );
+
+    return 0;
+}
+
+/**
+ * Store downloaded file with its validators, then evict least recently used entries
+ */
+int cache_store ( const char *dir, const char *url, const struct cache_t *entry,
+    const char *filepath, size_t max )
+{
+    FILE *file;
+    int error;
+    struct stat st;
+    char path[PATH_MAX];
+    char meta[PATH_MAX];
+    char tmp[PATH_MAX];
+
+    /* Only complete regular files with validators may be revalidated */
+    if ( ( !*entry->etag && !*entry->modified ) || stat ( filepath, &st ) < 0
+        || !S_ISREG ( st.st_mode ) )
+    {
+        return 0;
+    }
+
+    if ( cache_path ( dir, url, "", path, sizeof ( path ) ) < 0
+        || cache_path ( dir, url, CACHE_META_SUFFIX, meta, sizeof ( meta ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Temporary names are unique among concurrent downloads */
+    if ( ( size_t ) snprintf ( tmp, sizeof ( tmp ), "%s.%lu.%lx.tmp", path,
+            ( unsigned long ) getpid (  ), ( unsigned long ) pthread_self (  ) ) >= sizeof ( tmp ) )
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    /* Stale metadata goes first, so entry is never paired with foreign data */
+    unlink ( meta );
+
+    if ( file_clone ( filepath, tmp ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( rename ( tmp, path ) < 0 )
+    {
+        error = errno;
+        unlink ( tmp );
+        errno = error;
+        return -1;
+    }
+
+    if ( !( file = fopen ( tmp, "w" ) ) )
+    {
+        return -1;
+    }
+
+    fprintf ( file, "url %s\n", url );
+
+    if ( *entry->etag )
+    {
+        fprintf ( file, "etag %s\n", entry->etag );
+    }
+
+    if ( *entry->modified )
+    {
+        fprintf ( file, "modified %s\n", entry->modified );
+    }
+
+    fprintf ( file, "length %lu\n", ( unsigned long ) st.st_size );
+
+    if ( fclose ( file ) || rename ( tmp, meta ) < 0 )
+    {
+        error = errno;
+        unlink ( tmp );
+        errno = error;
+        return -1;
+    }
+
+    return cache_evict ( dir, max );
+}
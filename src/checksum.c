@@ -0,0 +1,209 @@
+/* ------------------------------------------------------------------
+ * Lget - Streaming Checksum Verification
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Checksum thread, hashes output file in order up to the written prefix
+ */
+static void *checksum_thread ( void *arg )
+{
+    ssize_t len;
+    size_t ready;
+    size_t limit;
+    struct checksum_t *checksum;
+
+    checksum = ( struct checksum_t * ) arg;
+
+    for ( ;; )
+    {
+        pthread_mutex_lock ( &checksum->mutex );
+
+        while ( checksum->hashed >= checksum->ready && !checksum->stop )
+        {
+            pthread_cond_wait ( &checksum->cond, &checksum->mutex );
+        }
+
+        ready = checksum->ready;
+
+        if ( checksum->hashed >= ready )
+        {
+            pthread_mutex_unlock ( &checksum->mutex );
+            break;
+        }
+
+        pthread_mutex_unlock ( &checksum->mutex );
+
+        /* Written data is still in page cache, reading it back costs no disk I/O */
+        while ( checksum->hashed < ready )
+        {
+            limit = ready - checksum->hashed < CHECKSUM_BUFFER_SIZE
+                ? ready - checksum->hashed : CHECKSUM_BUFFER_SIZE;
+
+            if ( ( len = pread ( checksum->fd, checksum->buffer, limit, checksum->hashed ) ) <= 0 )
+            {
+                checksum->error = len < 0 ? errno : EIO;
+                return NULL;
+            }
+
+            hash_update ( &checksum->hash, checksum->buffer, len );
+            checksum->hashed += len;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Start checksum of output file, prefix up to ready offset is already written
+ */
+int checksum_start ( struct checksum_t *checksum, const struct digest_t *expected,
+    const char *filepath, size_t ready )
+{
+    struct stat st;
+
+    checksum->expected = expected;
+    checksum->running = 0;
+
+    if ( !expected )
+    {
+        return 0;
+    }
+
+    checksum->hashed = 0;
+    checksum->ready = ready;
+    checksum->stop = 0;
+    checksum->error = 0;
+    hash_init ( &checksum->hash, expected->algorithm );
+
+    /* Output is read back, so it must be a regular file */
+    if ( ( checksum->fd = open ( filepath, O_RDONLY ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( fstat ( checksum->fd, &st ) < 0 || !S_ISREG ( st.st_mode ) )
+    {
+        close ( checksum->fd );
+        errno = ESPIPE;
+        return -1;
+    }
+
+    if ( !( checksum->buffer = ( char * ) malloc ( CHECKSUM_BUFFER_SIZE ) ) )
+    {
+        close ( checksum->fd );
+        return -1;
+    }
+
+    if ( pthread_mutex_init ( &checksum->mutex, NULL ) )
+    {
+        free ( checksum->buffer );
+        close ( checksum->fd );
+        return -1;
+    }
+
+    if ( pthread_cond_init ( &checksum->cond, NULL ) )
+    {
+        pthread_mutex_destroy ( &checksum->mutex );
+        free ( checksum->buffer );
+        close ( checksum->fd );
+        return -1;
+    }
+
+    if ( pthread_create ( &checksum->thread, NULL, checksum_thread, checksum ) )
+    {
+        pthread_cond_destroy ( &checksum->cond );
+        pthread_mutex_destroy ( &checksum->mutex );
+        free ( checksum->buffer );
+        close ( checksum->fd );
+        return -1;
+    }
+
+    checksum->running = 1;
+
+    return 0;
+}
+
+/**
+ * Advance written prefix of output file, wakes checksum thread in steps
+ */
+void checksum_update ( struct checksum_t *checksum, size_t ready )
+{
+    if ( !checksum->running
+        || ready < __atomic_load_n ( &checksum->ready, __ATOMIC_RELAXED ) + CHECKSUM_STEP )
+    {
+        return;
+    }
+
+    pthread_mutex_lock ( &checksum->mutex );
+
+    /* Segments may report out of order */
+    if ( ready > checksum->ready )
+    {
+        __atomic_store_n ( &checksum->ready, ready, __ATOMIC_RELAXED );
+        pthread_cond_signal ( &checksum->cond );
+    }
+
+    pthread_mutex_unlock ( &checksum->mutex );
+}
+
+/**
+ * Stop checksum thread after hashing up to given size
+ */
+static void checksum_stop ( struct checksum_t *checksum, size_t total )
+{
+    pthread_mutex_lock ( &checksum->mutex );
+    checksum->ready = total;
+    checksum->stop = 1;
+    pthread_cond_signal ( &checksum->cond );
+    pthread_mutex_unlock ( &checksum->mutex );
+
+    pthread_join ( checksum->thread, NULL );
+    pthread_cond_destroy ( &checksum->cond );
+    pthread_mutex_destroy ( &checksum->mutex );
+    free ( checksum->buffer );
+    close ( checksum->fd );
+    checksum->running = 0;
+}
+
+/**
+ * Complete checksum of output file with final size and compare it
+ */
+int checksum_finish ( struct checksum_t *checksum, size_t total )
+{
+    unsigned char digest[DIGEST_SIZE_MAX];
+
+    if ( !checksum->running )
+    {
+        return 0;
+    }
+
+    checksum_stop ( checksum, total );
+
+    if ( checksum->error )
+    {
+        errno = checksum->error;
+        return -1;
+    }
+
+    if ( hash_final ( &checksum->hash, digest ) != checksum->expected->len
+        || memcmp ( digest, checksum->expected->value, checksum->expected->len ) )
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Abandon checksum of failed download
+ */
+void checksum_cancel ( struct checksum_t *checksum )
+{
+    if ( checksum->running )
+    {
+        checksum_stop ( checksum, 0 );
+    }
+}
@@ -0,0 +1,303 @@
+/* ------------------------------------------------------------------
+ * Lget - Parallel Connect Support
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Get monotonic time in milliseconds
+ */
+static unsigned long connect_now ( void )
+{
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Fill socket address from resolved address and port
+ */
+socklen_t connect_sockaddr ( const struct address_t *address, unsigned short port,
+    struct sockaddr_storage *saddr )
+{
+    struct sockaddr_in *saddr4;
+    struct sockaddr_in6 *saddr6;
+
+    memset ( saddr, '\0', sizeof ( struct sockaddr_storage ) );
+
+    if ( address->family == AF_INET6 )
+    {
+        saddr6 = ( struct sockaddr_in6 * ) saddr;
+        saddr6->sin6_family = AF_INET6;
+        saddr6->sin6_addr = address->addr.v6;
+        saddr6->sin6_port = htons ( port );
+        return sizeof ( struct sockaddr_in6 );
+    }
+
+    saddr4 = ( struct sockaddr_in * ) saddr;
+    saddr4->sin_family = AF_INET;
+    saddr4->sin_addr = address->addr.v4;
+    saddr4->sin_port = htons ( port );
+    return sizeof ( struct sockaddr_in );
+}
+
+/**
+ * Apply socket options selected on command line before connect
+ */
+int connect_setup ( int sock, const struct options_t *options )
+{
+    int enable = 1;
+    int size;
+    struct timeval timeout;
+
+    /* Receive buffer must be sized before handshake to affect window scaling */
+    if ( options->rcvbuf )
+    {
+        size = options->rcvbuf;
+
+        if ( setsockopt ( sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof ( size ) ) < 0 )
+        {
+            perror ( "SO_RCVBUF" );
+            return -1;
+        }
+    }
+
+    /* Stalled receive returns instead of blocking forever */
+    if ( options->recv_timeout )
+    {
+        timeout.tv_sec = options->recv_timeout / 1000;
+        timeout.tv_usec = ( options->recv_timeout % 1000 ) * 1000;
+
+        if ( setsockopt ( sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof ( timeout ) ) < 0 )
+        {
+            perror ( "SO_RCVTIMEO" );
+            return -1;
+        }
+    }
+
+    if ( options->nodelay
+        && setsockopt ( sock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof ( enable ) ) < 0 )
+    {
+        perror ( "TCP_NODELAY" );
+        return -1;
+    }
+
+    if ( options->congestion
+        && setsockopt ( sock, IPPROTO_TCP, TCP_CONGESTION, options->congestion,
+            strlen ( options->congestion ) ) < 0 )
+    {
+        perror ( "TCP_CONGESTION" );
+        return -1;
+    }
+
+#ifdef TCP_FASTOPEN_CONNECT
+    /* Handshake is deferred until first write, which then travels within SYN */
+    if ( options->fastopen
+        && setsockopt ( sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &enable,
+            sizeof ( enable ) ) < 0 )
+    {
+        perror ( "TCP_FASTOPEN_CONNECT" );
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * Start non-blocking connect with server address
+ */
+static int connect_start ( const struct address_t *address, unsigned short port,
+    const struct options_t *options )
+{
+    int sock;
+    socklen_t saddr_len;
+    struct sockaddr_storage saddr;
+
+    /* Prepare server address */
+    saddr_len = connect_sockaddr ( address, port, &saddr );
+
+    /* Create non-blocking server socket */
+    if ( ( sock = socket ( saddr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0 ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( connect_setup ( sock, options ) < 0 )
+    {
+        close ( sock );
+        return -1;
+    }
+
+    /* Start connecting with server */
+    if ( connect ( sock, ( struct sockaddr * ) &saddr, saddr_len ) < 0 && errno != EINPROGRESS )
+    {
+        close ( sock );
+        return -1;
+    }
+
+    return sock;
+}
+
+/**
+ * Connect with first responding of server addresses, attempts are staggered
+ */
+int connect_race ( const struct address_t *addrs, size_t count, unsigned short port,
+    const struct options_t *options )
+{
+    int ret;
+    int enable = 1;
+    int flags;
+    int error;
+    int sock = -1;
+    int last_error = ETIMEDOUT;
+    size_t i;
+    size_t started = 0;
+    size_t pending = 0;
+    socklen_t optlen;
+    unsigned long now;
+    unsigned long next;
+    unsigned long deadline;
+    unsigned long timeout;
+    struct pollfd fds[RESOLVE_ADDRS_MAX];
+    struct options_t race;
+
+    if ( count > RESOLVE_ADDRS_MAX )
+    {
+        count = RESOLVE_ADDRS_MAX;
+    }
+
+    /* Deferred fast open handshake reports connected at once, so it would win every race */
+    if ( options->fastopen && count > 1 )
+    {
+        race = *options;
+        race.fastopen = 0;
+        options = &race;
+    }
+
+    next = connect_now (  );
+    deadline = next + CONNECT_TIMEOUT_MSEC;
+
+    while ( sock < 0 )
+    {
+        now = connect_now (  );
+
+        /* Start next attempt once delay expires or previous ones failed */
+        if ( started < count && ( now >= next || !pending ) )
+        {
+            if ( ( fds[started].fd = connect_start ( &addrs[started], port, options ) ) >= 0 )
+            {
+                /* Every attempt gets full timeout */
+                deadline = now + CONNECT_TIMEOUT_MSEC;
+                pending++;
+
+            } else
+            {
+                last_error = errno;
+            }
+
+            fds[started].events = POLLOUT;
+            fds[started].revents = 0;
+            started++;
+            next = now + CONNECT_DELAY_MSEC;
+            continue;
+        }
+
+        if ( !pending )
+        {
+            break;
+        }
+
+        if ( now >= deadline )
+        {
+            last_error = ETIMEDOUT;
+            break;
+        }
+
+        timeout = deadline - now;
+
+        if ( started < count && next - now < timeout )
+        {
+            timeout = next - now;
+        }
+
+        /* Negative descriptors of failed attempts are ignored */
+        if ( ( ret = poll ( fds, started, timeout ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            last_error = errno;
+            break;
+        }
+
+        for ( i = 0; i < started && ret > 0; i++ )
+        {
+            if ( fds[i].fd < 0 || !fds[i].revents )
+            {
+                continue;
+            }
+
+            ret--;
+            error = 0;
+            optlen = sizeof ( error );
+
+            if ( getsockopt ( fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &optlen ) < 0 )
+            {
+                error = errno;
+            }
+
+            if ( !error )
+            {
+                sock = fds[i].fd;
+                fds[i].fd = -1;
+                break;
+            }
+
+            /* Refused address is replaced without waiting for delay */
+            close ( fds[i].fd );
+            fds[i].fd = -1;
+            pending--;
+            last_error = error;
+            next = now;
+        }
+    }
+
+    /* Cancel remaining attempts */
+    for ( i = 0; i < started; i++ )
+    {
+        if ( fds[i].fd >= 0 )
+        {
+            close ( fds[i].fd );
+        }
+    }
+
+    if ( sock < 0 )
+    {
+        errno = last_error;
+        return -1;
+    }
+
+    /* Connected socket is used in blocking mode */
+    if ( ( flags = fcntl ( sock, F_GETFL ) ) < 0
+        || fcntl ( sock, F_SETFL, flags & ~O_NONBLOCK ) < 0 )
+    {
+        close ( sock );
+        return -1;
+    }
+
+    /* Acknowledge response header at once, kernel may leave quick ack mode later */
+    if ( options->quickack
+        && setsockopt ( sock, IPPROTO_TCP, TCP_QUICKACK, &enable, sizeof ( enable ) ) < 0 )
+    {
+        perror ( "TCP_QUICKACK" );
+        close ( sock );
+        return -1;
+    }
+
+    return sock;
+}
@@ -0,0 +1,1003 @@
+/* ------------------------------------------------------------------
+ * Lget - Delta Download Against Block Manifest
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Manifest block, with offset of matching data found in local copy
+ */
+struct block_t
+{
+    uint32_t weak;
+    unsigned char strong[DELTA_STRONG_SIZE];
+    ssize_t source;
+    ssize_t next;
+};
+
+/**
+ * Delta download state
+ */
+struct delta_t
+{
+    size_t length;
+    size_t block_size;
+    size_t count;
+    struct digest_t digest;
+    struct block_t *blocks;
+    ssize_t *heads;
+    unsigned int bits;
+    int fd;
+    char *buffer;
+    size_t size;
+    size_t requests;
+    size_t fetched;
+    struct options_t options;
+    struct progress_t progress;
+    char target[HTTP_URL_SIZE];
+};
+
+/**
+ * Compute rolling checksum sums of data window
+ */
+static void delta_weak_init ( const unsigned char *data, size_t len, uint32_t *a, uint32_t *b )
+{
+    size_t i;
+
+    *a = 0;
+    *b = 0;
+
+    for ( i = 0; i < len; i++ )
+    {
+        *a += data[i];
+        *b += ( uint32_t ) ( len - i ) * data[i];
+    }
+}
+
+/**
+ * Combine rolling checksum sums into weak checksum
+ */
+static uint32_t delta_weak ( uint32_t a, uint32_t b )
+{
+    return ( a & 0xffff ) | ( b << 16 );
+}
+
+/**
+ * Compute strong checksum of block
+ */
+static void delta_strong ( const unsigned char *data, size_t len, unsigned char *strong )
+{
+    struct hash_t hash;
+    unsigned char digest[DIGEST_SIZE_MAX];
+
+    hash_init ( &hash, DIGEST_MD5 );
+    hash_update ( &hash, data, len );
+    hash_final ( &hash, digest );
+    memcpy ( strong, digest, DELTA_STRONG_SIZE );
+}
+
+/**
+ * Pick block size, so that manifest of large file stays small
+ */
+static size_t delta_block_size ( size_t length )
+{
+    size_t block_size = DELTA_BLOCK_MIN;
+
+    while ( length / block_size > DELTA_BLOCKS_TARGET && block_size < DELTA_BLOCK_MAX )
+    {
+        block_size *= 2;
+    }
+
+    return block_size;
+}
+
+/**
+ * Write data slice at given file offset
+ */
+static int delta_write ( int fd, const void *data, size_t len, size_t offset )
+{
+    ssize_t ret;
+
+    while ( len )
+    {
+        if ( ( ret = pwrite ( fd, data, len, offset ) ) < 0 )
+        {
+            return -1;
+        }
+
+        data = ( const char * ) data + ret;
+        len -= ret;
+        offset += ret;
+    }
+
+    return 0;
+}
+
+/**
+ * Read block sized slice, only the last one may come short
+ */
+static ssize_t delta_read ( int fd, unsigned char *data, size_t len )
+{
+    ssize_t ret;
+    size_t sum = 0;
+
+    while ( sum < len )
+    {
+        if ( ( ret = read ( fd, data + sum, len - sum ) ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( !ret )
+        {
+            break;
+        }
+
+        sum += ret;
+    }
+
+    return sum;
+}
+
+/**
+ * Generate block manifest of file, weak and strong checksum per block and whole file digest
+ */
+int delta_manifest ( const char *filepath, const char *manifest )
+{
+    int fd;
+    FILE *file;
+    ssize_t len;
+    size_t i;
+    size_t count;
+    size_t block_size;
+    uint32_t a;
+    uint32_t b;
+    struct stat st;
+    struct hash_t hash;
+    struct digest_t digest;
+    struct block_t *blocks;
+    unsigned char *data;
+    char hex[DIGEST_SIZE_MAX * 2 + 1];
+
+    if ( ( fd = open ( filepath, O_RDONLY ) ) < 0 )
+    {
+        perror ( "open" );
+        return -1;
+    }
+
+    if ( fstat ( fd, &st ) < 0 )
+    {
+        perror ( "fstat" );
+        close ( fd );
+        return -1;
+    }
+
+    block_size = delta_block_size ( st.st_size );
+    count = ( st.st_size + block_size - 1 ) / block_size;
+
+    if ( !( data = ( unsigned char * ) malloc ( block_size ) ) )
+    {
+        perror ( "malloc" );
+        close ( fd );
+        return -1;
+    }
+
+    if ( !( blocks =
+            ( struct block_t * ) calloc ( count ? count : 1, sizeof ( struct block_t ) ) ) )
+    {
+        perror ( "calloc" );
+        free ( data );
+        close ( fd );
+        return -1;
+    }
+
+    hash_init ( &hash, DIGEST_SHA256 );
+
+    /* Blocks and whole file digest are computed in a single pass */
+    for ( i = 0; i < count; i++ )
+    {
+        if ( ( len = delta_read ( fd, data, block_size ) ) <= 0
+            || ( i + 1 < count && ( size_t ) len != block_size ) )
+        {
+            errno = len < 0 ? errno : EIO;
+            perror ( "read" );
+            free ( blocks );
+            free ( data );
+            close ( fd );
+            return -1;
+        }
+
+        delta_weak_init ( data, len, &a, &b );
+        blocks[i].weak = delta_weak ( a, b );
+        delta_strong ( data, len, blocks[i].strong );
+        hash_update ( &hash, data, len );
+    }
+
+    free ( data );
+    close ( fd );
+
+    digest.algorithm = DIGEST_SHA256;
+    digest.len = hash_final ( &hash, digest.value );
+    digest_hex ( &digest, hex );
+
+    if ( !( file = fopen ( manifest, "w" ) ) )
+    {
+        perror ( "fopen" );
+        free ( blocks );
+        return -1;
+    }
+
+    /* Header lines, then one line per block */
+    fprintf ( file, "%s\nlength %lu\nblocksize %lu\nhash %s:%s\n", DELTA_MAGIC,
+        ( unsigned long ) st.st_size, ( unsigned long ) block_size,
+        digest_name ( digest.algorithm ), hex );
+
+    for ( i = 0; i < count; i++ )
+    {
+        fprintf ( file, "%08x ", blocks[i].weak );
+
+        for ( len = 0; len < DELTA_STRONG_SIZE; len++ )
+        {
+            fprintf ( file, "%02x", blocks[i].strong[len] );
+        }
+
+        fputc ( '\n', file );
+    }
+
+    free ( blocks );
+
+    if ( fclose ( file ) )
+    {
+        perror ( "fclose" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Load block manifest
+ */
+static int delta_load ( const char *manifest, struct delta_t *delta )
+{
+    FILE *file;
+    size_t i;
+    unsigned long length;
+    unsigned long block_size;
+    unsigned int weak;
+    struct digest_t strong;
+    char spec[DIGEST_SIZE_MAX * 2 + 16];
+    char line[DIGEST_SIZE_MAX * 2 + 16];
+
+    if ( !( file = fopen ( manifest, "r" ) ) )
+    {
+        return -1;
+    }
+
+    /* Header gives layout of blocks and digest of the whole file */
+    if ( !fgets ( line, sizeof ( line ), file ) || strncmp ( line, DELTA_MAGIC "\n",
+            sizeof ( DELTA_MAGIC ) ) || fscanf ( file, "length %lu\n", &length ) != 1
+        || fscanf ( file, "blocksize %lu\n", &block_size ) != 1
+        || fscanf ( file, "hash %79s\n", spec ) != 1
+        || digest_parse ( spec, &delta->digest ) < 0 || block_size < DELTA_BLOCK_MIN
+        || block_size > DELTA_BLOCK_MAX || length / block_size >= DELTA_BLOCKS_MAX )
+    {
+        fclose ( file );
+        errno = EINVAL;
+        return -1;
+    }
+
+    delta->length = length;
+    delta->block_size = block_size;
+    delta->count = ( length + block_size - 1 ) / block_size;
+
+    if ( !( delta->blocks =
+            ( struct block_t * ) calloc ( delta->count ? delta->count : 1,
+                sizeof ( struct block_t ) ) ) )
+    {
+        fclose ( file );
+        return -1;
+    }
+
+    for ( i = 0; i < delta->count; i++ )
+    {
+        if ( fscanf ( file, "%8x %40s\n", &weak, line ) != 2
+            || ( size_t ) snprintf ( spec, sizeof ( spec ), "md5:%s", line ) >= sizeof ( spec )
+            || digest_parse ( spec, &strong ) < 0 )
+        {
+            free ( delta->blocks );
+            fclose ( file );
+            errno = EINVAL;
+            return -1;
+        }
+
+        delta->blocks[i].weak = weak;
+        memcpy ( delta->blocks[i].strong, strong.value, DELTA_STRONG_SIZE );
+        delta->blocks[i].source = -1;
+    }
+
+    fclose ( file );
+
+    return 0;
+}
+
+/**
+ * Get hash table bucket of weak checksum
+ */
+static size_t delta_bucket ( const struct delta_t *delta, uint32_t weak )
+{
+    return ( uint32_t ) ( weak * 2654435761u ) >> ( 32 - delta->bits );
+}
+
+/**
+ * Index full blocks by weak checksum, table is at least twice the blocks count
+ */
+static int delta_index ( struct delta_t *delta, size_t full )
+{
+    size_t i;
+    size_t bucket;
+
+    for ( delta->bits = 4; ( ( size_t ) 1 << delta->bits ) < full * 2; delta->bits++ )
+    {
+    }
+
+    if ( !( delta->heads =
+            ( ssize_t * ) malloc ( ( ( size_t ) 1 << delta->bits ) * sizeof ( ssize_t ) ) ) )
+    {
+        return -1;
+    }
+
+    for ( i = 0; i < ( ( size_t ) 1 << delta->bits ); i++ )
+    {
+        delta->heads[i] = -1;
+    }
+
+    for ( i = full; i > 0; i-- )
+    {
+        bucket = delta_bucket ( delta, delta->blocks[i - 1].weak );
+        delta->blocks[i - 1].next = delta->heads[bucket];
+        delta->heads[bucket] = i - 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Mark blocks matching window of local copy, returns if any block matched
+ */
+static int delta_match ( struct delta_t *delta, const unsigned char *data, size_t pos,
+    uint32_t weak, size_t *found )
+{
+    int hashed = 0;
+    int matched = 0;
+    ssize_t j;
+    unsigned char strong[DELTA_STRONG_SIZE];
+
+    for ( j = delta->heads[delta_bucket ( delta, weak )]; j >= 0; j = delta->blocks[j].next )
+    {
+        if ( delta->blocks[j].weak != weak )
+        {
+            continue;
+        }
+
+        /* Strong checksum is computed once weak one matches */
+        if ( !hashed )
+        {
+            delta_strong ( data + pos, delta->block_size, strong );
+            hashed = 1;
+        }
+
+        if ( memcmp ( delta->blocks[j].strong, strong, DELTA_STRONG_SIZE ) )
+        {
+            continue;
+        }
+
+        /* Repeated blocks are all taken from the same data */
+        if ( delta->blocks[j].source < 0 )
+        {
+            delta->blocks[j].source = pos;
+            ( *found )++;
+        }
+
+        matched = 1;
+    }
+
+    return matched;
+}
+
+/**
+ * Scan local copy for blocks of manifest at any offset
+ */
+static void delta_scan ( struct delta_t *delta, const unsigned char *data, size_t size )
+{
+    size_t pos = 0;
+    size_t full;
+    size_t tail;
+    size_t found = 0;
+    size_t block_size;
+    uint32_t a;
+    uint32_t b;
+    unsigned char strong[DELTA_STRONG_SIZE];
+
+    block_size = delta->block_size;
+    tail = delta->length % block_size;
+    full = delta->count - ( tail ? 1 : 0 );
+
+    /* Short last block is only looked for at its own offset */
+    if ( tail && size >= delta->length )
+    {
+        delta_strong ( data + delta->length - tail, tail, strong );
+
+        if ( !memcmp ( delta->blocks[full].strong, strong, DELTA_STRONG_SIZE ) )
+        {
+            delta->blocks[full].source = delta->length - tail;
+            found++;
+        }
+    }
+
+    if ( !full || size < block_size )
+    {
+        return;
+    }
+
+    delta_weak_init ( data, block_size, &a, &b );
+
+    /* Window rolls byte by byte, and skips a whole block after a match */
+    for ( ;; )
+    {
+        if ( delta_match ( delta, data, pos, delta_weak ( a, b ), &found ) )
+        {
+            if ( found == delta->count )
+            {
+                break;
+            }
+
+            if ( pos + block_size * 2 <= size )
+            {
+                pos += block_size;
+                delta_weak_init ( data + pos, block_size, &a, &b );
+                continue;
+            }
+        }
+
+        if ( pos + block_size >= size )
+        {
+            break;
+        }
+
+        a = a - data[pos] + data[pos + block_size];
+        b = b - ( uint32_t ) block_size * data[pos] + a;
+        pos++;
+    }
+}
+
+/**
+ * Find next range to fetch from block index, nearby missing blocks share one range
+ */
+static int delta_next ( const struct delta_t *delta, size_t *index, size_t *begin, size_t *end )
+{
+    size_t i;
+    size_t first;
+    size_t last;
+
+    for ( first = *index; first < delta->count && delta->blocks[first].source >= 0; first++ )
+    {
+    }
+
+    if ( first == delta->count )
+    {
+        return 0;
+    }
+
+    /* Refetching short gap of found blocks is cheaper than another request */
+    for ( last = first, i = first + 1;
+        i < delta->count && ( i - last - 1 ) * delta->block_size < DELTA_GAP_SIZE; i++ )
+    {
+        if ( delta->blocks[i].source < 0 )
+        {
+            last = i;
+        }
+    }
+
+    *index = last + 1;
+    *begin = first * delta->block_size;
+    *end = ( last + 1 ) * delta->block_size < delta->length
+        ? ( last + 1 ) * delta->block_size : delta->length;
+
+    return 1;
+}
+
+/**
+ * Fetch range of missing data into output, position advances as data is written
+ */
+static int delta_fetch ( struct delta_t *delta, size_t *pos, size_t end, struct retry_t *retry )
+{
+    int sock;
+    int keepalive;
+    unsigned int hops = 0;
+    unsigned short port;
+    ssize_t ret;
+    size_t len;
+    const char *path;
+    struct response_t response;
+    struct stall_t stall;
+    char hostname[HOSTNAME_SIZE];
+    char location[HTTP_URL_SIZE];
+    char range[64];
+
+    snprintf ( range, sizeof ( range ), "Range: bytes=%lu-%lu\r\n", ( unsigned long ) *pos,
+        ( unsigned long ) end - 1 );
+
+    /* Redirect target is kept for the following ranges */
+    for ( ;; )
+    {
+        if ( ( sock = http_query ( delta->target, range, &delta->options, &delta->buffer,
+                    &delta->size, &len, &response ) ) < 0 )
+        {
+            retry->error = errno;
+            return -1;
+        }
+
+        delta->requests++;
+        retry->status = response.status;
+
+        if ( !response_redirect ( &response ) )
+        {
+            break;
+        }
+
+        close ( sock );
+
+        if ( ++hops > delta->options.redirects
+            || response_location ( &response, delta->buffer, delta->target, location,
+                sizeof ( location ) ) < 0 )
+        {
+            errno = ELOOP;
+            retry->error = errno;
+            perror ( "redirect" );
+            return -1;
+        }
+
+        memcpy ( delta->target, location, sizeof ( location ) );
+    }
+
+    keepalive = response_keepalive ( &response );
+
+    if ( response.status != 200 && response.status != 206 )
+    {
+        errno = response.status;
+        perror ( "http status" );
+        errno = EINVAL;
+        retry->error = errno;
+        close ( sock );
+        return -1;
+    }
+
+    /* Server without range support sends the whole file instead, progress starts over */
+    if ( response.status == 200 && response.has_length && response.content_len == delta->length )
+    {
+        *pos = 0;
+        end = delta->length;
+        progress_stop ( &delta->progress, -1 );
+        progress_start ( &delta->progress, delta->progress.name, 0, delta->length,
+            delta->options.progress );
+
+    } else if ( response.status != 206 || !response.has_range || response.range_begin != *pos
+        || response.range_end != end - 1 || response.range_total != delta->length )
+    {
+        errno = EINVAL;
+        retry->error = errno;
+        perror ( "range" );
+        close ( sock );
+        return -1;
+    }
+
+    /* Copy first data slice */
+    len -= response.header_len;
+
+    if ( len > end - *pos )
+    {
+        len = end - *pos;
+        keepalive = 0;
+    }
+
+    if ( len )
+    {
+        if ( delta_write ( delta->fd, delta->buffer + response.header_len, len, *pos ) < 0 )
+        {
+            retry->error = errno;
+            perror ( "pwrite" );
+            close ( sock );
+            return -1;
+        }
+
+        *pos += len;
+        delta->fetched += len;
+        progress_add ( &delta->progress, len );
+    }
+
+    mirror_stall_start ( &stall, *pos, delta->options.min_speed );
+
+    while ( *pos < end )
+    {
+        if ( ( ret = recv ( sock, delta->buffer,
+                    end - *pos < delta->size ? end - *pos : delta->size, 0 ) ) <= 0 )
+        {
+            if ( !ret )
+            {
+                errno = EPIPE;
+
+            } else if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                errno = ETIMEDOUT;
+            }
+
+            retry->error = errno;
+            perror ( "recv" );
+            close ( sock );
+            return -1;
+        }
+
+        if ( delta_write ( delta->fd, delta->buffer, ret, *pos ) < 0 )
+        {
+            retry->error = errno;
+            perror ( "pwrite" );
+            close ( sock );
+            return -1;
+        }
+
+        *pos += ret;
+        delta->fetched += ret;
+        progress_add ( &delta->progress, ret );
+
+        if ( mirror_stall_check ( &stall, *pos ) < 0 )
+        {
+            retry->error = errno;
+            perror ( "stall" );
+            close ( sock );
+            return -1;
+        }
+    }
+
+    if ( keepalive && !http_parse_url ( delta->target, hostname, sizeof ( hostname ), &port,
+            &path ) )
+    {
+        pool_release ( sock, hostname, port, delta->options.socks5 );
+
+    } else
+    {
+        close ( sock );
+    }
+
+    return response.status == 200;
+}
+
+/**
+ * Load manifest from local path or from url
+ */
+static int delta_manifest_load ( const char *filepath, const struct options_t *options,
+    struct delta_t *delta )
+{
+    int ret;
+    int error;
+    struct options_t current;
+    char path[PATH_MAX];
+
+    if ( strncmp ( options->delta, "http://", 7 ) )
+    {
+        return delta_load ( options->delta, delta );
+    }
+
+    /* Manifest is fetched aside the output and dropped once loaded */
+    if ( ( size_t ) snprintf ( path, sizeof ( path ), "%s.%lu.manifest", filepath,
+            ( unsigned long ) getpid (  ) ) >= sizeof ( path ) )
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    current = *options;
+    current.delta = NULL;
+    current.checksum = NULL;
+    current.cache = NULL;
+    current.store = NULL;
+
+    if ( http_get ( options->delta, path, &current ) < 0 )
+    {
+        unlink ( path );
+        return -1;
+    }
+
+    ret = delta_load ( path, delta );
+    error = errno;
+    unlink ( path );
+    errno = error;
+
+    return ret;
+}
+
+/**
+ * Scan local copy of the file and copy blocks found into new output, returns reused bytes
+ */
+static ssize_t delta_reuse ( struct delta_t *delta, const char *filepath )
+{
+    int fd;
+    size_t i;
+    size_t len;
+    size_t reused = 0;
+    struct stat st;
+    unsigned char *data;
+
+    /* Without local copy every block is fetched */
+    if ( ( fd = open ( filepath, O_RDONLY ) ) < 0 )
+    {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    if ( fstat ( fd, &st ) < 0 )
+    {
+        close ( fd );
+        return -1;
+    }
+
+    if ( !S_ISREG ( st.st_mode ) )
+    {
+        close ( fd );
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( !st.st_size )
+    {
+        close ( fd );
+        return 0;
+    }
+
+    if ( ( data = ( unsigned char * ) mmap ( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd,
+                0 ) ) == MAP_FAILED )
+    {
+        close ( fd );
+        return -1;
+    }
+
+    madvise ( data, st.st_size, MADV_SEQUENTIAL );
+
+    delta_scan ( delta, data, st.st_size );
+
+    /* Found blocks may come from any offset of local copy */
+    for ( i = 0; i < delta->count; i++ )
+    {
+        if ( delta->blocks[i].source < 0 )
+        {
+            continue;
+        }
+
+        len = i + 1 < delta->count ? delta->block_size : delta->length - i * delta->block_size;
+
+        if ( delta_write ( delta->fd, data + delta->blocks[i].source, len,
+                i * delta->block_size ) < 0 )
+        {
+            munmap ( data, st.st_size );
+            close ( fd );
+            return -1;
+        }
+
+        reused += len;
+    }
+
+    munmap ( data, st.st_size );
+    close ( fd );
+
+    return reused;
+}
+
+/**
+ * Fetch all missing ranges, each retried as the retry policy allows
+ */
+static int delta_transfer ( struct delta_t *delta, const char *url,
+    const struct options_t *options )
+{
+    int ret = 0;
+    unsigned int attempt;
+    unsigned long delay;
+    size_t index = 0;
+    size_t begin;
+    size_t end;
+    struct retry_t retry;
+
+    while ( delta_next ( delta, &index, &begin, &end ) )
+    {
+        /* Retry continues after data already written */
+        for ( attempt = 0;; attempt++ )
+        {
+            memset ( &retry, '\0', sizeof ( retry ) );
+
+            if ( ( ret = delta_fetch ( delta, &begin, end, &retry ) ) >= 0
+                || attempt >= options->retries || !retry_allowed ( options, &retry, retry.error ) )
+            {
+                break;
+            }
+
+            delay = retry_delay ( options, &retry, attempt );
+
+            if ( options->progress )
+            {
+                printf ( "retry: %s in %lu ms, attempt %u of %u\n", url, delay, attempt + 2,
+                    options->retries + 1 );
+            }
+
+            retry_sleep ( delay );
+        }
+
+        /* Whole file may come at once */
+        if ( ret )
+        {
+            break;
+        }
+    }
+
+    return ret < 0 ? -1 : 0;
+}
+
+/**
+ * Release delta download state
+ */
+static void delta_free ( struct delta_t *delta )
+{
+    free ( delta->blocks );
+    free ( delta->heads );
+    free ( delta->buffer );
+}
+
+/**
+ * Download file as delta against its local copy, only blocks missing from it are fetched
+ */
+int delta_get ( const char *url, const char *filepath, const struct options_t *options )
+{
+    int error;
+    ssize_t reused;
+    size_t index = 0;
+    size_t begin;
+    size_t end;
+    size_t planned = 0;
+    struct checksum_t checksum;
+    struct delta_t delta;
+    char tmp[PATH_MAX];
+
+    memset ( &delta, '\0', sizeof ( delta ) );
+
+    /* Ranges travel plain over persistent connection */
+    delta.options = *options;
+    delta.options.keepalive = 1;
+    delta.options.compressed = 0;
+
+    if ( strlen ( url ) >= sizeof ( delta.target ) )
+    {
+        errno = ENAMETOOLONG;
+        perror ( "delta" );
+        return -1;
+    }
+
+    strcpy ( delta.target, url );
+
+    if ( delta_manifest_load ( filepath, options, &delta ) < 0 )
+    {
+        perror ( "manifest" );
+        return -1;
+    }
+
+    delta.size = HTTP_BUFFER_SIZE;
+
+    if ( !( delta.buffer = ( char * ) malloc ( delta.size ) )
+        || delta_index ( &delta, delta.count - ( delta.length % delta.block_size ? 1 : 0 ) ) < 0 )
+    {
+        perror ( "malloc" );
+        delta_free ( &delta );
+        return -1;
+    }
+
+    /* Local copy is read while new file is built aside */
+    if ( ( size_t ) snprintf ( tmp, sizeof ( tmp ), "%s.%lu.tmp", filepath,
+            ( unsigned long ) getpid (  ) ) >= sizeof ( tmp ) )
+    {
+        errno = ENAMETOOLONG;
+        perror ( "delta" );
+        delta_free ( &delta );
+        return -1;
+    }
+
+    if ( ( delta.fd = open ( tmp, O_CREAT | O_WRONLY | O_TRUNC, 0644 ) ) < 0 )
+    {
+        perror ( "open" );
+        delta_free ( &delta );
+        return -1;
+    }
+
+    if ( file_preallocate ( delta.fd, 0, delta.length ) < 0
+        || ftruncate ( delta.fd, delta.length ) < 0 )
+    {
+        perror ( "ftruncate" );
+        close ( delta.fd );
+        unlink ( tmp );
+        delta_free ( &delta );
+        return -1;
+    }
+
+    if ( ( reused = delta_reuse ( &delta, filepath ) ) < 0 )
+    {
+        perror ( "delta" );
+        close ( delta.fd );
+        unlink ( tmp );
+        delta_free ( &delta );
+        return -1;
+    }
+
+    while ( delta_next ( &delta, &index, &begin, &end ) )
+    {
+        planned += end - begin;
+    }
+
+    progress_start ( &delta.progress, get_basename ( filepath ), delta.length - planned,
+        delta.length, options->progress );
+
+    if ( delta_transfer ( &delta, url, options ) < 0 )
+    {
+        error = errno;
+        progress_stop ( &delta.progress, -1 );
+        close ( delta.fd );
+        unlink ( tmp );
+        delta_free ( &delta );
+        errno = error;
+        return -1;
+    }
+
+    /* Reassembled file must match the manifest as a whole */
+    if ( checksum_start ( &checksum, &delta.digest, tmp, delta.length ) < 0
+        || checksum_finish ( &checksum, delta.length ) < 0 )
+    {
+        progress_stop ( &delta.progress, -1 );
+        perror ( "checksum" );
+        close ( delta.fd );
+        unlink ( tmp );
+        delta_free ( &delta );
+        return -1;
+    }
+
+    if ( file_finish ( delta.fd, delta.length, options ) < 0 )
+    {
+        progress_stop ( &delta.progress, -1 );
+        perror ( "verify" );
+        close ( delta.fd );
+        unlink ( tmp );
+        delta_free ( &delta );
+        return -1;
+    }
+
+    progress_stop ( &delta.progress, 0 );
+    close ( delta.fd );
+
+    if ( rename ( tmp, filepath ) < 0 )
+    {
+        perror ( "rename" );
+        unlink ( tmp );
+        delta_free ( &delta );
+        return -1;
+    }
+
+    if ( options->progress )
+    {
+        printf ( "delta: %lu/%lu reused, %lu fetched in %lu requests\n",
+            ( unsigned long ) reused, ( unsigned long ) delta.length,
+            ( unsigned long ) delta.fetched, ( unsigned long ) delta.requests );
+    }
+
+    delta_free ( &delta );
+
+    /* Failing to store does not fail the download */
+    if ( options->store && store_put ( filepath, options ) < 0 )
+    {
+        perror ( "store" );
+    }
+
+    return 0;
+}
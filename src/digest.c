@@ -0,0 +1,453 @@
+/* ------------------------------------------------------------------
+ * Lget - Message Digest Algorithms
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+#if defined(__SSE4_2__) && !defined(DISABLE_SIMD)
+#define DIGEST_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+/**
+ * Sha256 round constants
+ */
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4,
+    0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe,
+    0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+    0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+    0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116,
+    0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+    0xc67178f2
+};
+
+/**
+ * Md5 per round shift amounts and sine derived constants
+ */
+static const unsigned char md5_r[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static const uint32_t md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613,
+    0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193,
+    0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d,
+    0x02441453, 0xd8a1e681, 0xe7d3fbc8, 0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122,
+    0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665, 0xf4292244,
+    0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb,
+    0xeb86d391
+};
+
+#ifndef DIGEST_CRC32C_SSE42
+/**
+ * Crc32c lookup table, built on first use
+ */
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Build crc32c lookup table for reflected Castagnoli polynomial
+ */
+static void crc32c_setup ( void )
+{
+    unsigned int i;
+    unsigned int j;
+    uint32_t crc;
+
+    for ( i = 0; i < 256; i++ )
+    {
+        for ( crc = i, j = 0; j < 8; j++ )
+        {
+            crc = crc & 1 ? ( crc >> 1 ) ^ 0x82f63b78 : crc >> 1;
+        }
+
+        crc32c_table[i] = crc;
+    }
+}
+#endif
+
+/**
+ * Rotate 32 bit word right
+ */
+static inline uint32_t ror32 ( uint32_t x, unsigned int n )
+{
+    return ( x >> n ) | ( x << ( 32 - n ) );
+}
+
+/**
+ * Rotate 32 bit word left
+ */
+static inline uint32_t rol32 ( uint32_t x, unsigned int n )
+{
+    return ( x << n ) | ( x >> ( 32 - n ) );
+}
+
+/**
+ * Process single sha256 block
+ */
+static void sha256_block ( uint32_t *state, const unsigned char *block )
+{
+    unsigned int i;
+    uint32_t t1;
+    uint32_t t2;
+    uint32_t w[64];
+    uint32_t s[8];
+
+    for ( i = 0; i < 16; i++ )
+    {
+        w[i] = ( uint32_t ) block[i * 4] << 24 | ( uint32_t ) block[i * 4 + 1] << 16
+            | ( uint32_t ) block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    }
+
+    for ( ; i < 64; i++ )
+    {
+        w[i] = w[i - 16] + ( ror32 ( w[i - 15], 7 ) ^ ror32 ( w[i - 15], 18 ) ^ ( w[i - 15] >> 3 ) )
+            + w[i - 7] + ( ror32 ( w[i - 2], 17 ) ^ ror32 ( w[i - 2], 19 ) ^ ( w[i - 2] >> 10 ) );
+    }
+
+    memcpy ( s, state, sizeof ( s ) );
+
+    for ( i = 0; i < 64; i++ )
+    {
+        t1 = s[7] + ( ror32 ( s[4], 6 ) ^ ror32 ( s[4], 11 ) ^ ror32 ( s[4], 25 ) )
+            + ( ( s[4] & s[5] ) ^ ( ~s[4] & s[6] ) ) + sha256_k[i] + w[i];
+        t2 = ( ror32 ( s[0], 2 ) ^ ror32 ( s[0], 13 ) ^ ror32 ( s[0], 22 ) )
+            + ( ( s[0] & s[1] ) ^ ( s[0] & s[2] ) ^ ( s[1] & s[2] ) );
+        memmove ( s + 1, s, 7 * sizeof ( uint32_t ) );
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+
+    for ( i = 0; i < 8; i++ )
+    {
+        state[i] += s[i];
+    }
+}
+
+/**
+ * Process single md5 block
+ */
+static void md5_block ( uint32_t *state, const unsigned char *block )
+{
+    unsigned int i;
+    unsigned int g;
+    uint32_t f;
+    uint32_t tmp;
+    uint32_t w[16];
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+
+    for ( i = 0; i < 16; i++ )
+    {
+        w[i] = block[i * 4] | ( uint32_t ) block[i * 4 + 1] << 8
+            | ( uint32_t ) block[i * 4 + 2] << 16 | ( uint32_t ) block[i * 4 + 3] << 24;
+    }
+
+    for ( i = 0; i < 64; i++ )
+    {
+        if ( i < 16 )
+        {
+            f = ( b & c ) | ( ~b & d );
+            g = i;
+
+        } else if ( i < 32 )
+        {
+            f = ( d & b ) | ( ~d & c );
+            g = ( 5 * i + 1 ) % 16;
+
+        } else if ( i < 48 )
+        {
+            f = b ^ c ^ d;
+            g = ( 3 * i + 5 ) % 16;
+
+        } else
+        {
+            f = c ^ ( b | ~d );
+            g = 7 * i % 16;
+        }
+
+        tmp = d;
+        d = c;
+        c = b;
+        b = b + rol32 ( a + f + md5_k[i] + w[g], md5_r[i] );
+        a = tmp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+/**
+ * Update crc32c with data
+ */
+static uint32_t crc32c_update ( uint32_t crc, const unsigned char *data, size_t len )
+{
+#ifdef DIGEST_CRC32C_SSE42
+#ifdef __x86_64__
+    uint64_t word;
+
+    for ( ; len >= 8; data += 8, len -= 8 )
+    {
+        memcpy ( &word, data, 8 );
+        crc = ( uint32_t ) _mm_crc32_u64 ( crc, word );
+    }
+#endif
+
+    for ( ; len; data++, len-- )
+    {
+        crc = _mm_crc32_u8 ( crc, *data );
+    }
+#else
+    for ( ; len; data++, len-- )
+    {
+        crc = crc32c_table[( crc ^ *data ) & 0xff] ^ ( crc >> 8 );
+    }
+#endif
+
+    return crc;
+}
+
+/**
+ * Setup hash state for algorithm
+ */
+void hash_init ( struct hash_t *hash, int algorithm )
+{
+    static const uint32_t sha256_iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab,
+        0x5be0cd19
+    };
+    static const uint32_t md5_iv[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+    hash->algorithm = algorithm;
+    hash->count = 0;
+
+    if ( algorithm == DIGEST_SHA256 )
+    {
+        memcpy ( hash->state, sha256_iv, sizeof ( sha256_iv ) );
+
+    } else if ( algorithm == DIGEST_MD5 )
+    {
+        memcpy ( hash->state, md5_iv, sizeof ( md5_iv ) );
+
+    } else
+    {
+#ifndef DIGEST_CRC32C_SSE42
+        pthread_once ( &crc32c_once, crc32c_setup );
+#endif
+        hash->state[0] = 0xffffffff;
+    }
+}
+
+/**
+ * Add data to hash
+ */
+void hash_update ( struct hash_t *hash, const void *data, size_t len )
+{
+    size_t fill;
+    size_t used;
+    const unsigned char *ptr;
+
+    ptr = ( const unsigned char * ) data;
+
+    if ( hash->algorithm == DIGEST_CRC32C )
+    {
+        hash->state[0] = crc32c_update ( hash->state[0], ptr, len );
+        hash->count += len;
+        return;
+    }
+
+    /* Block based digests buffer partial blocks */
+    used = hash->count % 64;
+    hash->count += len;
+
+    if ( used )
+    {
+        fill = 64 - used < len ? 64 - used : len;
+        memcpy ( hash->block + used, ptr, fill );
+        ptr += fill;
+        len -= fill;
+
+        if ( used + fill < 64 )
+        {
+            return;
+        }
+
+        if ( hash->algorithm == DIGEST_SHA256 )
+        {
+            sha256_block ( hash->state, hash->block );
+
+        } else
+        {
+            md5_block ( hash->state, hash->block );
+        }
+    }
+
+    for ( ; len >= 64; ptr += 64, len -= 64 )
+    {
+        if ( hash->algorithm == DIGEST_SHA256 )
+        {
+            sha256_block ( hash->state, ptr );
+
+        } else
+        {
+            md5_block ( hash->state, ptr );
+        }
+    }
+
+    memcpy ( hash->block, ptr, len );
+}
+
+/**
+ * Complete hash and store digest, returns digest length
+ */
+size_t hash_final ( struct hash_t *hash, unsigned char *digest )
+{
+    unsigned int i;
+    uint64_t bits;
+    unsigned char pad[72];
+    size_t pad_len;
+
+    if ( hash->algorithm == DIGEST_CRC32C )
+    {
+        hash->state[0] ^= 0xffffffff;
+
+        for ( i = 0; i < 4; i++ )
+        {
+            digest[i] = hash->state[0] >> ( 24 - i * 8 );
+        }
+
+        return 4;
+    }
+
+    /* Pad with one bit, zeros and message length in bits */
+    bits = hash->count * 8;
+    pad_len = 64 - ( hash->count + 8 ) % 64;
+    memset ( pad, '\0', sizeof ( pad ) );
+    pad[0] = 0x80;
+
+    for ( i = 0; i < 8; i++ )
+    {
+        pad[pad_len + i] = hash->algorithm == DIGEST_SHA256
+            ? bits >> ( 56 - i * 8 ) : bits >> ( i * 8 );
+    }
+
+    hash_update ( hash, pad, pad_len + 8 );
+
+    if ( hash->algorithm == DIGEST_SHA256 )
+    {
+        for ( i = 0; i < 32; i++ )
+        {
+            digest[i] = hash->state[i / 4] >> ( 24 - i % 4 * 8 );
+        }
+
+        return 32;
+    }
+
+    for ( i = 0; i < 16; i++ )
+    {
+        digest[i] = hash->state[i / 4] >> ( i % 4 * 8 );
+    }
+
+    return 16;
+}
+
+/**
+ * Parse expected digest given as algorithm:hex
+ */
+int digest_parse ( const char *spec, struct digest_t *digest )
+{
+    size_t i;
+    size_t len;
+    unsigned int byte;
+    const char *hex;
+
+    if ( !strncmp ( spec, "sha256:", 7 ) )
+    {
+        digest->algorithm = DIGEST_SHA256;
+        digest->len = 32;
+
+    } else if ( !strncmp ( spec, "md5:", 4 ) )
+    {
+        digest->algorithm = DIGEST_MD5;
+        digest->len = 16;
+
+    } else if ( !strncmp ( spec, "crc32c:", 7 ) )
+    {
+        digest->algorithm = DIGEST_CRC32C;
+        digest->len = 4;
+
+    } else
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    hex = strchr ( spec, ':' ) + 1;
+    len = strlen ( hex );
+
+    if ( len != digest->len * 2 )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for ( i = 0; i < digest->len; i++ )
+    {
+        if ( !isxdigit ( ( unsigned char ) hex[i * 2] )
+            || !isxdigit ( ( unsigned char ) hex[i * 2 + 1] )
+            || sscanf ( hex + i * 2, "%2x", &byte ) <= 0 )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        digest->value[i] = byte;
+    }
+
+    return 0;
+}
+
+/**
+ * Get digest algorithm name
+ */
+const char *digest_name ( int algorithm )
+{
+    switch ( algorithm )
+    {
+    case DIGEST_SHA256:
+        return "sha256";
+    case DIGEST_MD5:
+        return "md5";
+    }
+
+    return "crc32c";
+}
+
+/**
+ * Format digest value as lowercase hex, buffer holds twice the length plus one
+ */
+void digest_hex ( const struct digest_t *digest, char *buffer )
+{
+    size_t i;
+
+    for ( i = 0; i < digest->len; i++ )
+    {
+        sprintf ( buffer + i * 2, "%02x", digest->value[i] );
+    }
+
+    buffer[digest->len * 2] = '\0';
+}
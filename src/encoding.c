@@ -0,0 +1,230 @@
+/* ------------------------------------------------------------------
+ * Lget - Content Encoding Decoder
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Zlib window bits for gzip, zlib and raw deflate streams
+ */
+#define WINDOW_GZIP ( 16 + MAX_WBITS )
+#define WINDOW_ZLIB MAX_WBITS
+#define WINDOW_RAW ( -MAX_WBITS )
+
+/**
+ * Write whole data slice to output file
+ */
+static int encoding_output ( int fd, const char *data, size_t len )
+{
+    ssize_t ret;
+
+    while ( len )
+    {
+        if ( ( ret = write ( fd, data, len ) ) < 0 )
+        {
+            return -1;
+        }
+
+        data += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+/**
+ * Setup content decoder from response header
+ */
+int encoding_init ( struct encoding_t *encoding, const struct response_t *response,
+    const char *buffer )
+{
+    const char *value;
+    size_t len;
+
+    encoding->mode = ENCODING_IDENTITY;
+    encoding->done = 0;
+    encoding->probe = 0;
+    encoding->decoded = 0;
+    encoding->buffer = NULL;
+
+    value = buffer + response->encoding;
+    len = response->encoding_len;
+
+    if ( !len || ( len == 8 && !scan_casecmp ( value, "identity", 8 ) ) )
+    {
+        return 0;
+    }
+
+    if ( ( len == 4 && !scan_casecmp ( value, "gzip", 4 ) )
+        || ( len == 6 && !scan_casecmp ( value, "x-gzip", 6 ) ) )
+    {
+        encoding->mode = ENCODING_GZIP;
+
+    } else if ( len == 7 && !scan_casecmp ( value, "deflate", 7 ) )
+    {
+        encoding->mode = ENCODING_DEFLATE;
+
+    } else
+    {
+        /* Stacked or unknown codings are not supported */
+        errno = EPROTONOSUPPORT;
+        return -1;
+    }
+
+#ifdef DISABLE_ZLIB
+    encoding->mode = ENCODING_IDENTITY;
+    errno = EPROTONOSUPPORT;
+    return -1;
+#else
+    if ( !( encoding->buffer = ( char * ) malloc ( ENCODING_BUFFER_SIZE ) ) )
+    {
+        return -1;
+    }
+
+    memset ( &encoding->stream, '\0', sizeof ( encoding->stream ) );
+
+    /* Deflate is meant to be zlib wrapped, some servers send it raw though */
+    if ( inflateInit2 ( &encoding->stream,
+            encoding->mode == ENCODING_GZIP ? WINDOW_GZIP : WINDOW_ZLIB ) != Z_OK )
+    {
+        free ( encoding->buffer );
+        encoding->buffer = NULL;
+        encoding->mode = ENCODING_IDENTITY;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    encoding->probe = encoding->mode == ENCODING_DEFLATE;
+
+    return 0;
+#endif
+}
+
+/**
+ * Decode body payload and write result to output file
+ */
+int encoding_write ( struct encoding_t *encoding, int fd, const char *data, size_t len )
+{
+#ifndef DISABLE_ZLIB
+    int ret;
+    size_t out_len;
+    z_stream *stream;
+#endif
+
+    if ( encoding->mode == ENCODING_IDENTITY )
+    {
+        if ( encoding_output ( fd, data, len ) < 0 )
+        {
+            return -1;
+        }
+
+        encoding->decoded += len;
+        return 0;
+    }
+
+#ifdef DISABLE_ZLIB
+    errno = EPROTONOSUPPORT;
+    return -1;
+#else
+    stream = &encoding->stream;
+    stream->next_in = ( Bytef * ) data;
+    stream->avail_in = len;
+
+    /* Output buffer is drained after each step, memory stays bounded, full buffer may leave
+     * decoded data pending after the input is consumed */
+    while ( stream->avail_in || ( !encoding->done && !stream->avail_out ) )
+    {
+        /* Gzip members may be concatenated */
+        if ( encoding->done )
+        {
+            if ( encoding->mode != ENCODING_GZIP || inflateReset ( stream ) != Z_OK )
+            {
+                errno = EPROTO;
+                return -1;
+            }
+
+            encoding->done = 0;
+        }
+
+        stream->next_out = ( Bytef * ) encoding->buffer;
+        stream->avail_out = ENCODING_BUFFER_SIZE;
+
+        ret = inflate ( stream, Z_NO_FLUSH );
+
+        /* Retry first deflate bytes as raw stream without zlib header */
+        if ( ret == Z_DATA_ERROR && encoding->probe )
+        {
+            encoding->probe = 0;
+
+            if ( inflateReset2 ( stream, WINDOW_RAW ) != Z_OK )
+            {
+                errno = EPROTO;
+                return -1;
+            }
+
+            stream->next_in = ( Bytef * ) data;
+            stream->avail_in = len;
+            continue;
+        }
+
+        if ( ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR )
+        {
+            errno = EPROTO;
+            return -1;
+        }
+
+        if ( ( out_len = ENCODING_BUFFER_SIZE - stream->avail_out ) )
+        {
+            encoding->probe = 0;
+
+            if ( encoding_output ( fd, encoding->buffer, out_len ) < 0 )
+            {
+                return -1;
+            }
+
+            encoding->decoded += out_len;
+        }
+
+        if ( ret == Z_STREAM_END )
+        {
+            encoding->done = 1;
+        }
+    }
+
+    /* Raw deflate is detected within the first slice only */
+    encoding->probe = 0;
+
+    return 0;
+#endif
+}
+
+/**
+ * Check if compressed stream ended with the body
+ */
+int encoding_finish ( const struct encoding_t *encoding )
+{
+    if ( encoding->mode != ENCODING_IDENTITY && !encoding->done )
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Release content decoder
+ */
+void encoding_close ( struct encoding_t *encoding )
+{
+    if ( !encoding->buffer )
+    {
+        return;
+    }
+
+#ifndef DISABLE_ZLIB
+    inflateEnd ( &encoding->stream );
+#endif
+    free ( encoding->buffer );
+    encoding->buffer = NULL;
+}
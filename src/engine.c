@@ -0,0 +1,1211 @@
+/* ------------------------------------------------------------------
+ * Lget - Event Loop Transfer Engine
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Transfer states
+ */
+#define TRANSFER_CONNECT 0
+#define TRANSFER_SOCKS5_HELLO_SEND 1
+#define TRANSFER_SOCKS5_HELLO_RECV 2
+#define TRANSFER_SOCKS5_REQUEST_SEND 3
+#define TRANSFER_SOCKS5_REQUEST_RECV 4
+#define TRANSFER_REQUEST_SEND 5
+#define TRANSFER_HEADER_RECV 6
+#define TRANSFER_BODY_RECV 7
+
+/**
+ * Transfer step results
+ */
+#define STEP_FAIL -1
+#define STEP_WAIT 0
+#define STEP_NEXT 1
+#define STEP_DONE 2
+
+/**
+ * Single transfer details
+ */
+struct transfer_t
+{
+    struct transfer_t *prev;
+    struct transfer_t *next;
+    int state;
+    int sock;
+    int fd;
+    int reused;
+    int keepalive;
+    unsigned int events;
+    unsigned int redirects;
+    unsigned long expires;
+    char *url;
+    char *filepath;
+    const char *path;
+    char hostname[HOSTNAME_SIZE];
+    unsigned short port;
+    char *buffer;
+    size_t size;
+    size_t len;
+    size_t pos;
+    size_t offset;
+    size_t sum;
+    size_t limit;
+    struct response_t response;
+    struct body_t decoder;
+};
+
+/**
+ * Event loop engine state
+ */
+struct engine_t
+{
+    int epfd;
+    unsigned long tick;
+    unsigned int active;
+    const struct options_t *options;
+    int ( *next ) ( void *arg, char **url, char **filepath );
+    void ( *done ) ( void *arg, const char *url, const char *filepath, int result );
+    void *arg;
+    struct transfer_t *wheel[ENGINE_WHEEL_SLOTS];
+    struct splice_t relay;
+    char scratch[32768];
+};
+
+/**
+ * Get current engine tick
+ */
+static unsigned long engine_now ( void )
+{
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+
+    return ( ts.tv_sec * 1000 + ts.tv_nsec / 1000000 ) / ENGINE_TICK_MSEC;
+}
+
+/**
+ * Remove transfer from timer wheel
+ */
+static void timer_cancel ( struct engine_t *engine, struct transfer_t *transfer )
+{
+    if ( transfer->prev )
+    {
+        transfer->prev->next = transfer->next;
+
+    } else if ( engine->wheel[transfer->expires % ENGINE_WHEEL_SLOTS] == transfer )
+    {
+        engine->wheel[transfer->expires % ENGINE_WHEEL_SLOTS] = transfer->next;
+    }
+
+    if ( transfer->next )
+    {
+        transfer->next->prev = transfer->prev;
+    }
+
+    transfer->prev = NULL;
+    transfer->next = NULL;
+}
+
+/**
+ * Schedule transfer timeout on timer wheel
+ */
+static void timer_arm ( struct engine_t *engine, struct transfer_t *transfer )
+{
+    struct transfer_t **slot;
+
+    timer_cancel ( engine, transfer );
+
+    transfer->expires = engine->tick + ENGINE_TIMEOUT_MSEC / ENGINE_TICK_MSEC;
+    slot = &engine->wheel[transfer->expires % ENGINE_WHEEL_SLOTS];
+
+    transfer->next = *slot;
+    if ( *slot )
+    {
+        ( *slot )->prev = transfer;
+    }
+    *slot = transfer;
+}
+
+/**
+ * Release transfer and report its result
+ */
+static void transfer_finish ( struct engine_t *engine, struct transfer_t *transfer, int result )
+{
+    timer_cancel ( engine, transfer );
+
+    if ( transfer->sock >= 0 )
+    {
+        close ( transfer->sock );
+    }
+
+    if ( transfer->fd >= 0 )
+    {
+        close ( transfer->fd );
+    }
+
+    engine->done ( engine->arg, transfer->url, transfer->filepath, result );
+    engine->active--;
+
+    free ( transfer->buffer );
+    free ( transfer->url );
+    free ( transfer->filepath );
+    free ( transfer );
+}
+
+/**
+ * Place outgoing message into transfer buffer
+ */
+static int transfer_message ( struct transfer_t *transfer, const char *data, size_t len )
+{
+    char *buffer;
+
+    if ( len > transfer->size )
+    {
+        if ( !( buffer = ( char * ) realloc ( transfer->buffer, len ) ) )
+        {
+            return -1;
+        }
+        transfer->buffer = buffer;
+        transfer->size = len;
+    }
+
+    memcpy ( transfer->buffer, data, len );
+    transfer->len = len;
+    transfer->pos = 0;
+
+    return 0;
+}
+
+/**
+ * Wait for transfer connection to complete
+ */
+static int transfer_wait_connect ( struct engine_t *engine, struct transfer_t *transfer )
+{
+    struct epoll_event event;
+
+    transfer->state = TRANSFER_CONNECT;
+    transfer->events = EPOLLOUT;
+
+    event.events = transfer->events;
+    event.data.ptr = transfer;
+
+    if ( epoll_ctl ( engine->epfd, EPOLL_CTL_ADD, transfer->sock, &event ) < 0 )
+    {
+        perror ( "epoll_ctl" );
+        return -1;
+    }
+
+    timer_arm ( engine, transfer );
+
+    return 0;
+}
+
+/**
+ * Start connecting transfer with server or proxy
+ */
+static int transfer_connect ( struct engine_t *engine, struct transfer_t *transfer, int pooled )
+{
+    int flags;
+    char *url;
+    socklen_t saddr_len;
+    struct stat st;
+    struct address_t addr;
+    struct sockaddr_storage saddr;
+
+    /* Known permanent redirects save round trips */
+    while ( redirect_cache_lookup ( transfer->url, engine->scratch,
+            sizeof ( engine->scratch ) ) >= 0 )
+    {
+        if ( ++transfer->redirects > engine->options->redirects )
+        {
+            errno = ELOOP;
+            perror ( "redirect" );
+            return -1;
+        }
+
+        if ( !( url = strdup ( engine->scratch ) ) )
+        {
+            perror ( "strdup" );
+            return -1;
+        }
+
+        free ( transfer->url );
+        transfer->url = url;
+    }
+
+    /* Extract hostname and path from http url */
+    if ( http_parse_url ( transfer->url, transfer->hostname, sizeof ( transfer->hostname ),
+            &transfer->port, &transfer->path ) < 0 )
+    {
+        perror ( "parse" );
+        return -1;
+    }
+
+    /* Continue from the end of partial file if requested */
+    transfer->offset = 0;
+
+    if ( engine->options->resume && !stat ( transfer->filepath, &st ) && S_ISREG ( st.st_mode ) )
+    {
+        transfer->offset = st.st_size;
+    }
+
+    /* Reuse idle connection if possible */
+    transfer->reused = 0;
+    transfer->keepalive = 0;
+
+    if ( pooled && engine->options->keepalive
+        && ( transfer->sock =
+            pool_acquire ( transfer->hostname, transfer->port,
+                engine->options->socks5 ) ) >= 0 )
+    {
+        if ( ( flags = fcntl ( transfer->sock, F_GETFL ) ) < 0
+            || fcntl ( transfer->sock, F_SETFL, flags | O_NONBLOCK ) < 0 )
+        {
+            perror ( "fcntl" );
+            return -1;
+        }
+
+        transfer->reused = 1;
+        return transfer_wait_connect ( engine, transfer );
+    }
+
+    /* Connect endpoint or proxy server, preferred address is used */
+    if ( engine->options->socks5 )
+    {
+        saddr_len =
+            connect_sockaddr ( &engine->options->socks5->addrs[0],
+            engine->options->socks5->port, &saddr );
+
+    } else
+    {
+        /* Resolve server address */
+        if ( resolve_host ( transfer->hostname, engine->options->family, &addr, 1 ) < 0 )
+        {
+            perror ( "resolve" );
+            return -1;
+        }
+        saddr_len = connect_sockaddr ( &addr, transfer->port, &saddr );
+    }
+
+    /* Create non-blocking server socket */
+    if ( ( transfer->sock = socket ( saddr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0 ) ) < 0 )
+    {
+        perror ( "socket" );
+        return -1;
+    }
+
+    if ( connect_setup ( transfer->sock, engine->options ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Start connecting with server */
+    if ( connect ( transfer->sock, ( struct sockaddr * ) &saddr, saddr_len ) < 0
+        && errno != EINPROGRESS )
+    {
+        perror ( "connect" );
+        return -1;
+    }
+
+    return transfer_wait_connect ( engine, transfer );
+}
+
+/**
+ * Prepare http request for sending
+ */
+static int transfer_request ( struct engine_t *engine, struct transfer_t *transfer )
+{
+    ssize_t len;
+    char range[64];
+
+    /* Request remaining bytes if partial file exists */
+    if ( transfer->offset )
+    {
+        snprintf ( range, sizeof ( range ), "Range: bytes=%lu-\r\n",
+            ( unsigned long ) transfer->offset );
+
+    } else
+    {
+        range[0] = '\0';
+    }
+
+    /* Engine writes bodies as received, compression is not advertised */
+    if ( ( len =
+            http_format_request ( engine->scratch, sizeof ( engine->scratch ),
+                transfer->hostname, transfer->port, transfer->path, range,
+                engine->options->keepalive, 0 ) ) < 0 )
+    {
+        perror ( "request" );
+        return -1;
+    }
+
+    if ( transfer_message ( transfer, engine->scratch, len ) < 0 )
+    {
+        perror ( "realloc" );
+        return -1;
+    }
+
+    /* Response header is parsed while it arrives */
+    response_init ( &transfer->response );
+    transfer->state = TRANSFER_REQUEST_SEND;
+
+    return 0;
+}
+
+/**
+ * Send pending transfer buffer
+ */
+static int transfer_send ( struct transfer_t *transfer, int state )
+{
+    ssize_t len;
+
+    while ( transfer->pos < transfer->len )
+    {
+        if ( ( len =
+                send ( transfer->sock, transfer->buffer + transfer->pos,
+                    transfer->len - transfer->pos, MSG_NOSIGNAL ) ) < 0 )
+        {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                return STEP_WAIT;
+            }
+
+            perror ( "send" );
+            return STEP_FAIL;
+        }
+
+        transfer->pos += len;
+    }
+
+    /* Message sent, wait for response */
+    transfer->len = 0;
+    transfer->pos = 0;
+    transfer->state = state;
+
+    return STEP_NEXT;
+}
+
+/**
+ * Receive transfer data up to given length
+ */
+static int transfer_recv ( struct transfer_t *transfer, size_t limit )
+{
+    ssize_t len;
+
+    if ( ( len =
+            recv ( transfer->sock, transfer->buffer + transfer->len, limit - transfer->len,
+                0 ) ) < 0 )
+    {
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
+        {
+            return STEP_WAIT;
+        }
+
+        perror ( "recv" );
+        return STEP_FAIL;
+    }
+
+    /* Detect broken pipe */
+    if ( !len )
+    {
+        errno = EPIPE;
+        perror ( "recv" );
+        return STEP_FAIL;
+    }
+
+    transfer->len += len;
+
+    return STEP_NEXT;
+}
+
+/**
+ * Write data slice into transfer output file
+ */
+static int transfer_write ( struct transfer_t *transfer, const char *data, size_t len )
+{
+    ssize_t ret;
+
+    while ( len )
+    {
+        if ( ( ret = write ( transfer->fd, data, len ) ) < 0 )
+        {
+            perror ( "write" );
+            return -1;
+        }
+
+        data += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+/**
+ * Decode body slice and write its payload into transfer output file
+ */
+static int transfer_decode ( struct transfer_t *transfer, const char *data, size_t len )
+{
+    ssize_t ret;
+    size_t payload_len;
+    const char *payload;
+
+    while ( len && !transfer->decoder.done )
+    {
+        if ( ( ret = body_decode ( &transfer->decoder, data, len, &payload, &payload_len ) ) < 0 )
+        {
+            perror ( "decode" );
+            return -1;
+        }
+
+        if ( payload_len && transfer_write ( transfer, payload, payload_len ) < 0 )
+        {
+            return -1;
+        }
+
+        transfer->sum += payload_len;
+        data += ret;
+        len -= ret;
+    }
+
+    /* Data beyond the body means connection is out of sync */
+    if ( len )
+    {
+        transfer->keepalive = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Put transfer connection into pool for reuse
+ */
+static void transfer_release ( struct engine_t *engine, struct transfer_t *transfer )
+{
+    if ( epoll_ctl ( engine->epfd, EPOLL_CTL_DEL, transfer->sock, NULL ) < 0 )
+    {
+        close ( transfer->sock );
+
+    } else
+    {
+        pool_release ( transfer->sock, transfer->hostname, transfer->port,
+            engine->options->socks5 );
+    }
+
+    transfer->sock = -1;
+}
+
+/**
+ * Follow http redirect with new connection
+ */
+static int transfer_redirect ( struct engine_t *engine, struct transfer_t *transfer )
+{
+    char *url;
+
+    if ( ++transfer->redirects > engine->options->redirects )
+    {
+        errno = ELOOP;
+        perror ( "redirect" );
+        return STEP_FAIL;
+    }
+
+    if ( response_location ( &transfer->response, transfer->buffer, transfer->url,
+            engine->scratch, sizeof ( engine->scratch ) ) < 0 )
+    {
+        perror ( "redirect" );
+        return STEP_FAIL;
+    }
+
+    /* Permanent redirect is taken without request next time */
+    if ( response_permanent ( &transfer->response ) )
+    {
+        redirect_cache_store ( transfer->url, engine->scratch );
+    }
+
+    if ( !( url = strdup ( engine->scratch ) ) )
+    {
+        perror ( "strdup" );
+        return STEP_FAIL;
+    }
+
+    free ( transfer->url );
+    transfer->url = url;
+
+    /* Keep connection for redirect if the whole body was received */
+    if ( transfer->keepalive && transfer->response.has_length
+        && transfer->len - transfer->response.header_len == transfer->response.content_len )
+    {
+        transfer_release ( engine, transfer );
+
+    } else
+    {
+        /* Closing socket also removes it from epoll set */
+        close ( transfer->sock );
+        transfer->sock = -1;
+    }
+
+    transfer->len = 0;
+
+    if ( transfer_connect ( engine, transfer, 1 ) < 0 )
+    {
+        return STEP_FAIL;
+    }
+
+    return STEP_WAIT;
+}
+
+/**
+ * Process complete http response header
+ */
+static int transfer_response ( struct engine_t *engine, struct transfer_t *transfer )
+{
+    unsigned int status;
+    size_t len;
+    const char *body;
+    const struct response_t *response;
+
+    response = &transfer->response;
+    status = response->status;
+    body = transfer->buffer + response->header_len;
+
+    /* Connection may be reused if response body is delimited */
+    transfer->keepalive = engine->options->keepalive && response_keepalive ( response );
+
+    if ( response_redirect ( response ) )
+    {
+        return transfer_redirect ( engine, transfer );
+    }
+
+    /* Partial file may already be complete */
+    if ( status == 416 && transfer->offset && response->has_complete
+        && response->complete_len == transfer->offset )
+    {
+        transfer->keepalive = 0;
+        return STEP_DONE;
+    }
+
+    if ( status != 200 && status != 206 )
+    {
+        errno = status;
+        perror ( "http status" );
+        errno = EINVAL;
+        return STEP_FAIL;
+    }
+
+    if ( status == 206 )
+    {
+        /* Validate range against the requested one */
+        if ( !response->has_range || response->range_begin != transfer->offset
+            || response->range_end + 1 != response->range_total )
+        {
+            errno = EINVAL;
+            perror ( "range" );
+            return STEP_FAIL;
+        }
+
+        transfer->limit = response->range_total;
+
+    } else
+    {
+        /* Server ignored the range, start over */
+        transfer->offset = 0;
+    }
+
+    /* Body may be sized, chunked or delimited by connection close */
+    body_init ( &transfer->decoder, response );
+
+    if ( transfer->decoder.mode == BODY_CLOSE )
+    {
+        transfer->keepalive = 0;
+    }
+
+    /* Total size is unknown without content length */
+    if ( status == 200 )
+    {
+        transfer->limit =
+            transfer->decoder.mode == BODY_LENGTH ? transfer->decoder.remaining : 0;
+    }
+
+    /* Copy shared with cache or store is never written through, resumed prefix is kept */
+    if ( ( engine->options->cache || engine->options->store )
+        && file_detach ( transfer->filepath, transfer->offset != 0 ) < 0 )
+    {
+        perror ( "detach" );
+        return STEP_FAIL;
+    }
+
+    /* Open output file */
+    if ( ( transfer->fd =
+            open ( transfer->filepath, O_CREAT | O_WRONLY | ( transfer->offset ? 0 : O_TRUNC ),
+                0644 ) ) < 0 )
+    {
+        perror ( "open" );
+        return STEP_FAIL;
+    }
+
+    /* Append to partial file */
+    if ( transfer->offset && lseek ( transfer->fd, transfer->offset, SEEK_SET ) < 0 )
+    {
+        perror ( "lseek" );
+        return STEP_FAIL;
+    }
+
+    /* Reserve disk space, so a full disk fails before the transfer */
+    if ( file_preallocate ( transfer->fd, transfer->offset, transfer->limit ) < 0 )
+    {
+        perror ( "fallocate" );
+        return STEP_FAIL;
+    }
+
+    /* Copy first data slice */
+    len = transfer->len - response->header_len;
+    transfer->sum = transfer->offset;
+
+    if ( transfer_decode ( transfer, body, len ) < 0 )
+    {
+        return STEP_FAIL;
+    }
+
+    /* Header buffer is no longer needed */
+    free ( transfer->buffer );
+    transfer->buffer = NULL;
+    transfer->size = 0;
+    transfer->len = 0;
+
+    if ( transfer->decoder.done )
+    {
+        return STEP_DONE;
+    }
+
+    transfer->state = TRANSFER_BODY_RECV;
+
+    return STEP_NEXT;
+}
+
+/**
+ * Receive http response header
+ */
+static int transfer_header ( struct engine_t *engine, struct transfer_t *transfer )
+{
+    int ret;
+    size_t grown;
+    size_t header_max;
+    char *buffer;
+
+    header_max = engine->options->header_max;
+
+    /* Grow header buffer if full, header must fit within the limit */
+    if ( transfer->len + 1 >= transfer->size )
+    {
+        if ( transfer->size >= header_max )
+        {
+            errno = E2BIG;
+            perror ( "recv" );
+            return STEP_FAIL;
+        }
+
+        grown = transfer->size * 2 < header_max ? transfer->size * 2 : header_max;
+
+        if ( !( buffer = ( char * ) realloc ( transfer->buffer, grown ) ) )
+        {
+            perror ( "realloc" );
+            return STEP_FAIL;
+        }
+
+        transfer->buffer = buffer;
+        transfer->size = grown;
+    }
+
+    if ( ( ret = transfer_recv ( transfer, transfer->size - 1 ) ) != STEP_NEXT )
+    {
+        return ret;
+    }
+
+    transfer->buffer[transfer->len] = '\0';
+
+    /* Only newly received bytes are scanned */
+    if ( ( ret = response_parse ( &transfer->response, transfer->buffer, transfer->len ) ) < 0 )
+    {
+        perror ( "http response" );
+        return STEP_FAIL;
+    }
+
+    if ( !ret )
+    {
+        return STEP_NEXT;
+    }
+
+    return transfer_response ( engine, transfer );
+}
+
+/**
+ * Receive http response body into output file
+ */
+static int transfer_body ( struct engine_t *engine, struct transfer_t *transfer )
+{
+    ssize_t len;
+    size_t direct;
+
+    /* Move data from socket into file within kernel if possible, pipe is shared */
+    if ( engine->relay.pipe[0] >= 0
+        && ( direct = body_direct_len ( &transfer->decoder, engine->relay.size ) ) )
+    {
+        if ( ( len = splice_recv ( &engine->relay, transfer->sock, transfer->fd, NULL,
+                    direct ) ) > 0 )
+        {
+            body_skip ( &transfer->decoder, len );
+            transfer->sum += len;
+            return transfer->decoder.done ? STEP_DONE : STEP_WAIT;
+        }
+
+        if ( len < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+        {
+            return STEP_WAIT;
+        }
+
+        if ( len < 0 && errno != ENOSYS )
+        {
+            perror ( "splice" );
+            return STEP_FAIL;
+        }
+
+        /* Fall back to copy loop */
+        if ( len < 0 )
+        {
+            splice_close ( &engine->relay );
+        }
+    }
+
+    if ( ( len = recv ( transfer->sock, engine->scratch, sizeof ( engine->scratch ), 0 ) ) < 0 )
+    {
+        if ( errno == EAGAIN || errno == EWOULDBLOCK )
+        {
+            return STEP_WAIT;
+        }
+
+        perror ( "recv" );
+        return STEP_FAIL;
+    }
+
+    /* Connection close may terminate the body */
+    if ( !len )
+    {
+        if ( body_eof ( &transfer->decoder ) < 0 )
+        {
+            perror ( "recv" );
+            return STEP_FAIL;
+        }
+
+        return STEP_DONE;
+    }
+
+    if ( transfer_decode ( transfer, engine->scratch, len ) < 0 )
+    {
+        return STEP_FAIL;
+    }
+
+    if ( transfer->decoder.done )
+    {
+        return STEP_DONE;
+    }
+
+    /* Yield to other transfers, level triggered epoll will call back */
+    return STEP_WAIT;
+}
+
+/**
+ * Advance transfer state machine by one step
+ */
+static int transfer_step ( struct engine_t *engine, struct transfer_t *transfer )
+{
+    int err;
+    int ret;
+    ssize_t len;
+    socklen_t errlen;
+
+    switch ( transfer->state )
+    {
+    case TRANSFER_CONNECT:
+        errlen = sizeof ( err );
+
+        if ( getsockopt ( transfer->sock, SOL_SOCKET, SO_ERROR, &err, &errlen ) < 0 )
+        {
+            perror ( "getsockopt" );
+            return STEP_FAIL;
+        }
+
+        if ( err )
+        {
+            errno = err;
+            perror ( "connect" );
+            return STEP_FAIL;
+        }
+
+        /* Pooled connection is ready for next request */
+        if ( transfer->reused )
+        {
+            return transfer_request ( engine, transfer ) < 0 ? STEP_FAIL : STEP_NEXT;
+        }
+
+        if ( engine->options->socks5 )
+        {
+            if ( transfer_message ( transfer, engine->scratch,
+                    socks5_format_greeting ( engine->scratch ) ) < 0 )
+            {
+                perror ( "realloc" );
+                return STEP_FAIL;
+            }
+
+            transfer->state = TRANSFER_SOCKS5_HELLO_SEND;
+            return STEP_NEXT;
+        }
+
+        return transfer_request ( engine, transfer ) < 0 ? STEP_FAIL : STEP_NEXT;
+
+    case TRANSFER_SOCKS5_HELLO_SEND:
+        return transfer_send ( transfer, TRANSFER_SOCKS5_HELLO_RECV );
+
+    case TRANSFER_SOCKS5_HELLO_RECV:
+        if ( ( ret = transfer_recv ( transfer, 2 ) ) != STEP_NEXT )
+        {
+            return ret;
+        }
+
+        if ( transfer->len < 2 )
+        {
+            return STEP_NEXT;
+        }
+
+        if ( socks5_check_greeting ( transfer->buffer, transfer->len ) < 0 )
+        {
+            perror ( "socks5 handshake" );
+            return STEP_FAIL;
+        }
+
+        if ( ( len =
+                socks5_format_request_hostname ( engine->scratch, sizeof ( engine->scratch ),
+                    transfer->hostname, transfer->port ) ) < 0
+            || transfer_message ( transfer, engine->scratch, len ) < 0 )
+        {
+            perror ( "socks5 request" );
+            return STEP_FAIL;
+        }
+
+        transfer->state = TRANSFER_SOCKS5_REQUEST_SEND;
+        return STEP_NEXT;
+
+    case TRANSFER_SOCKS5_REQUEST_SEND:
+        return transfer_send ( transfer, TRANSFER_SOCKS5_REQUEST_RECV );
+
+    case TRANSFER_SOCKS5_REQUEST_RECV:
+        /* Read fixed part first, then the bound address */
+        if ( !( len = socks5_reply_len ( transfer->buffer, transfer->len ) ) )
+        {
+            len = 5;
+        }
+
+        if ( ( size_t ) len > transfer->size )
+        {
+            errno = ENOBUFS;
+            perror ( "socks5 request" );
+            return STEP_FAIL;
+        }
+
+        if ( ( ret = transfer_recv ( transfer, len ) ) != STEP_NEXT )
+        {
+            return ret;
+        }
+
+        if ( transfer->len < 5 || transfer->len < socks5_reply_len ( transfer->buffer,
+                transfer->len ) )
+        {
+            return STEP_NEXT;
+        }
+
+        if ( socks5_check_reply ( transfer->buffer, transfer->len ) < 0 )
+        {
+            perror ( "socks5 request" );
+            return STEP_FAIL;
+        }
+
+        return transfer_request ( engine, transfer ) < 0 ? STEP_FAIL : STEP_NEXT;
+
+    case TRANSFER_REQUEST_SEND:
+        return transfer_send ( transfer, TRANSFER_HEADER_RECV );
+
+    case TRANSFER_HEADER_RECV:
+        return transfer_header ( engine, transfer );
+
+    case TRANSFER_BODY_RECV:
+        return transfer_body ( engine, transfer );
+    }
+
+    errno = EINVAL;
+    return STEP_FAIL;
+}
+
+/**
+ * Handle socket event on transfer
+ */
+static void transfer_event ( struct engine_t *engine, struct transfer_t *transfer )
+{
+    int ret;
+    unsigned int events;
+    struct epoll_event event;
+
+    /* Any socket event postpones the timeout */
+    timer_arm ( engine, transfer );
+
+    while ( ( ret = transfer_step ( engine, transfer ) ) == STEP_NEXT )
+    {
+    }
+
+    if ( ret == STEP_FAIL )
+    {
+        /* Idle connection may be closed by server meanwhile, connect once again then */
+        if ( transfer->reused && transfer->fd < 0
+            && ( transfer->state == TRANSFER_REQUEST_SEND
+                || ( transfer->state == TRANSFER_HEADER_RECV && !transfer->len ) ) )
+        {
+            close ( transfer->sock );
+            transfer->sock = -1;
+
+            if ( transfer_connect ( engine, transfer, 0 ) >= 0 )
+            {
+                return;
+            }
+        }
+
+        transfer_finish ( engine, transfer, -1 );
+        return;
+    }
+
+    if ( ret == STEP_DONE )
+    {
+        /* Output must match announced size */
+        if ( transfer->fd >= 0 && file_finish ( transfer->fd,
+                transfer->limit ? transfer->limit : transfer->sum, engine->options ) < 0 )
+        {
+            perror ( "verify" );
+            transfer_finish ( engine, transfer, -1 );
+            return;
+        }
+
+        /* Keep connection for following transfers */
+        if ( transfer->keepalive )
+        {
+            transfer_release ( engine, transfer );
+        }
+
+        transfer_finish ( engine, transfer, 0 );
+        return;
+    }
+
+    /* Wait for readiness required by current state */
+    switch ( transfer->state )
+    {
+    case TRANSFER_CONNECT:
+    case TRANSFER_SOCKS5_HELLO_SEND:
+    case TRANSFER_SOCKS5_REQUEST_SEND:
+    case TRANSFER_REQUEST_SEND:
+        events = EPOLLOUT;
+        break;
+    default:
+        events = EPOLLIN;
+    }
+
+    if ( events != transfer->events )
+    {
+        transfer->events = events;
+        event.events = events;
+        event.data.ptr = transfer;
+
+        if ( epoll_ctl ( engine->epfd, EPOLL_CTL_MOD, transfer->sock, &event ) < 0 )
+        {
+            perror ( "epoll_ctl" );
+            transfer_finish ( engine, transfer, -1 );
+        }
+    }
+}
+
+/**
+ * Start next transfer from the source
+ */
+static int transfer_start ( struct engine_t *engine )
+{
+    char *url;
+    char *filepath;
+    struct transfer_t *transfer;
+
+    if ( engine->next ( engine->arg, &url, &filepath ) < 0 )
+    {
+        return -1;
+    }
+
+    engine->active++;
+
+    if ( !( transfer = ( struct transfer_t * ) calloc ( 1, sizeof ( struct transfer_t ) ) ) )
+    {
+        perror ( "calloc" );
+        engine->active--;
+        engine->done ( engine->arg, url, filepath, -1 );
+        return 0;
+    }
+
+    transfer->sock = -1;
+    transfer->fd = -1;
+    transfer->url = strdup ( url );
+    transfer->filepath = strdup ( filepath );
+    transfer->buffer = ( char * ) malloc ( ENGINE_BUFFER_SIZE );
+    transfer->size = ENGINE_BUFFER_SIZE;
+
+    if ( !transfer->url || !transfer->filepath || !transfer->buffer )
+    {
+        perror ( "malloc" );
+        free ( transfer->url );
+        free ( transfer->filepath );
+        free ( transfer->buffer );
+        free ( transfer );
+        engine->active--;
+        engine->done ( engine->arg, url, filepath, -1 );
+        return 0;
+    }
+
+    if ( transfer_connect ( engine, transfer, 1 ) < 0 )
+    {
+        transfer_finish ( engine, transfer, -1 );
+    }
+
+    return 0;
+}
+
+/**
+ * Expire timed out transfers
+ */
+static void engine_expire ( struct engine_t *engine )
+{
+    unsigned long now;
+    struct transfer_t *transfer;
+    struct transfer_t *next;
+
+    now = engine_now (  );
+
+    while ( engine->tick < now )
+    {
+        engine->tick++;
+
+        for ( transfer = engine->wheel[engine->tick % ENGINE_WHEEL_SLOTS]; transfer;
+            transfer = next )
+        {
+            next = transfer->next;
+
+            /* Slot is shared with later wheel rounds */
+            if ( transfer->expires <= engine->tick )
+            {
+                errno = ETIMEDOUT;
+                perror ( transfer->url );
+                transfer_finish ( engine, transfer, -1 );
+            }
+        }
+    }
+}
+
+/**
+ * Raise open files limit for many simultaneous transfers
+ */
+static void engine_raise_nofile ( void )
+{
+    struct rlimit rl;
+
+    if ( !getrlimit ( RLIMIT_NOFILE, &rl ) && rl.rlim_cur < rl.rlim_max )
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit ( RLIMIT_NOFILE, &rl );
+    }
+}
+
+/**
+ * Run transfers on event loop engine
+ */
+int engine_run ( const struct options_t *options, unsigned int limit,
+    int ( *next ) ( void *arg, char **url, char **filepath ),
+    void ( *done ) ( void *arg, const char *url, const char *filepath, int result ), void *arg )
+{
+    int i;
+    int count;
+    int exhausted = 0;
+    struct engine_t *engine;
+    struct epoll_event events[ENGINE_EVENTS_MAX];
+
+    if ( !( engine = ( struct engine_t * ) calloc ( 1, sizeof ( struct engine_t ) ) ) )
+    {
+        perror ( "calloc" );
+        return -1;
+    }
+
+    if ( ( engine->epfd = epoll_create1 ( 0 ) ) < 0 )
+    {
+        perror ( "epoll_create1" );
+        free ( engine );
+        return -1;
+    }
+
+    engine->options = options;
+    engine->next = next;
+    engine->done = done;
+    engine->arg = arg;
+    engine->tick = engine_now (  );
+
+    engine_raise_nofile (  );
+
+    /* One pipe serves all transfers as it is drained after each move */
+    engine->relay.pipe[0] = -1;
+    engine->relay.pipe[1] = -1;
+
+    if ( options->backend != BACKEND_COPY )
+    {
+        splice_open ( &engine->relay );
+    }
+
+    for ( ;; )
+    {
+        /* Keep transfers count up to the limit */
+        while ( !exhausted && engine->active < limit )
+        {
+            if ( transfer_start ( engine ) < 0 )
+            {
+                exhausted = 1;
+            }
+        }
+
+        if ( !engine->active )
+        {
+            break;
+        }
+
+        if ( ( count = epoll_wait ( engine->epfd, events, ENGINE_EVENTS_MAX,
+                    ENGINE_TICK_MSEC ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+
+            perror ( "epoll_wait" );
+            break;
+        }
+
+        for ( i = 0; i < count; i++ )
+        {
+            transfer_event ( engine, ( struct transfer_t * ) events[i].data.ptr );
+        }
+
+        engine_expire ( engine );
+    }
+
+    splice_close ( &engine->relay );
+    close ( engine->epfd );
+    free ( engine );
+
+    return 0;
+}
@@ -0,0 +1,311 @@
+/* ------------------------------------------------------------------
+ * Lget - Output File Support
+ * ------------------------------------------------------------------ */
+
+#define _GNU_SOURCE
+
+#include "lget.h"
+
+/**
+ * Reserve disk space for the rest of output file
+ */
+int file_preallocate ( int fd, size_t offset, size_t total )
+{
+    struct stat st;
+
+    /* Output may be a device or pipe */
+    if ( fstat ( fd, &st ) < 0 || !S_ISREG ( st.st_mode ) )
+    {
+        return 0;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    /* Output is written mostly in order */
+    posix_fadvise ( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+
+    if ( total <= offset )
+    {
+        return 0;
+    }
+
+#ifdef FALLOC_FL_KEEP_SIZE
+    /* Allocate contiguous extents, file size grows only with data written */
+    if ( fallocate ( fd, FALLOC_FL_KEEP_SIZE, offset, total - offset ) < 0 )
+    {
+        /* Not every file system supports preallocation */
+        if ( errno == EOPNOTSUPP || errno == ENOSYS || errno == EINVAL )
+        {
+            return 0;
+        }
+
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * Verify final size of output file and release its cached pages if requested
+ */
+int file_finish ( int fd, size_t size, const struct options_t *options )
+{
+    struct stat st;
+
+    if ( fstat ( fd, &st ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( !S_ISREG ( st.st_mode ) )
+    {
+        return 0;
+    }
+
+    /* Missing data is an error, stale data past the end is dropped */
+    if ( ( size_t ) st.st_size < size )
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    if ( ( size_t ) st.st_size > size && ftruncate ( fd, size ) < 0 )
+    {
+        return -1;
+    }
+
+#ifdef POSIX_FADV_DONTNEED
+    /* Pages can be dropped only once written back */
+    if ( options->nocache && !fdatasync ( fd ) )
+    {
+        posix_fadvise ( fd, 0, 0, POSIX_FADV_DONTNEED );
+    }
+#else
+    ( void ) options;
+#endif
+
+    return 0;
+}
+
+/**
+ * Copy file contents, kernel copies within file system if possible
+ */
+static int file_copy ( int src, int dst )
+{
+    ssize_t len;
+    ssize_t ret;
+    ssize_t done;
+    char buffer[FILE_COPY_BUFFER_SIZE];
+
+    for ( ;; )
+    {
+        if ( ( len = copy_file_range ( src, NULL, dst, NULL, FILE_COPY_CHUNK_SIZE, 0 ) ) > 0 )
+        {
+            continue;
+        }
+
+        if ( !len )
+        {
+            return 0;
+        }
+
+        /* Older kernels and some file systems copy through user space */
+        if ( errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP )
+        {
+            return -1;
+        }
+
+        break;
+    }
+
+    while ( ( len = read ( src, buffer, sizeof ( buffer ) ) ) > 0 )
+    {
+        for ( done = 0; done < len; done += ret )
+        {
+            if ( ( ret = write ( dst, buffer + done, len - done ) ) < 0 )
+            {
+                return -1;
+            }
+        }
+    }
+
+    return len < 0 ? -1 : 0;
+}
+
+/**
+ * Place copy of file at new path, sharing data by reflink or hard link if possible
+ */
+int file_clone ( const char *src, const char *dst )
+{
+    int ret;
+    int error;
+    int fd_src;
+    int fd_dst;
+
+    if ( ( fd_src = open ( src, O_RDONLY ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( ( fd_dst = open ( dst, O_CREAT | O_EXCL | O_WRONLY, 0644 ) ) < 0 )
+    {
+        close ( fd_src );
+        return -1;
+    }
+
+#ifdef FICLONE
+    /* Copy on write clone shares extents yet stays independent */
+    if ( !ioctl ( fd_dst, FICLONE, fd_src ) )
+    {
+        close ( fd_dst );
+        close ( fd_src );
+        return 0;
+    }
+#endif
+
+    /* Hard link shares the inode, so both names must be replaced rather than modified */
+    close ( fd_dst );
+    unlink ( dst );
+
+    if ( !link ( src, dst ) )
+    {
+        close ( fd_src );
+        return 0;
+    }
+
+    if ( ( fd_dst = open ( dst, O_CREAT | O_EXCL | O_WRONLY, 0644 ) ) < 0 )
+    {
+        close ( fd_src );
+        return -1;
+    }
+
+    if ( ( ret = file_copy ( fd_src, fd_dst ) ) < 0 )
+    {
+        error = errno;
+        unlink ( dst );
+        errno = error;
+    }
+
+    close ( fd_dst );
+    close ( fd_src );
+
+    return ret;
+}
+
+/**
+ * Write file data into existing output which cannot be replaced
+ */
+static int file_write ( const char *src, const char *dst )
+{
+    int ret;
+    int fd_src;
+    int fd_dst;
+
+    if ( ( fd_src = open ( src, O_RDONLY ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( ( fd_dst = open ( dst, O_WRONLY ) ) < 0 )
+    {
+        close ( fd_src );
+        return -1;
+    }
+
+    ret = file_copy ( fd_src, fd_dst );
+
+    close ( fd_dst );
+    close ( fd_src );
+
+    return ret;
+}
+
+/**
+ * Place copy of file at output path, regular output is replaced, devices and pipes written
+ */
+int file_place ( const char *src, const char *filepath )
+{
+    struct stat st;
+
+    if ( lstat ( filepath, &st ) < 0 || S_ISREG ( st.st_mode ) )
+    {
+        if ( !access ( filepath, F_OK ) && unlink ( filepath ) < 0 )
+        {
+            return -1;
+        }
+
+        return file_clone ( src, filepath );
+    }
+
+    return file_write ( src, filepath );
+}
+
+/**
+ * Release output file from shared copies, a hard link must not be written through,
+ * data kept for resume is copied into a private file first
+ */
+int file_detach ( const char *filepath, int keep )
+{
+    int ret = -1;
+    int error;
+    int fd_src;
+    int fd_dst;
+    struct stat st;
+    char tmp[PATH_MAX];
+
+    if ( lstat ( filepath, &st ) < 0 || !S_ISREG ( st.st_mode ) || st.st_nlink < 2 )
+    {
+        return 0;
+    }
+
+    if ( !keep )
+    {
+        return unlink ( filepath );
+    }
+
+    /* Temporary names are unique among concurrent downloads */
+    if ( ( size_t ) snprintf ( tmp, sizeof ( tmp ), "%s.%lu.%lx.tmp", filepath,
+            ( unsigned long ) getpid (  ), ( unsigned long ) pthread_self (  ) ) >= sizeof ( tmp ) )
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if ( ( fd_src = open ( filepath, O_RDONLY ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( ( fd_dst = open ( tmp, O_CREAT | O_EXCL | O_WRONLY, 0644 ) ) < 0 )
+    {
+        close ( fd_src );
+        return -1;
+    }
+
+#ifdef FICLONE
+    /* Copy on write clone stays independent of the shared inode */
+    if ( !ioctl ( fd_dst, FICLONE, fd_src ) )
+    {
+        ret = 0;
+    }
+#endif
+
+    if ( ret < 0 )
+    {
+        ret = file_copy ( fd_src, fd_dst );
+    }
+
+    close ( fd_dst );
+    close ( fd_src );
+
+    if ( ret < 0 || rename ( tmp, filepath ) < 0 )
+    {
+        error = errno;
+        unlink ( tmp );
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
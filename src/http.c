@@ -20,14 +20,31 @@ static int parse_http_host ( const char *url, char *hostname, size_t limit, unsi
     }
 
     url += 7;
-    end = url;
 
-    while ( *end && *end != ':' && *end != '/' )
+    /* IPv6 literal is bracketed */
+    if ( *url == '[' )
     {
-        end++;
+        if ( !( end = strchr ( ++url, ']' ) ) )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        len = end++ - url;
+
+    } else
+    {
+        end = url;
+
+        while ( *end && *end != ':' && *end != '/' )
+        {
+            end++;
+        }
+
+        len = end - url;
     }
 
-    if ( ( len = end - url ) >= limit )
+    if ( len >= limit )
     {
         errno = ENOBUFS;
         return -1;
@@ -66,356 +83,1122 @@ static const char *http_path ( const char *url )
 }
 
 /**
- * Extract content length from http response
+ * Parse http url into hostname, port and path
  */
-static int http_content_len ( const char *response, const char *body, size_t *content_len )
+int http_parse_url ( const char *url, char *hostname, size_t limit, unsigned short *port,
+    const char **path )
 {
-    const char *begin;
-    const char *s_content_len = "content-length: ";
+    if ( parse_http_host ( url, hostname, limit, port ) < 0 )
+    {
+        return -1;
+    }
 
-    if ( !( begin = lget_strcasestr ( response, s_content_len ) ) )
+    if ( !( *path = http_path ( url ) ) )
     {
-        errno = ENODATA;
         return -1;
     }
 
-    begin += strlen ( s_content_len );
+    return 0;
+}
+
+/**
+ * Report failed step, errno is kept for the retry policy
+ */
+static void http_error ( const char *name )
+{
+    int error;
+
+    error = errno;
+    perror ( name );
+    errno = error;
+}
+
+/**
+ * Connect with http server directly or via proxy
+ */
+int http_connect ( const char *hostname, unsigned short port, const struct options_t *options )
+{
+    int sock;
+    int count;
+    struct timeval tv;
+    const struct socks5_t *socks5;
+    struct address_t addrs[RESOLVE_ADDRS_MAX];
+
+    socks5 = options->socks5;
+
+    /* Connect endpoint or proxy server */
+    if ( socks5 )
+    {
+        sock = connect_race ( socks5->addrs, socks5->count, socks5->port, options );
+
+    } else
+    {
+        /* Resolve all server addresses */
+        if ( ( count =
+                resolve_host ( hostname, options->family, addrs, RESOLVE_ADDRS_MAX ) ) < 0 )
+        {
+            http_error ( "resolve" );
+            return -1;
+        }
+
+        /* Race staggered attempts, a dead address does not stall the download */
+        sock = connect_race ( addrs, count, port, options );
+    }
 
-    if ( begin > body )
+    if ( sock < 0 )
     {
-        errno = ENODATA;
+        http_error ( "connect" );
         return -1;
     }
 
-    if ( sscanf ( begin, "%lu", ( unsigned long * ) content_len ) <= 0 )
+    /* Set socket send timeout */
+    tv.tv_sec = 4;
+    tv.tv_usec = 0;
+    setsockopt ( sock, SOL_SOCKET, SO_SNDTIMEO, ( const char * ) &tv, sizeof ( tv ) );
+
+    /* Set socket receive timeuot, unless set up on connect as requested */
+    if ( !options->recv_timeout )
     {
-        errno = EINVAL;
+        tv.tv_sec = 4;
+        tv.tv_usec = 0;
+        setsockopt ( sock, SOL_SOCKET, SO_RCVTIMEO, ( const char * ) &tv, sizeof ( tv ) );
+    }
+
+    /* Setup Socks5 connection if needed */
+    if ( socks5 )
+    {
+        /* Perform Socks5 handshake */
+        if ( socks5_handshake ( sock ) < 0 )
+        {
+            http_error ( "socks5 handshake" );
+            close ( sock );
+            return -1;
+        }
+
+        /* Perform Socks5 request */
+        if ( socks5_request_hostname ( sock, hostname, port ) < 0 )
+        {
+            http_error ( "socks5 request" );
+            close ( sock );
+            return -1;
+        }
+    }
+
+    return sock;
+}
+
+/**
+ * Format http request with optional extra headers
+ */
+ssize_t http_format_request ( char *buffer, size_t size, const char *hostname,
+    unsigned short port, const char *path, const char *headers, int keepalive, int compressed )
+{
+    size_t len;
+    char host[HOSTNAME_SIZE + 8];
+
+    /* Default port is omitted from host header */
+    if ( format_host ( host, sizeof ( host ), hostname, port ) < 0 )
+    {
+        return -1;
+    }
+
+    len = snprintf ( buffer, size,
+        "GET %s HTTP/1.%c\r\n"
+        "Host: %s\r\n"
+        "User-Agent: Mozilla/5.0 (Windows NT 10.0; WOW64; rv:61.0) Gecko/20100101 Firefox/61.0\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: %s\r\n" "%s" "Connection: %s\r\n" "\r\n", path,
+        keepalive ? '1' : '0', host, compressed ? "gzip, deflate" : "", headers,
+        keepalive ? "keep-alive" : "close" );
+
+    if ( len >= size )
+    {
+        errno = ENOBUFS;
         return -1;
     }
 
+    return len;
+}
+
+/**
+ * Send http request with optional extra headers
+ */
+static int http_request ( int sock, const char *hostname, unsigned short port, const char *path,
+    const char *headers, int keepalive, int compressed )
+{
+    size_t len;
+    size_t sum;
+    ssize_t limit;
+    char buffer[8192];
+
+    /* Prepare http request */
+    if ( ( limit =
+            http_format_request ( buffer, sizeof ( buffer ), hostname, port, path, headers,
+                keepalive, compressed ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Send http request */
+    for ( sum = 0; sum < ( size_t ) limit; sum += len )
+    {
+        if ( ( ssize_t ) ( len = send ( sock, buffer + sum, limit - sum, MSG_NOSIGNAL ) ) < 0 )
+        {
+            return -1;
+        }
+    }
+
     return 0;
 }
 
 /**
- * Extract http status code
+ * Receive http response header, buffer grows up to header size limit
+ */
+static int http_response ( int sock, char **buffer, size_t *size, size_t *len,
+    struct response_t *response, size_t header_max )
+{
+    int ret;
+    ssize_t received;
+    size_t grown;
+    char *ptr;
+
+    response_init ( response );
+
+    for ( *len = 0;; *len += received )
+    {
+        /* Grow buffer when full, header must fit within the limit */
+        if ( *len + 1 >= *size )
+        {
+            if ( *size >= header_max )
+            {
+                errno = E2BIG;
+                return -1;
+            }
+
+            grown = *size * 2 < header_max ? *size * 2 : header_max;
+
+            if ( !( ptr = ( char * ) realloc ( *buffer, grown ) ) )
+            {
+                return -1;
+            }
+
+            *buffer = ptr;
+            *size = grown;
+        }
+
+        if ( ( received = recv ( sock, *buffer + *len, *size - *len - 1, 0 ) ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Detect broken pipe */
+        if ( !received )
+        {
+            errno = EPIPE;
+            return -1;
+        }
+
+        ( *buffer )[*len + received] = '\0';
+
+        /* Only the newly received bytes are scanned */
+        if ( ( ret = response_parse ( response, *buffer, *len + received ) ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( ret )
+        {
+            *len += received;
+            return 0;
+        }
+
+        if ( *len + received >= header_max )
+        {
+            errno = E2BIG;
+            return -1;
+        }
+    }
+}
+
+/**
+ * Open connection with http server, reuse idle one if possible
  */
-static int http_status ( const char *response, unsigned int *status )
+int http_open ( const char *hostname, unsigned short port, const struct options_t *options,
+    int *reused )
 {
-    while ( *response && *response != '\x20' )
+    int sock;
+    int flags;
+
+    *reused = 0;
+
+    /* Reuse idle connection if possible */
+    if ( options->keepalive && ( sock = pool_acquire ( hostname, port, options->socks5 ) ) >= 0 )
+    {
+        /* Connection may come from event loop engine */
+        if ( ( flags = fcntl ( sock, F_GETFL ) ) >= 0 )
+        {
+            fcntl ( sock, F_SETFL, flags & ~O_NONBLOCK );
+        }
+
+        *reused = 1;
+        return sock;
+    }
+
+    return http_connect ( hostname, port, options );
+}
+
+/**
+ * Open connection and exchange http request for response header
+ */
+int http_query ( const char *url, const char *headers, const struct options_t *options,
+    char **buffer, size_t *size, size_t *len, struct response_t *response )
+{
+    int sock;
+    int reused;
+    unsigned short port;
+    const char *path;
+    char hostname[HOSTNAME_SIZE];
+
+    /* Extract hostname and path from http url */
+    if ( http_parse_url ( url, hostname, sizeof ( hostname ), &port, &path ) < 0 )
     {
-        response++;
+        http_error ( "parse" );
+        return -1;
     }
 
-    if ( !*response || sscanf ( response, "%u", status ) <= 0 )
+    if ( ( sock = http_open ( hostname, port, options, &reused ) ) < 0 )
     {
-        errno = EINVAL;
         return -1;
     }
 
+    /* Idle connection may be closed by server meanwhile, connect once again then */
+    while ( http_request ( sock, hostname, port, path, headers, options->keepalive,
+            options->compressed ) < 0
+        || http_response ( sock, buffer, size, len, response, options->header_max ) < 0 )
+    {
+        close ( sock );
+
+        if ( !reused )
+        {
+            http_error ( "http" );
+            return -1;
+        }
+
+        reused = 0;
+
+        if ( ( sock = http_connect ( hostname, port, options ) ) < 0 )
+        {
+            return -1;
+        }
+    }
+
+    return sock;
+}
+
+/**
+ * Decode body slice and write its payload to output file
+ */
+static int http_body_write ( int fd, const char *data, size_t len, struct body_t *decoder,
+    struct encoding_t *encoding, size_t *sum, int *keepalive )
+{
+    ssize_t ret;
+    size_t payload_len;
+    const char *payload;
+
+    while ( len && !decoder->done )
+    {
+        if ( ( ret = body_decode ( decoder, data, len, &payload, &payload_len ) ) < 0 )
+        {
+            http_error ( "decode" );
+            return -1;
+        }
+
+        if ( payload_len && encoding_write ( encoding, fd, payload, payload_len ) < 0 )
+        {
+            http_error ( encoding->mode == ENCODING_IDENTITY ? "write" : "inflate" );
+            return -1;
+        }
+
+        *sum += payload_len;
+        data += ret;
+        len -= ret;
+    }
+
+    /* Data beyond the body means connection is out of sync */
+    if ( len )
+    {
+        *keepalive = 0;
+    }
+
     return 0;
 }
 
 /**
- * Perform http redirect
+ * Report receive failure, timeout of receive means the transfer stalled
  */
-static int http_redirect ( const char *buffer, const char *hostname, const char *filepath,
-    struct socks5_t *socks5 )
+static void http_recv_error ( const char *name )
 {
-    size_t len;
-    const char *begin;
-    const char *end;
-    char url[4096];
-    const char *s_location = "location: ";
+    if ( errno == EAGAIN || errno == EWOULDBLOCK )
+    {
+        errno = ETIMEDOUT;
+    }
+
+    http_error ( name );
+}
+
+/**
+ * Receive next body slice into output file, zero means connection closed
+ */
+static ssize_t http_body_recv ( int sock, int fd, char *buffer, size_t size,
+    struct body_t *decoder, struct encoding_t *encoding, struct splice_t *relay,
+    struct uring_t **ring, size_t *sum, int *keepalive )
+{
+    ssize_t len;
+    size_t direct;
 
-    if ( !( begin = lget_strcasestr ( buffer, s_location ) ) )
+    /* Chain receive and write on io_uring if selected */
+    if ( *ring && ( direct = body_direct_len ( decoder, URING_BUFFERS * URING_BUFFER_SIZE ) ) )
     {
-        errno = ENODATA;
+        if ( ( len = uring_recv ( *ring, sock, fd, *sum, direct ) ) > 0 )
+        {
+            body_skip ( decoder, len );
+            *sum += len;
+            return len;
+        }
+
+        if ( len < 0 && errno != ENOSYS )
+        {
+            http_recv_error ( "io_uring" );
+            return -1;
+        }
+
+        /* Fall back to copy loop, io_uring writes do not move file position */
+        uring_close ( *ring );
+        *ring = NULL;
+
+        if ( lseek ( fd, *sum, SEEK_SET ) < 0 )
+        {
+            http_error ( "lseek" );
+            return -1;
+        }
+
+        if ( !len )
+        {
+            return 0;
+        }
+    }
+
+    /* Move data from socket into file within kernel if possible */
+    if ( relay->pipe[0] >= 0 && ( direct = body_direct_len ( decoder, relay->size ) ) )
+    {
+        if ( ( len = splice_recv ( relay, sock, fd, NULL, direct ) ) > 0 )
+        {
+            body_skip ( decoder, len );
+            *sum += len;
+            return len;
+        }
+
+        if ( len < 0 && errno != ENOSYS )
+        {
+            http_recv_error ( "splice" );
+            return -1;
+        }
+
+        /* Fall back to copy loop */
+        splice_close ( relay );
+
+        if ( !len )
+        {
+            return 0;
+        }
+    }
+
+    if ( ( len = recv ( sock, buffer, size, 0 ) ) < 0 )
+    {
+        http_recv_error ( "recv" );
         return -1;
     }
 
-    begin += strlen ( s_location );
+    if ( len && http_body_write ( fd, buffer, len, decoder, encoding, sum, keepalive ) < 0 )
+    {
+        return -1;
+    }
+
+    return len;
+}
+
+/**
+ * Read rest of short redirect body, so connection may be reused
+ */
+static int http_drain ( int sock, char *buffer, size_t size, size_t remaining )
+{
+    ssize_t len;
 
-    if ( !( end = strstr ( begin, "\r\n" ) ) )
+    if ( remaining > REDIRECT_DRAIN_MAX )
     {
-        errno = ENODATA;
         return -1;
     }
 
-    if ( ( len = end - begin ) >= sizeof ( url ) )
+    while ( remaining )
     {
-        errno = ENOBUFS;
+        if ( ( len = recv ( sock, buffer, remaining < size ? remaining : size, 0 ) ) <= 0 )
+        {
+            return -1;
+        }
+
+        remaining -= len;
+    }
+
+    return 0;
+}
+
+/**
+ * Place cached copy of unchanged file at output path
+ */
+static int http_cache_restore ( const char *url, const char *filepath,
+    const struct options_t *options, size_t length )
+{
+    struct checksum_t checksum;
+
+    if ( cache_restore ( options->cache, url, filepath ) < 0 )
+    {
+        http_error ( "cache" );
         return -1;
     }
 
-    if ( 7 + strlen ( hostname ) + len >= sizeof ( url ) )
+    /* Cached copy is verified as a whole */
+    if ( checksum_start ( &checksum, options->checksum, filepath, length ) < 0 )
     {
-        errno = ENOBUFS;
+        http_error ( "checksum" );
         return -1;
     }
 
-    if ( *begin == '/' )
+    if ( checksum_finish ( &checksum, length ) < 0 )
     {
-        memcpy ( url, "http://", 7 );
-        memcpy ( url + 7, hostname, strlen ( hostname ) );
-        memcpy ( url + 7 + strlen ( hostname ), begin, len );
-        url[strlen ( hostname ) + len + 7] = '\0';
+        http_error ( "checksum" );
+        unlink ( filepath );
+        return -1;
+    }
 
-    } else
+    if ( options->progress )
     {
-        memcpy ( url, begin, len );
-        url[len] = '\0';
+        printf ( "%s: %lu/%lu - not modified, cached\n", get_basename ( filepath ),
+            ( unsigned long ) length, ( unsigned long ) length );
     }
 
-    printf ( "redirect: %s\n", url );
-    return http_get ( url, filepath, socks5 );
+    return 0;
 }
 
+/**
+ * Store downloaded file in cache, failure does not fail the download
+ */
+static void http_cache_store ( const char *url, const char *filepath,
+    const struct options_t *options, const struct cache_t *fresh )
+{
+    if ( cache_store ( options->cache, url, fresh, filepath, options->cache_max ) < 0 )
+    {
+        http_error ( "cache" );
+    }
+}
 
 /**
- * Download file via Http
+ * Download file via Http into caller provided buffer, redirect target is stored in location
  */
-int http_get ( const char *url, const char *filepath, struct socks5_t *socks5 )
+static int http_download ( const char *url, const char *filepath,
+    const struct options_t *options, char **buffer, size_t *size, struct retry_t *retry,
+    char *location )
 {
     int fd;
     int sock;
-    unsigned int addr;
-    unsigned int status;
+    int ret;
+    int error;
+    int keepalive;
+    int cacheable = 0;
     unsigned short port;
     size_t len;
     size_t sum;
-    size_t limit;
+    size_t limit = 0;
+    size_t offset = 0;
     const char *path;
-    const char *body = NULL;
+    const char *body;
     const char *basename;
-    struct timeval tv;
-    struct sockaddr_in saddr;
+    struct response_t response;
+    struct body_t decoder;
+    struct encoding_t encoding;
+    struct checksum_t checksum;
+    struct splice_t relay;
+    struct uring_t *ring;
+    struct progress_t progress;
+    struct stall_t stall;
+    struct cache_t cached;
+    struct cache_t fresh;
+    struct stat st;
     char hostname[HOSTNAME_SIZE];
-    char buffer[32768];
+    char range[64];
+    char headers[CACHE_HEADERS_SIZE];
 
     /* Setup file basename */
     basename = get_basename ( filepath );
 
-    /* Extract hostname from url http */
-    if ( parse_http_host ( url, hostname, sizeof ( hostname ), &port ) < 0 )
+    /* Extract hostname and path from http url */
+    if ( http_parse_url ( url, hostname, sizeof ( hostname ), &port, &path ) < 0 )
     {
-        perror ( "parse" );
+        http_error ( "parse" );
         return -1;
     }
 
-    /* Extract path from http url */
-    if ( !( path = http_path ( url ) ) )
+    /* Continue from the end of partial file if requested, encoded body is fetched whole */
+    if ( options->resume && !options->compressed && !stat ( filepath, &st )
+        && S_ISREG ( st.st_mode ) )
     {
-        perror ( "parse" );
-        return -1;
+        offset = st.st_size;
     }
 
-    /* Prepare server address */
-    memset ( &saddr, '\0', sizeof ( saddr ) );
-    saddr.sin_family = AF_INET;
-
-    /* Connect endpoint or proxy server */
-    if ( socks5 )
+    /* Request remaining bytes, also probes byte ranges support for segments */
+    if ( offset || ( options->connections > 1 && !options->compressed ) )
     {
-        saddr.sin_addr.s_addr = socks5->addr;
-        saddr.sin_port = htons ( socks5->port );
+        snprintf ( range, sizeof ( range ), "Range: bytes=%lu-\r\n", ( unsigned long ) offset );
 
     } else
     {
-        /* Resolve server address */
-        if ( resolve_ipv4 ( hostname, &addr ) < 0 )
-        {
-            perror ( "resolve" );
-            return -1;
-        }
-        saddr.sin_addr.s_addr = addr;
-        saddr.sin_port = htons ( port );
+        range[0] = '\0';
     }
 
-    /* Create server socket */
-    if ( ( sock = socket ( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    /* Cached copy is revalidated instead of downloaded again */
+    cached.found = 0;
+    memcpy ( headers, range, sizeof ( range ) );
+
+    if ( options->cache && !offset && !cache_lookup ( options->cache, url, &cached ) )
     {
-        perror ( "socket" );
-        return -1;
+        cache_conditional ( &cached, headers, sizeof ( headers ) );
     }
 
-    tv.tv_sec = 4;
-    tv.tv_usec = 0;
-    setsockopt ( sock, SOL_SOCKET, SO_SNDTIMEO, ( const char * ) &tv, sizeof ( tv ) );
-
-    /* Set socket receive timeuot */
-    tv.tv_sec = 4;
-    tv.tv_usec = 0;
-    setsockopt ( sock, SOL_SOCKET, SO_RCVTIMEO, ( const char * ) &tv, sizeof ( tv ) );
-
-    /* Connect with server */
-    if ( connect ( sock, ( struct sockaddr * ) &saddr, sizeof ( struct sockaddr_in ) ) < 0 )
+    /* Send http request and receive response header */
+    if ( ( sock = http_query ( url, headers, options, buffer, size, &sum, &response ) ) < 0 )
     {
-        perror ( "connect" );
-        close ( sock );
         return -1;
     }
 
-    /* Setup Socks5 connection if needed */
-    if ( socks5 )
+    /* Status decides whether failed attempt is retried */
+    retry->status = response.status;
+    retry->has_retry_after = response.has_retry_after;
+    retry->retry_after = response.retry_after;
+
+    /* Body follows the header within the buffer */
+    body = *buffer + response.header_len;
+
+    /* Connection may be reused if response body is delimited */
+    keepalive = options->keepalive && response_keepalive ( &response );
+
+    if ( response_redirect ( &response ) )
     {
-        /* Perform Socks5 handshake */
-        if ( socks5_handshake ( sock ) < 0 )
+        if ( response_location ( &response, *buffer, url, location, HTTP_URL_SIZE ) < 0 )
         {
-            perror ( "socks5 handshake" );
+            http_error ( "redirect" );
+            close ( sock );
             return -1;
         }
 
-        /* Perform Socks5 request */
-        if ( socks5_request_hostname ( sock, hostname, port ) < 0 )
+        /* Permanent redirect is taken without request next time */
+        if ( response_permanent ( &response ) )
         {
-            perror ( "socks5 request" );
-            return -1;
+            redirect_cache_store ( url, location );
         }
-    }
 
-    /* Prepare http request */
-    snprintf ( buffer, sizeof ( buffer ),
-        "GET %s HTTP/1.0\r\n"
-        "Host: %s\r\n"
-        "User-Agent: Mozilla/5.0 (Windows NT 10.0; WOW64; rv:61.0) Gecko/20100101 Firefox/61.0\r\n"
-        "Accept-Language: en-US,en;q=0.5\r\n"
-        "Accept-Encoding: \r\n" "Connection: close\r\n" "\r\n", path, hostname );
+        /* Keep connection for redirect once the whole body is received */
+        if ( keepalive && response.has_length
+            && sum - response.header_len <= response.content_len
+            && http_drain ( sock, *buffer, *size,
+                response.content_len - ( sum - response.header_len ) ) >= 0 )
+        {
+            pool_release ( sock, hostname, port, options->socks5 );
 
-    /* Send http request */
-    for ( limit = strlen ( buffer ), sum = 0; sum < limit; sum += len )
-    {
-        if ( ( ssize_t ) ( len = send ( sock, buffer + sum, limit - sum, MSG_NOSIGNAL ) ) < 0 )
+        } else
         {
-            perror ( "send" );
             close ( sock );
-            return -1;
         }
+
+        if ( options->progress )
+        {
+            printf ( "redirect: %s\n", location );
+        }
+
+        return HTTP_REDIRECT;
     }
 
-    /* Receive http response */
-    for ( sum = 0; sum < sizeof ( buffer ); )
+    /* Unchanged file is taken from cache, response has no body */
+    if ( response.status == 304 && cached.found )
     {
-        if ( ( ssize_t ) ( len =
-                recv ( sock, buffer + sum, sizeof ( buffer ) - sum - 1, 0 ) ) <= 0 )
+        if ( keepalive )
+        {
+            pool_release ( sock, hostname, port, options->socks5 );
+
+        } else
         {
-            if ( !errno )
-            {
-                errno = EPIPE;
-            }
-            perror ( "recv" );
             close ( sock );
-            return -1;
         }
 
-        sum += len;
-        buffer[sum] = '\0';
+        return http_cache_restore ( url, filepath, options, cached.length );
+    }
+
+    /* Partial file may already be complete */
+    if ( response.status == 416 && offset && response.has_complete
+        && response.complete_len == offset )
+    {
+        close ( sock );
 
-        if ( http_status ( buffer, &status ) < 0 )
+        /* Complete file is verified as a whole */
+        if ( checksum_start ( &checksum, options->checksum, filepath, offset ) < 0 )
         {
-            continue;
+            http_error ( "checksum" );
+            return -1;
         }
 
-        if ( status == 300 || status == 301 || status == 302 )
+        if ( checksum_finish ( &checksum, offset ) < 0 )
         {
-            close ( sock );
-            return http_redirect ( buffer, hostname, filepath, socks5 );
+            http_error ( "checksum" );
+            unlink ( filepath );
+            return -1;
+        }
+
+        if ( options->progress )
+        {
+            printf ( "%s: %lu/%lu - OK\n", basename, ( unsigned long ) offset,
+                ( unsigned long ) offset );
         }
+        return 0;
+    }
+
+    if ( response.status != 200 && response.status != 206 )
+    {
+        errno = response.status;
+        http_error ( "http status" );
+        errno = EINVAL;
+        close ( sock );
+        return -1;
+    }
+
+    /* Complete file is cached along with its validators, also when ignored range restarts it */
+    if ( options->cache && ( !offset || response.status == 200 ) )
+    {
+        cache_validators ( &fresh, &response, *buffer );
+        cacheable = 1;
+    }
+
+    /* Copy shared with cache or store is never written through, resumed prefix is kept */
+    if ( ( options->cache || options->store )
+        && file_detach ( filepath, offset && response.status == 206 ) < 0 )
+    {
+        http_error ( "detach" );
+        close ( sock );
+        return -1;
+    }
 
-        if ( status != 200 )
+    if ( response.status == 206 )
+    {
+        /* Validate range against the requested one */
+        if ( !response.has_range || response.range_begin != offset
+            || response.range_end + 1 != response.range_total )
         {
-            errno = status;
-            perror ( "http status" );
             errno = EINVAL;
+            http_error ( "range" );
             close ( sock );
             return -1;
         }
 
-        if ( ( body = strstr ( buffer, "\r\n\r\n" ) ) )
+        limit = response.range_total;
+
+        /* Split download into segments if requested, holes rule out resume */
+        if ( options->connections > 1 )
         {
-            break;
+            retry->opened = 1;
+            retry->resumable = 0;
+            ret = segment_get ( sock, url, filepath, body, sum - response.header_len, offset,
+                limit, options );
+            close ( sock );
+
+            if ( !ret && cacheable )
+            {
+                http_cache_store ( url, filepath, options, &fresh );
+            }
+
+            return ret;
         }
+
+    } else
+    {
+        /* Server ignored the range, start over */
+        offset = 0;
+    }
+
+    /* Body may be sized, chunked or delimited by connection close */
+    body_init ( &decoder, &response );
+
+    if ( decoder.mode == BODY_CLOSE )
+    {
+        keepalive = 0;
+    }
+
+    /* Total size is unknown without content length */
+    if ( response.status == 200 )
+    {
+        limit = decoder.mode == BODY_LENGTH ? decoder.remaining : 0;
     }
 
-    /* Check if response header is complete */
-    if ( !body )
+    /* Compressed body is inflated between receive loop and file */
+    if ( encoding_init ( &encoding, &response, *buffer ) < 0 )
     {
-        errno = E2BIG;
-        perror ( "recv" );
+        http_error ( "content encoding" );
         close ( sock );
         return -1;
     }
 
-    body += 4;
+    /* Open output file */
+    if ( ( fd = open ( filepath, O_CREAT | O_WRONLY | ( offset ? 0 : O_TRUNC ), 0644 ) ) < 0 )
+    {
+        http_error ( "open" );
+        encoding_close ( &encoding );
+        close ( sock );
+        return -1;
+    }
 
-    /* Extract content length parameter */
-    if ( http_content_len ( buffer, body, &limit ) < 0 )
+    /* Append to partial file */
+    if ( offset && lseek ( fd, offset, SEEK_SET ) < 0 )
     {
-        perror ( "clen" );
+        http_error ( "lseek" );
+        encoding_close ( &encoding );
         close ( sock );
+        close ( fd );
         return -1;
     }
 
-    /* Open output file */
-    if ( ( fd = open ( filepath, O_CREAT | O_WRONLY | O_TRUNC, 0644 ) ) < 0 )
+    /* Written prefix of plain regular file may be resumed by next attempt */
+    retry->opened = 1;
+    retry->resumable = encoding.mode == ENCODING_IDENTITY && !fstat ( fd, &st )
+        && S_ISREG ( st.st_mode );
+    retry->offset = offset;
+
+    /* Reserve disk space, so a full disk fails before the transfer, decoded size is unknown */
+    if ( file_preallocate ( fd, offset, encoding.mode == ENCODING_IDENTITY ? limit : 0 ) < 0 )
     {
-        perror ( "open" );
+        http_error ( "fallocate" );
+        encoding_close ( &encoding );
+        close ( sock );
+        close ( fd );
+        return -1;
+    }
+
+    /* Checksum thread follows written data in file order, partial file included */
+    if ( checksum_start ( &checksum, options->checksum, filepath, offset ) < 0 )
+    {
+        http_error ( "checksum" );
+        encoding_close ( &encoding );
+        close ( sock );
+        close ( fd );
         return -1;
     }
 
     /* Copy first data slice */
-    sum = buffer + sum - body;
+    len = sum - response.header_len;
+    sum = offset;
 
-    if ( sum )
+    if ( http_body_write ( fd, body, len, &decoder, &encoding, &sum, &keepalive ) < 0 )
     {
-        if ( write ( fd, body, sum ) < 0 )
+        retry->offset = sum;
+        checksum_cancel ( &checksum );
+        encoding_close ( &encoding );
+        close ( sock );
+        close ( fd );
+        return -1;
+    }
+
+    /* Sized or close delimited body may bypass user space */
+    relay.pipe[0] = -1;
+    relay.pipe[1] = -1;
+    ring = NULL;
+
+    if ( encoding.mode == ENCODING_IDENTITY && body_direct_len ( &decoder, 1 ) )
+    {
+        if ( options->backend == BACKEND_URING )
         {
-            perror ( "write" );
-            close ( sock );
-            close ( fd );
-            return -1;
+            ring = uring_open (  );
+
+        } else if ( options->backend == BACKEND_SPLICE )
+        {
+            splice_open ( &relay );
         }
+    }
 
-        printf ( "\r%s: %lu/%lu", basename, ( unsigned long ) sum, ( unsigned long ) limit );
+    /* Reporter prints in intervals, receive loop only updates the counter */
+    progress_start ( &progress, basename, offset, limit, options->progress );
+    progress_set ( &progress, sum );
+
+    if ( encoding.mode != ENCODING_IDENTITY )
+    {
+        progress_decoded ( &progress, encoding.decoded );
     }
 
+    mirror_stall_start ( &stall, sum, options->min_speed );
+
     /* Further data receive */
-    for ( ; sum < limit; sum += len )
+    for ( ret = 0; !decoder.done; )
     {
-        len = limit - sum;
-
-        if ( len > sizeof ( buffer ) )
+        if ( ( ret =
+                http_body_recv ( sock, fd, *buffer, *size, &decoder, &encoding, &relay, &ring,
+                    &sum, &keepalive ) ) < 0 )
         {
-            len = sizeof ( buffer );
+            break;
         }
 
-        if ( ( ssize_t ) ( len = recv ( sock, buffer, len, 0 ) ) <= 0 )
+        /* Connection close may terminate the body */
+        if ( !ret )
         {
-            if ( !errno )
+            if ( ( ret = body_eof ( &decoder ) ) < 0 )
             {
-                errno = EPIPE;
+                http_error ( "recv" );
             }
-            perror ( "recv" );
-            close ( sock );
-            close ( fd );
-            return -1;
+            break;
+        }
+
+        progress_set ( &progress, sum );
 
+        if ( encoding.mode != ENCODING_IDENTITY )
+        {
+            progress_decoded ( &progress, encoding.decoded );
         }
 
-        if ( write ( fd, buffer, len ) < 0 )
+        checksum_update ( &checksum,
+            encoding.mode != ENCODING_IDENTITY ? encoding.decoded : sum );
+
+        /* Slow transfer is abandoned, so it may continue elsewhere */
+        if ( mirror_stall_check ( &stall, sum ) < 0 )
         {
-            perror ( "write" );
-            close ( sock );
-            close ( fd );
-            return -1;
+            http_error ( "stall" );
+            ret = -1;
+            break;
         }
+    }
+
+    /* Compressed stream must end together with the body */
+    if ( ret >= 0 && encoding_finish ( &encoding ) < 0 )
+    {
+        http_error ( "inflate" );
+        ret = -1;
+    }
+
+    encoding_close ( &encoding );
+    splice_close ( &relay );
+
+    if ( ring )
+    {
+        uring_close ( ring );
+    }
 
-        printf ( "\r%s: %lu/%lu", basename, ( unsigned long ) ( sum + len ),
-            ( unsigned long ) limit );
+    if ( ret < 0 )
+    {
+        error = errno;
+        retry->offset = sum;
+        checksum_cancel ( &checksum );
+        progress_stop ( &progress, -1 );
+        close ( sock );
+        close ( fd );
+        errno = error;
+        return -1;
+    }
+
+    len = encoding.mode != ENCODING_IDENTITY ? encoding.decoded : limit ? limit : sum;
+
+    /* Mismatching file is removed, so it is not mistaken for a partial one */
+    if ( checksum_finish ( &checksum, len ) < 0 )
+    {
+        progress_stop ( &progress, -1 );
+        http_error ( "checksum" );
+        unlink ( filepath );
+        retry->resumable = 0;
+        close ( sock );
+        close ( fd );
+        return -1;
+    }
+
+    /* Output must match announced size */
+    if ( file_finish ( fd, len, options ) < 0 )
+    {
+        progress_stop ( &progress, -1 );
+        http_error ( "verify" );
+        close ( sock );
+        close ( fd );
+        return -1;
+    }
+
+    progress_stop ( &progress, 0 );
+
+    /* Keep connection for following downloads */
+    if ( keepalive )
+    {
+        pool_release ( sock, hostname, port, options->socks5 );
+
+    } else
+    {
+        close ( sock );
     }
 
-    printf ( " - OK\n" );
-    close ( sock );
     close ( fd );
 
+    if ( cacheable )
+    {
+        http_cache_store ( url, filepath, options, &fresh );
+    }
+
     return 0;
 }
+
+/**
+ * Download file via Http in single attempt, redirects are followed in place
+ */
+static int http_fetch ( const char *url, const char *filepath,
+    const struct options_t *options, struct retry_t *retry )
+{
+    int ret;
+    int error;
+    unsigned int hops = 0;
+    size_t size;
+    char *buffer;
+    char *urls;
+    char *target;
+
+    /* Buffer may grow while receiving response header */
+    size = HTTP_BUFFER_SIZE;
+
+    if ( !( buffer = ( char * ) malloc ( size ) ) )
+    {
+        http_error ( "malloc" );
+        return -1;
+    }
+
+    /* Current and next url alternate between two slots */
+    if ( !( urls = ( char * ) malloc ( 2 * HTTP_URL_SIZE ) ) )
+    {
+        http_error ( "malloc" );
+        free ( buffer );
+        return -1;
+    }
+
+    target = urls;
+
+    for ( ;; )
+    {
+        /* Known permanent redirect saves a round trip */
+        if ( redirect_cache_lookup ( url, target, HTTP_URL_SIZE ) >= 0 )
+        {
+            if ( options->progress )
+            {
+                printf ( "redirect: %s (cached)\n", target );
+            }
+
+            ret = HTTP_REDIRECT;
+
+        } else
+        {
+            ret = http_download ( url, filepath, options, &buffer, &size, retry, target );
+        }
+
+        if ( ret != HTTP_REDIRECT )
+        {
+            break;
+        }
+
+        if ( ++hops > options->redirects )
+        {
+            errno = ELOOP;
+            http_error ( "redirect" );
+            ret = -1;
+            break;
+        }
+
+        url = target;
+        target = target == urls ? urls + HTTP_URL_SIZE : urls;
+    }
+
+    /* Retry policy reads the error of failed attempt */
+    if ( ret < 0 )
+    {
+        retry->error = errno;
+    }
+
+    error = errno;
+    free ( urls );
+    free ( buffer );
+    errno = error;
+
+    return ret;
+}
+
+/**
+ * Download file via Http, transient failures are retried, state is carried between calls
+ */
+int http_transfer ( const char *url, const char *filepath, const struct options_t *options,
+    struct options_t *current, struct retry_t *retry )
+{
+    int ret;
+    unsigned int attempt;
+    unsigned long delay;
+
+    for ( attempt = 0;; attempt++ )
+    {
+        retry->status = 0;
+        retry->has_retry_after = 0;
+        retry->error = 0;
+
+        if ( ( ret = http_fetch ( url, filepath, current, retry ) ) >= 0
+            || attempt >= options->retries || !retry_allowed ( options, retry, retry->error ) )
+        {
+            break;
+        }
+
+        /* Continue after written prefix */
+        if ( retry_resume ( filepath, options, retry, current ) < 0 )
+        {
+            break;
+        }
+
+        delay = retry_delay ( options, retry, attempt );
+
+        if ( options->progress )
+        {
+            printf ( "retry: %s in %lu ms, attempt %u of %u\n", url, delay, attempt + 2,
+                options->retries + 1 );
+        }
+
+        retry_sleep ( delay );
+    }
+
+    return ret;
+}
+
+/**
+ * Download file via Http, transient failures are retried
+ */
+int http_get ( const char *url, const char *filepath, const struct options_t *options )
+{
+    int ret;
+    struct retry_t retry;
+    struct options_t current;
+
+    /* Content known by expected digest is taken from store */
+    if ( options->store && !store_fetch ( filepath, options ) )
+    {
+        return 0;
+    }
+
+    memset ( &retry, '\0', sizeof ( retry ) );
+    current = *options;
+
+    /* Failing to store does not fail the download */
+    if ( ( ret = http_transfer ( url, filepath, options, &current, &retry ) ) >= 0
+        && options->store && store_put ( filepath, options ) < 0 )
+    {
+        http_error ( "store" );
+    }
+
+    return ret;
+}
@@ -9,29 +9,67 @@
  */
 static void show_usage ( void )
 {
-    printf ( "usage: lget [-s5h|--socks5h] hostname:port url file\n" );
+    printf ( "usage: lget [-s5h|--socks5h hostname:port] [-n|--connections count] [-c|--continue]\n"
+        "            [-k|--keep-alive] [-b|--backend copy|splice|uring] [-N|--no-cache]\n"
+        "            [-H|--header-max bytes] [-z|--compressed] [-q|--quiet]\n"
+        "            [-C|--checksum sha256|md5|crc32c:hex]\n"
+        "            [-F|--family prefer-ipv6|prefer-ipv4|ipv4|ipv6] [-r|--retries count]\n"
+        "            [-d|--retry-delay ms] [-S|--retry-on status,...] [-T|--fastopen]\n"
+        "            [-D|--nodelay] [-Q|--quickack] [-R|--rcvbuf bytes]\n"
+        "            [-G|--congestion name] [-m|--max-redirects count]\n"
+        "            [-M|--mirror url]... [-W|--swarm] [-L|--min-speed bytes]\n"
+        "            [-K|--cache dir] [-E|--cache-max bytes] [-B|--store dir]\n"
+        "            [-Z|--delta manifest] url file\n"
+        "       lget [options] -i|--input-file list [-j|--jobs count]\n"
+        "            [-e|--engine threads|epoll] [-P|--pipeline depth]\n"
+        "       lget -Y|--make-manifest file manifest\n" );
 }
 
 /*
  * Main program task
  */
-int lget_task ( const char *url, const char *filepath, const struct socks5h_t *socks5h )
+int lget_task ( const char *url, const char *filepath, const struct socks5h_t *socks5h,
+    struct options_t *options )
 {
+    int count;
     struct socks5_t socks5;
 
     /* Setup socks5 details if needed */
     if ( socks5h )
     {
-        if ( nsaddr ( socks5h->hostname, &socks5.addr ) < 0 )
+        if ( ( count =
+                resolve_host ( socks5h->hostname, options->family, socks5.addrs,
+                    RESOLVE_ADDRS_MAX ) ) < 0 )
         {
-            perror ( "nsaddr" );
+            perror ( "resolve" );
             return -1;
         }
+        socks5.count = count;
         socks5.port = socks5h->port;
     }
 
+    options->socks5 = socks5h ? &socks5 : NULL;
+
+    /* Download files listed in input file */
+    if ( options->input )
+    {
+        return batch_get ( options->input, options );
+    }
+
+    /* Download only blocks missing from local copy */
+    if ( options->delta )
+    {
+        return delta_get ( url, filepath, options );
+    }
+
+    /* Download file from fastest of mirrors */
+    if ( options->mirror_count )
+    {
+        return mirror_get ( url, filepath, options );
+    }
+
     /* Download file over http protocol */
-    if ( http_get ( url, filepath, socks5h ? &socks5 : NULL ) < 0 )
+    if ( http_get ( url, filepath, options ) < 0 )
     {
         return -1;
     }
@@ -44,37 +82,445 @@ int lget_task ( const char *url, const char *filepath, const struct socks5h_t *s
  */
 int main ( int argc, char *argv[] )
 {
-    int argoff = 0;
+    int argoff = 1;
     int use_socks5h = 0;
+    int make_manifest = 0;
     struct socks5h_t socks5h;
+    struct digest_t checksum;
+    struct options_t options;
+
+    memset ( &options, '\0', sizeof ( options ) );
+    options.connections = 1;
+    options.jobs = BATCH_JOBS_DEFAULT;
+    options.backend = BACKEND_SPLICE;
+    options.family = FAMILY_PREFER_IPV6;
+    options.header_max = HTTP_HEADER_MAX;
+    options.redirects = REDIRECTS_DEFAULT;
+    options.retry_delay = RETRY_DELAY_MSEC;
+    options.progress = 1;
+    options.cache_max = CACHE_SIZE_DEFAULT;
+    retry_parse_status ( RETRY_STATUS_DEFAULT, &options );
 
-    if ( argc < 3 )
+    /* Parse program options */
+    for ( ; argoff < argc && argv[argoff][0] == '-'; argoff++ )
+    {
+        if ( !strcmp ( argv[argoff], "-s5h" ) || !strcmp ( argv[argoff], "--socks5h" ) )
+        {
+            if ( argoff + 1 >= argc
+                || parse_host ( argv[argoff + 1], socks5h.hostname, sizeof ( socks5h.hostname ),
+                    &socks5h.port ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            use_socks5h = 1;
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-c" ) || !strcmp ( argv[argoff], "--continue" ) )
+        {
+            options.resume = 1;
+
+        } else if ( !strcmp ( argv[argoff], "-k" ) || !strcmp ( argv[argoff], "--keep-alive" ) )
+        {
+            options.keepalive = 1;
+
+        } else if ( !strcmp ( argv[argoff], "-q" ) || !strcmp ( argv[argoff], "--quiet" ) )
+        {
+            options.progress = 0;
+
+        } else if ( !strcmp ( argv[argoff], "-z" ) || !strcmp ( argv[argoff], "--compressed" ) )
+        {
+#ifdef DISABLE_ZLIB
+            show_usage (  );
+            return 1;
+#else
+            options.compressed = 1;
+#endif
+
+        } else if ( !strcmp ( argv[argoff], "-N" ) || !strcmp ( argv[argoff], "--no-cache" ) )
+        {
+            options.nocache = 1;
+
+        } else if ( !strcmp ( argv[argoff], "-T" ) || !strcmp ( argv[argoff], "--fastopen" ) )
+        {
+#ifndef TCP_FASTOPEN_CONNECT
+            show_usage (  );
+            return 1;
+#else
+            options.fastopen = 1;
+#endif
+
+        } else if ( !strcmp ( argv[argoff], "-D" ) || !strcmp ( argv[argoff], "--nodelay" ) )
+        {
+            options.nodelay = 1;
+
+        } else if ( !strcmp ( argv[argoff], "-Q" ) || !strcmp ( argv[argoff], "--quickack" ) )
+        {
+            options.quickack = 1;
+
+        } else if ( !strcmp ( argv[argoff], "-R" ) || !strcmp ( argv[argoff], "--rcvbuf" ) )
+        {
+            if ( argoff + 1 >= argc || sscanf ( argv[argoff + 1], "%u", &options.rcvbuf ) <= 0
+                || !options.rcvbuf || options.rcvbuf > INT_MAX / 2 )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-G" ) || !strcmp ( argv[argoff], "--congestion" ) )
+        {
+            if ( argoff + 1 >= argc || !*argv[argoff + 1] )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            options.congestion = argv[argoff + 1];
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-n" ) || !strcmp ( argv[argoff], "--connections" ) )
+        {
+            if ( argoff + 1 >= argc
+                || sscanf ( argv[argoff + 1], "%u", &options.connections ) <= 0
+                || !options.connections )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-H" ) || !strcmp ( argv[argoff], "--header-max" ) )
+        {
+            if ( argoff + 1 >= argc
+                || sscanf ( argv[argoff + 1], "%lu", ( unsigned long * ) &options.header_max ) <= 0
+                || options.header_max < HTTP_HEADER_MIN || options.header_max > HTTP_HEADER_LIMIT )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-C" ) || !strcmp ( argv[argoff], "--checksum" ) )
+        {
+            if ( argoff + 1 >= argc || digest_parse ( argv[argoff + 1], &checksum ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            options.checksum = &checksum;
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-m" ) || !strcmp ( argv[argoff], "--max-redirects" ) )
+        {
+            if ( argoff + 1 >= argc
+                || sscanf ( argv[argoff + 1], "%u", &options.redirects ) <= 0
+                || options.redirects > REDIRECTS_LIMIT )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-M" ) || !strcmp ( argv[argoff], "--mirror" ) )
+        {
+            if ( argoff + 1 >= argc || options.mirror_count + 1 >= MIRRORS_MAX )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            options.mirrors[options.mirror_count++] = argv[argoff + 1];
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-W" ) || !strcmp ( argv[argoff], "--swarm" ) )
+        {
+            options.swarm = 1;
+
+        } else if ( !strcmp ( argv[argoff], "-L" ) || !strcmp ( argv[argoff], "--min-speed" ) )
+        {
+            if ( argoff + 1 >= argc
+                || sscanf ( argv[argoff + 1], "%lu", ( unsigned long * ) &options.min_speed ) <= 0
+                || !options.min_speed )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            /* Stalled receive must return to have its throughput checked */
+            options.recv_timeout = STALL_WINDOW_MSEC;
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-K" ) || !strcmp ( argv[argoff], "--cache" ) )
+        {
+            if ( argoff + 1 >= argc || !*argv[argoff + 1] )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            options.cache = argv[argoff + 1];
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-B" ) || !strcmp ( argv[argoff], "--store" ) )
+        {
+            if ( argoff + 1 >= argc || !*argv[argoff + 1] )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            options.store = argv[argoff + 1];
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-Z" ) || !strcmp ( argv[argoff], "--delta" ) )
+        {
+            if ( argoff + 1 >= argc || !*argv[argoff + 1] )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            options.delta = argv[argoff + 1];
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-Y" )
+            || !strcmp ( argv[argoff], "--make-manifest" ) )
+        {
+            make_manifest = 1;
+
+        } else if ( !strcmp ( argv[argoff], "-E" ) || !strcmp ( argv[argoff], "--cache-max" ) )
+        {
+            if ( argoff + 1 >= argc
+                || sscanf ( argv[argoff + 1], "%lu", ( unsigned long * ) &options.cache_max ) <= 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-r" ) || !strcmp ( argv[argoff], "--retries" ) )
+        {
+            if ( argoff + 1 >= argc || sscanf ( argv[argoff + 1], "%u", &options.retries ) <= 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-d" ) || !strcmp ( argv[argoff], "--retry-delay" ) )
+        {
+            if ( argoff + 1 >= argc
+                || sscanf ( argv[argoff + 1], "%u", &options.retry_delay ) <= 0
+                || options.retry_delay > RETRY_DELAY_MAX_MSEC )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-S" ) || !strcmp ( argv[argoff], "--retry-on" ) )
+        {
+            if ( argoff + 1 >= argc || retry_parse_status ( argv[argoff + 1], &options ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-i" ) || !strcmp ( argv[argoff], "--input-file" ) )
+        {
+            if ( argoff + 1 >= argc )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            options.input = argv[argoff + 1];
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-j" ) || !strcmp ( argv[argoff], "--jobs" ) )
+        {
+            if ( argoff + 1 >= argc || sscanf ( argv[argoff + 1], "%u", &options.jobs ) <= 0
+                || !options.jobs || options.jobs > ENGINE_TRANSFERS_MAX )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-P" ) || !strcmp ( argv[argoff], "--pipeline" ) )
+        {
+            if ( argoff + 1 >= argc || sscanf ( argv[argoff + 1], "%u", &options.pipeline ) <= 0
+                || !options.pipeline || options.pipeline > PIPELINE_DEPTH_MAX )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            /* Pipelining relies on persistent connections */
+            options.keepalive = 1;
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-b" ) || !strcmp ( argv[argoff], "--backend" ) )
+        {
+            if ( argoff + 1 >= argc )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            if ( !strcmp ( argv[argoff + 1], "copy" ) )
+            {
+                options.backend = BACKEND_COPY;
+
+            } else if ( !strcmp ( argv[argoff + 1], "splice" ) )
+            {
+                options.backend = BACKEND_SPLICE;
+
+            } else if ( !strcmp ( argv[argoff + 1], "uring" ) )
+            {
+                options.backend = BACKEND_URING;
+
+            } else
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-e" ) || !strcmp ( argv[argoff], "--engine" ) )
+        {
+            if ( argoff + 1 >= argc )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            if ( !strcmp ( argv[argoff + 1], "threads" ) )
+            {
+                options.engine = ENGINE_THREADS;
+
+            } else if ( !strcmp ( argv[argoff + 1], "epoll" ) )
+            {
+                options.engine = ENGINE_EPOLL;
+
+            } else
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else if ( !strcmp ( argv[argoff], "-F" ) || !strcmp ( argv[argoff], "--family" ) )
+        {
+            if ( argoff + 1 >= argc )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            if ( !strcmp ( argv[argoff + 1], "prefer-ipv6" ) )
+            {
+                options.family = FAMILY_PREFER_IPV6;
+
+            } else if ( !strcmp ( argv[argoff + 1], "prefer-ipv4" ) )
+            {
+                options.family = FAMILY_PREFER_IPV4;
+
+            } else if ( !strcmp ( argv[argoff + 1], "ipv4" ) )
+            {
+                options.family = FAMILY_IPV4;
+
+            } else if ( !strcmp ( argv[argoff + 1], "ipv6" ) )
+            {
+                options.family = FAMILY_IPV6;
+
+            } else
+            {
+                show_usage (  );
+                return 1;
+            }
+
+            argoff++;
+
+        } else
+        {
+            show_usage (  );
+            return 1;
+        }
+    }
+
+    /* Expected digest and mirrors belong to a single file */
+    if ( options.input && ( options.checksum || options.mirror_count ) )
     {
         show_usage (  );
         return 1;
     }
 
-    if ( !strcmp ( argv[argoff + 1], "-s5h" ) || !strcmp ( argv[argoff + 1], "--socks5h" ) )
+    /* Manifest carries expected digest and is fetched from a single source */
+    if ( options.delta && ( options.input || options.checksum || options.mirror_count ) )
     {
+        show_usage (  );
+        return 1;
+    }
 
-        if ( argc < 5 )
+    /* Manifest of local file is generated without any download */
+    if ( make_manifest )
+    {
+        if ( argc - argoff < 2 )
         {
             show_usage (  );
             return 1;
         }
 
-        if ( parse_host ( argv[2], socks5h.hostname, sizeof ( socks5h.hostname ),
-                &socks5h.port ) < 0 )
+        return delta_manifest ( argv[argoff], argv[argoff + 1] ) < 0;
+    }
+
+    /* Cache and store directories are created on first use */
+    if ( options.cache && mkdir ( options.cache, 0755 ) < 0 && errno != EEXIST )
+    {
+        perror ( "cache" );
+        return 1;
+    }
+
+    if ( options.store && mkdir ( options.store, 0755 ) < 0 && errno != EEXIST )
+    {
+        perror ( "store" );
+        return 1;
+    }
+
+    if ( options.input )
+    {
+        if ( lget_task ( NULL, NULL, use_socks5h ? &socks5h : NULL, &options ) < 0 )
         {
-            show_usage (  );
             return 1;
         }
 
-        use_socks5h = 1;
-        argoff += 2;
+        return 0;
+    }
+
+    if ( argc - argoff < 2 )
+    {
+        show_usage (  );
+        return 1;
     }
 
-    if ( lget_task ( argv[argoff + 1], argv[argoff + 2], use_socks5h ? &socks5h : NULL ) < 0 )
+    if ( lget_task ( argv[argoff], argv[argoff + 1], use_socks5h ? &socks5h : NULL,
+            &options ) < 0 )
     {
         return 1;
     }
@@ -0,0 +1,419 @@
+/* ------------------------------------------------------------------
+ * Lget - Mirror Selection and Failover
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Mirror probe state and results
+ */
+struct mirror_t
+{
+    const char *url;
+    const struct options_t *options;
+    pthread_t thread;
+    int started;
+    int ok;
+    int ranges;
+    int has_total;
+    size_t total;
+    size_t received;
+    unsigned long first_byte;
+    unsigned long elapsed;
+    char target[HTTP_URL_SIZE];
+};
+
+/**
+ * Get monotonic time in milliseconds
+ */
+static unsigned long mirror_now ( void )
+{
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Start throughput watch at given byte count, zero floor disables it
+ */
+void mirror_stall_start ( struct stall_t *stall, size_t sum, size_t floor )
+{
+    stall->floor = floor;
+    stall->base = sum;
+    stall->since = mirror_now (  );
+}
+
+/**
+ * Check transfer throughput against floor once window elapses
+ */
+int mirror_stall_check ( struct stall_t *stall, size_t sum )
+{
+    unsigned long now;
+    unsigned long elapsed;
+
+    if ( !stall->floor )
+    {
+        return 0;
+    }
+
+    now = mirror_now (  );
+    elapsed = now - stall->since;
+
+    if ( elapsed < STALL_WINDOW_MSEC )
+    {
+        return 0;
+    }
+
+    if ( ( sum - stall->base ) * 1000 < stall->floor * elapsed )
+    {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    stall->base = sum;
+    stall->since = now;
+
+    return 0;
+}
+
+/**
+ * Probe thread, measures time to first byte and to receive file prefix
+ */
+static void *mirror_probe_thread ( void *arg )
+{
+    int sock;
+    unsigned int hops = 0;
+    ssize_t ret;
+    size_t len;
+    size_t size;
+    size_t want;
+    unsigned long start;
+    char *buffer;
+    struct mirror_t *mirror;
+    struct options_t options;
+    struct response_t response;
+    char range[64];
+    char location[HTTP_URL_SIZE];
+
+    mirror = ( struct mirror_t * ) arg;
+
+    /* Probe connection is not pooled and must not hang */
+    options = *mirror->options;
+    options.keepalive = 0;
+    options.compressed = 0;
+    options.recv_timeout = MIRROR_PROBE_TIMEOUT_MSEC;
+
+    /* Prefix is requested as range, servers without range support send it all */
+    snprintf ( range, sizeof ( range ), "Range: bytes=0-%lu\r\n",
+        ( unsigned long ) MIRROR_PROBE_SIZE - 1 );
+
+    size = HTTP_BUFFER_SIZE;
+
+    if ( !( buffer = ( char * ) malloc ( size ) ) )
+    {
+        return NULL;
+    }
+
+    start = mirror_now (  );
+
+    /* Redirects are followed, so download goes straight to the target */
+    for ( ;; )
+    {
+        if ( ( sock = http_query ( mirror->target, range, &options, &buffer, &size, &len,
+                    &response ) ) < 0 )
+        {
+            free ( buffer );
+            return NULL;
+        }
+
+        if ( !response_redirect ( &response ) )
+        {
+            break;
+        }
+
+        close ( sock );
+
+        if ( ++hops > options.redirects
+            || response_location ( &response, buffer, mirror->target, location,
+                sizeof ( location ) ) < 0 )
+        {
+            free ( buffer );
+            return NULL;
+        }
+
+        memcpy ( mirror->target, location, sizeof ( location ) );
+    }
+
+    mirror->first_byte = mirror_now (  ) - start;
+
+    if ( response.status == 206 && response.has_range )
+    {
+        mirror->ranges = 1;
+        mirror->has_total = 1;
+        mirror->total = response.range_total;
+        want = response.range_end - response.range_begin + 1;
+
+    } else if ( response.status == 200 )
+    {
+        mirror->has_total = response.has_length;
+        mirror->total = response.content_len;
+        want = response.has_length && response.content_len < MIRROR_PROBE_SIZE
+            ? response.content_len : MIRROR_PROBE_SIZE;
+
+    } else
+    {
+        close ( sock );
+        free ( buffer );
+        return NULL;
+    }
+
+    /* Count prefix received along with the header */
+    mirror->received = len - response.header_len;
+
+    while ( mirror->received < want )
+    {
+        if ( ( ret = recv ( sock, buffer, size, 0 ) ) < 0 )
+        {
+            close ( sock );
+            free ( buffer );
+            return NULL;
+        }
+
+        if ( !ret )
+        {
+            break;
+        }
+
+        mirror->received += ret;
+    }
+
+    mirror->elapsed = mirror_now (  ) - start;
+    mirror->ok = 1;
+
+    close ( sock );
+    free ( buffer );
+
+    return NULL;
+}
+
+/**
+ * Get probe throughput in bytes per second
+ */
+static unsigned long mirror_rate ( const struct mirror_t *mirror )
+{
+    return mirror->received * 1000UL / ( mirror->elapsed ? mirror->elapsed : 1 );
+}
+
+/**
+ * Order mirrors, responding ones first, then by probe throughput
+ */
+static int mirror_compare ( const void *a, const void *b )
+{
+    unsigned long rate_a;
+    unsigned long rate_b;
+    const struct mirror_t *mirror_a;
+    const struct mirror_t *mirror_b;
+
+    mirror_a = ( const struct mirror_t * ) a;
+    mirror_b = ( const struct mirror_t * ) b;
+
+    if ( mirror_a->ok != mirror_b->ok )
+    {
+        return mirror_b->ok - mirror_a->ok;
+    }
+
+    rate_a = mirror_rate ( mirror_a );
+    rate_b = mirror_rate ( mirror_b );
+
+    return rate_a < rate_b ? 1 : rate_a > rate_b ? -1 : 0;
+}
+
+/**
+ * Probe all mirrors in parallel and order them fastest first
+ */
+static void mirror_probe ( struct mirror_t *mirrors, size_t count )
+{
+    size_t i;
+
+    for ( i = 0; i < count; i++ )
+    {
+        mirrors[i].started = !pthread_create ( &mirrors[i].thread, NULL, mirror_probe_thread,
+            &mirrors[i] );
+    }
+
+    for ( i = 0; i < count; i++ )
+    {
+        if ( mirrors[i].started )
+        {
+            pthread_join ( mirrors[i].thread, NULL );
+        }
+    }
+
+    qsort ( mirrors, count, sizeof ( struct mirror_t ), mirror_compare );
+}
+
+/**
+ * Check if download may continue from next mirror
+ */
+static int mirror_failover ( const struct options_t *options, const struct retry_t *retry,
+    int error )
+{
+    /* Missing file, server errors, stalls and corrupted data are mirror specific */
+    return retry->status >= 400 || error == EBADMSG || retry_allowed ( options, retry, error );
+}
+
+/**
+ * Collect mirrors serving ranges of the same file, fastest first
+ */
+static size_t mirror_sources ( const struct mirror_t *mirrors, size_t count, const char **urls,
+    size_t *total )
+{
+    size_t i;
+    size_t sources = 0;
+
+    for ( i = 0; i < count; i++ )
+    {
+        if ( !mirrors[i].ok || !mirrors[i].ranges )
+        {
+            continue;
+        }
+
+        /* Fastest source decides the expected size */
+        if ( !sources )
+        {
+            *total = mirrors[i].total;
+
+        } else if ( mirrors[i].total != *total )
+        {
+            continue;
+        }
+
+        urls[sources++] = mirrors[i].target;
+    }
+
+    return sources;
+}
+
+/**
+ * Download file from fastest of mirrors, failing over to next ones
+ */
+int mirror_get ( const char *url, const char *filepath, const struct options_t *options )
+{
+    int ret = -1;
+    int error;
+    size_t i;
+    size_t count;
+    size_t total = 0;
+    size_t sources;
+    struct mirror_t *mirrors;
+    struct retry_t retry;
+    struct options_t current;
+    const char *urls[MIRRORS_MAX];
+
+    /* Content known by expected digest is taken from store */
+    if ( options->store && !store_fetch ( filepath, options ) )
+    {
+        return 0;
+    }
+
+    count = options->mirror_count + 1;
+
+    if ( !( mirrors = ( struct mirror_t * ) calloc ( count, sizeof ( struct mirror_t ) ) ) )
+    {
+        perror ( "calloc" );
+        return -1;
+    }
+
+    for ( i = 0; i < count; i++ )
+    {
+        mirrors[i].url = i ? options->mirrors[i - 1] : url;
+        mirrors[i].options = options;
+
+        if ( strlen ( mirrors[i].url ) >= sizeof ( mirrors[i].target ) )
+        {
+            free ( mirrors );
+            errno = ENAMETOOLONG;
+            perror ( "mirror" );
+            return -1;
+        }
+
+        strcpy ( mirrors[i].target, mirrors[i].url );
+    }
+
+    mirror_probe ( mirrors, count );
+
+    if ( options->progress )
+    {
+        for ( i = 0; i < count; i++ )
+        {
+            if ( mirrors[i].ok )
+            {
+                printf ( "mirror: %s - %lu ms to first byte, %lu KiB/s\n", mirrors[i].url,
+                    mirrors[i].first_byte, mirror_rate ( &mirrors[i] ) / 1024 );
+
+            } else
+            {
+                printf ( "mirror: %s - failed\n", mirrors[i].url );
+            }
+        }
+    }
+
+    memset ( &retry, '\0', sizeof ( retry ) );
+    current = *options;
+
+    /* Large file is fetched from all sources at once, in ranges */
+    if ( options->swarm && ( sources = mirror_sources ( mirrors, count, urls, &total ) ) > 1
+        && total > SWARM_CHUNK_MIN )
+    {
+        /* Mirrors continue one by one after contiguous prefix */
+        if ( ( ret = swarm_get ( urls, sources, total, filepath, options ) ) < 0 )
+        {
+            current.resume = 1;
+        }
+    }
+
+    for ( i = 0; ret < 0 && i < count; i++ )
+    {
+        /* Resumed ranges must come from copies of the same size */
+        if ( i && mirrors[i].has_total && mirrors[0].has_total
+            && mirrors[i].total != mirrors[0].total )
+        {
+            if ( options->progress )
+            {
+                printf ( "mirror: %s - size differs, skipped\n", mirrors[i].url );
+            }
+            continue;
+        }
+
+        if ( options->progress )
+        {
+            printf ( "mirror: using %s\n", mirrors[i].target );
+        }
+
+        if ( ( ret = http_transfer ( mirrors[i].target, filepath, options, &current,
+                    &retry ) ) >= 0 || !mirror_failover ( options, &retry, retry.error ) )
+        {
+            break;
+        }
+
+        /* Next mirror continues after written prefix */
+        if ( retry_resume ( filepath, options, &retry, &current ) < 0 )
+        {
+            break;
+        }
+    }
+
+    /* Failing to store does not fail the download */
+    if ( ret >= 0 && options->store && store_put ( filepath, options ) < 0 )
+    {
+        perror ( "store" );
+    }
+
+    error = errno;
+    free ( mirrors );
+    errno = error;
+
+    return ret;
+}
@@ -0,0 +1,424 @@
+/* ------------------------------------------------------------------
+ * Lget - Http Pipelining Support
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Pipelined connection receive state
+ */
+struct pipeline_t
+{
+    int sock;
+    size_t len;
+    size_t size;
+    size_t header_max;
+    char *buffer;
+    const struct options_t *options;
+};
+
+/**
+ * Receive more data into pipeline buffer, zero means connection closed
+ */
+static ssize_t pipeline_fill ( struct pipeline_t *pipeline )
+{
+    ssize_t len;
+    size_t grown;
+    char *ptr;
+
+    /* Grow buffer when full, header must fit within the limit */
+    if ( pipeline->len + 1 >= pipeline->size )
+    {
+        if ( pipeline->size >= pipeline->header_max )
+        {
+            errno = E2BIG;
+            return -1;
+        }
+
+        grown = pipeline->size * 2 < pipeline->header_max
+            ? pipeline->size * 2 : pipeline->header_max;
+
+        if ( !( ptr = ( char * ) realloc ( pipeline->buffer, grown ) ) )
+        {
+            return -1;
+        }
+
+        pipeline->buffer = ptr;
+        pipeline->size = grown;
+    }
+
+    if ( ( len =
+            recv ( pipeline->sock, pipeline->buffer + pipeline->len,
+                pipeline->size - pipeline->len - 1, 0 ) ) <= 0 )
+    {
+        return len;
+    }
+
+    pipeline->len += len;
+    pipeline->buffer[pipeline->len] = '\0';
+
+    return len;
+}
+
+/**
+ * Drop processed bytes from pipeline buffer
+ */
+static void pipeline_consume ( struct pipeline_t *pipeline, size_t len )
+{
+    pipeline->len -= len;
+    memmove ( pipeline->buffer, pipeline->buffer + len, pipeline->len );
+    pipeline->buffer[pipeline->len] = '\0';
+}
+
+/**
+ * Receive next response header from pipeline
+ */
+static int pipeline_header ( struct pipeline_t *pipeline, struct response_t *response )
+{
+    int ret;
+
+    response_init ( response );
+
+    /* Header starts at the buffer beginning, received bytes are scanned once */
+    while ( !( ret = response_parse ( response, pipeline->buffer, pipeline->len ) ) )
+    {
+        if ( pipeline_fill ( pipeline ) <= 0 )
+        {
+            return -1;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * Write payload slice into output file
+ */
+static int pipeline_write ( int fd, const char *data, size_t len )
+{
+    ssize_t ret;
+
+    while ( len )
+    {
+        if ( ( ret = write ( fd, data, len ) ) < 0 )
+        {
+            perror ( "write" );
+            return -1;
+        }
+
+        data += ret;
+        len -= ret;
+    }
+
+    return 0;
+}
+
+/**
+ * Receive response body from pipeline, discard it if no file is given
+ */
+static int pipeline_body ( struct pipeline_t *pipeline, int fd, struct body_t *decoder,
+    struct progress_t *progress, size_t *sum )
+{
+    ssize_t ret;
+    size_t payload_len;
+    const char *payload;
+
+    while ( !decoder->done )
+    {
+        if ( !pipeline->len && ( ret = pipeline_fill ( pipeline ) ) <= 0 )
+        {
+            /* Connection close may terminate the body */
+            if ( ret < 0 || body_eof ( decoder ) < 0 )
+            {
+                return -1;
+            }
+            break;
+        }
+
+        if ( ( ret =
+                body_decode ( decoder, pipeline->buffer, pipeline->len, &payload,
+                    &payload_len ) ) < 0 )
+        {
+            perror ( "decode" );
+            return -1;
+        }
+
+        if ( fd >= 0 && payload_len )
+        {
+            if ( pipeline_write ( fd, payload, payload_len ) < 0 )
+            {
+                return -1;
+            }
+
+            *sum += payload_len;
+            progress_set ( progress, *sum );
+        }
+
+        pipeline_consume ( pipeline, ret );
+    }
+
+    return 0;
+}
+
+/**
+ * Send all pipelined requests at once
+ */
+static int pipeline_send ( int sock, struct pipeline_item_t *items, size_t count,
+    const char *hostname, unsigned short port )
+{
+    size_t i;
+    size_t len = 0;
+    ssize_t ret;
+    char *buffer;
+    const char *path;
+    char urlhost[HOSTNAME_SIZE];
+    unsigned short urlport;
+
+    if ( !( buffer = ( char * ) malloc ( count * 8192 ) ) )
+    {
+        return -1;
+    }
+
+    /* Concatenate requests in items order */
+    for ( i = 0; i < count; i++ )
+    {
+        if ( http_parse_url ( items[i].url, urlhost, sizeof ( urlhost ), &urlport, &path ) < 0
+            || ( ret =
+                http_format_request ( buffer + len, 8192, hostname, port, path, "", 1, 0 ) ) < 0 )
+        {
+            free ( buffer );
+            return -1;
+        }
+
+        len += ret;
+    }
+
+    /* Send requests batch */
+    for ( i = 0; i < len; i += ret )
+    {
+        if ( ( ret = send ( sock, buffer + i, len - i, MSG_NOSIGNAL ) ) < 0 )
+        {
+            free ( buffer );
+            return -1;
+        }
+    }
+
+    free ( buffer );
+
+    return 0;
+}
+
+/**
+ * Receive single pipelined response into item output file
+ */
+static int pipeline_response ( struct pipeline_t *pipeline, struct pipeline_item_t *item,
+    int *keepalive )
+{
+    int fd = -1;
+    unsigned int status;
+    size_t sum = 0;
+    size_t limit;
+    struct response_t response;
+    struct body_t decoder;
+    struct retry_t retry;
+    struct progress_t progress;
+    char location[HTTP_URL_SIZE];
+
+    if ( pipeline_header ( pipeline, &response ) < 0 )
+    {
+        return -1;
+    }
+
+    status = response.status;
+    *keepalive = response_keepalive ( &response );
+
+    /* Body delimited by connection close ends the pipeline */
+    body_init ( &decoder, &response );
+
+    if ( decoder.mode == BODY_CLOSE )
+    {
+        *keepalive = 0;
+    }
+
+    /* Some responses never carry body */
+    if ( status == 204 || status == 304 )
+    {
+        decoder.done = 1;
+    }
+
+    /* Total size is unknown without content length */
+    limit = decoder.mode == BODY_LENGTH ? decoder.remaining : 0;
+
+    memset ( &retry, '\0', sizeof ( retry ) );
+    retry.status = status;
+
+    if ( status == 200 )
+    {
+        /* Copy shared with cache or store is never written through */
+        if ( ( pipeline->options->cache || pipeline->options->store )
+            && file_detach ( item->filepath, 0 ) < 0 )
+        {
+            perror ( "detach" );
+            item->result = PIPELINE_FAILED;
+
+        } else if ( ( fd = open ( item->filepath, O_CREAT | O_WRONLY | O_TRUNC, 0644 ) ) < 0 )
+        {
+            perror ( "open" );
+            item->result = PIPELINE_FAILED;
+
+        } else if ( file_preallocate ( fd, 0, limit ) < 0 )
+        {
+            /* Reserve disk space, so a full disk fails before the transfer */
+            perror ( "fallocate" );
+            close ( fd );
+            fd = -1;
+            item->result = PIPELINE_FAILED;
+        }
+
+    } else if ( response_redirect ( &response ) )
+    {
+        /* Redirects are followed without pipelining, permanent ones skip the hop then */
+        if ( response_permanent ( &response )
+            && response_location ( &response, pipeline->buffer, item->url, location,
+                sizeof ( location ) ) >= 0 )
+        {
+            redirect_cache_store ( item->url, location );
+        }
+
+        item->result = PIPELINE_RETRY;
+
+    } else if ( retry_allowed ( pipeline->options, &retry, EINVAL ) )
+    {
+        /* Transient statuses are retried along the retry policy without pipelining */
+        item->result = PIPELINE_RETRY;
+
+    } else
+    {
+        errno = status;
+        perror ( "http status" );
+        item->result = PIPELINE_FAILED;
+    }
+
+    pipeline_consume ( pipeline, response.header_len );
+
+    if ( fd >= 0 )
+    {
+        progress_start ( &progress, get_basename ( item->filepath ), 0, limit,
+            pipeline->options->progress );
+    }
+
+    if ( pipeline_body ( pipeline, fd, &decoder, &progress, &sum ) < 0 )
+    {
+        if ( fd >= 0 )
+        {
+            progress_stop ( &progress, -1 );
+            close ( fd );
+        }
+        return -1;
+    }
+
+    if ( fd >= 0 )
+    {
+        /* Output must match announced size */
+        if ( file_finish ( fd, limit ? limit : sum, pipeline->options ) < 0 )
+        {
+            perror ( "verify" );
+            progress_stop ( &progress, -1 );
+            item->result = PIPELINE_FAILED;
+
+        } else
+        {
+            progress_stop ( &progress, 0 );
+            item->result = PIPELINE_OK;
+        }
+
+        close ( fd );
+    }
+
+    return 0;
+}
+
+/**
+ * Download items from the same endpoint over one pipelined connection
+ */
+void pipeline_get ( struct pipeline_item_t *items, size_t count,
+    const struct options_t *options )
+{
+    int reused;
+    int keepalive = 1;
+    size_t i;
+    size_t done;
+    unsigned short port;
+    const char *path;
+    struct pipeline_t *pipeline;
+    char hostname[HOSTNAME_SIZE];
+
+    /* Items are fetched individually unless answered here */
+    for ( i = 0; i < count; i++ )
+    {
+        items[i].result = PIPELINE_RETRY;
+    }
+
+    if ( http_parse_url ( items[0].url, hostname, sizeof ( hostname ), &port, &path ) < 0 )
+    {
+        return;
+    }
+
+    if ( !( pipeline = ( struct pipeline_t * ) malloc ( sizeof ( struct pipeline_t ) ) ) )
+    {
+        return;
+    }
+
+    pipeline->len = 0;
+    pipeline->size = HTTP_BUFFER_SIZE;
+    pipeline->header_max = options->header_max;
+    pipeline->options = options;
+
+    if ( !( pipeline->buffer = ( char * ) malloc ( pipeline->size ) ) )
+    {
+        free ( pipeline );
+        return;
+    }
+
+    pipeline->buffer[0] = '\0';
+
+    if ( ( pipeline->sock = http_open ( hostname, port, options, &reused ) ) < 0 )
+    {
+        free ( pipeline->buffer );
+        free ( pipeline );
+        return;
+    }
+
+    if ( pipeline_send ( pipeline->sock, items, count, hostname, port ) < 0 )
+    {
+        close ( pipeline->sock );
+        free ( pipeline->buffer );
+        free ( pipeline );
+        return;
+    }
+
+    /* Responses arrive in requests order */
+    for ( done = 0; done < count && keepalive; done++ )
+    {
+        if ( pipeline_response ( pipeline, &items[done], &keepalive ) < 0 )
+        {
+            /* Server closed or misbehaves, fall back for the rest */
+            items[done].result = PIPELINE_RETRY;
+            keepalive = 0;
+            break;
+        }
+    }
+
+    /* Keep connection if all responses were consumed exactly */
+    if ( keepalive && done == count && !pipeline->len )
+    {
+        pool_release ( pipeline->sock, hostname, port, options->socks5 );
+
+    } else
+    {
+        close ( pipeline->sock );
+    }
+
+    free ( pipeline->buffer );
+    free ( pipeline );
+}
@@ -0,0 +1,164 @@
+/* ------------------------------------------------------------------
+ * Lget - Persistent Connections Pool
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Idle connection details
+ */
+struct pool_entry_t
+{
+    int sock;
+    time_t since;
+    unsigned short port;
+    struct address_t proxy_addr;
+    unsigned short proxy_port;
+    char hostname[HOSTNAME_SIZE];
+};
+
+/**
+ * Idle connections ordered from the oldest one
+ */
+static struct pool_entry_t pool[POOL_SIZE];
+static size_t pool_len = 0;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Check if pooled connection matches the endpoint
+ */
+static int pool_match ( const struct pool_entry_t *entry, const char *hostname,
+    unsigned short port, const struct socks5_t *socks5 )
+{
+    if ( entry->port != port || strcmp ( entry->hostname, hostname ) )
+    {
+        return 0;
+    }
+
+    if ( socks5 )
+    {
+        return entry->proxy_port == socks5->port
+            && !memcmp ( &entry->proxy_addr, &socks5->addrs[0], sizeof ( struct address_t ) );
+    }
+
+    return !entry->proxy_port;
+}
+
+/**
+ * Remove connection from pool
+ */
+static void pool_remove ( size_t index )
+{
+    pool_len--;
+    memmove ( &pool[index], &pool[index + 1], ( pool_len - index ) * sizeof ( pool[0] ) );
+}
+
+/**
+ * Check if idle connection was not closed by server
+ */
+static int pool_alive ( int sock )
+{
+    char c;
+
+    /* Idle connection must have nothing to read */
+    return recv ( sock, &c, 1, MSG_PEEK | MSG_DONTWAIT ) < 0 && ( errno == EAGAIN
+        || errno == EWOULDBLOCK );
+}
+
+/**
+ * Take idle connection to the endpoint from pool
+ */
+int pool_acquire ( const char *hostname, unsigned short port, const struct socks5_t *socks5 )
+{
+    int sock = -1;
+    size_t i;
+    time_t now;
+
+    now = time ( NULL );
+
+    pthread_mutex_lock ( &pool_mutex );
+
+    /* Prefer the most recently used connections */
+    for ( i = pool_len; i > 0 && sock < 0; i-- )
+    {
+        if ( now - pool[i - 1].since >= POOL_IDLE_SEC )
+        {
+            close ( pool[i - 1].sock );
+            pool_remove ( i - 1 );
+            continue;
+        }
+
+        if ( pool_match ( &pool[i - 1], hostname, port, socks5 ) )
+        {
+            sock = pool[i - 1].sock;
+            pool_remove ( i - 1 );
+
+            if ( !pool_alive ( sock ) )
+            {
+                close ( sock );
+                sock = -1;
+            }
+        }
+    }
+
+    pthread_mutex_unlock ( &pool_mutex );
+
+    return sock;
+}
+
+/**
+ * Put connection into pool for reuse
+ */
+void pool_release ( int sock, const char *hostname, unsigned short port,
+    const struct socks5_t *socks5 )
+{
+    size_t i;
+    size_t oldest = 0;
+    size_t count = 0;
+    struct pool_entry_t *entry;
+
+    if ( strlen ( hostname ) >= HOSTNAME_SIZE )
+    {
+        close ( sock );
+        return;
+    }
+
+    pthread_mutex_lock ( &pool_mutex );
+
+    /* Count connections to the same endpoint */
+    for ( i = 0; i < pool_len; i++ )
+    {
+        if ( pool_match ( &pool[i], hostname, port, socks5 ) && !count++ )
+        {
+            oldest = i;
+        }
+    }
+
+    /* Evict the oldest connection if limits are reached */
+    if ( count >= POOL_HOST_MAX )
+    {
+        close ( pool[oldest].sock );
+        pool_remove ( oldest );
+
+    } else if ( pool_len >= POOL_SIZE )
+    {
+        close ( pool[0].sock );
+        pool_remove ( 0 );
+    }
+
+    entry = &pool[pool_len++];
+    entry->sock = sock;
+    entry->since = time ( NULL );
+    entry->port = port;
+    memset ( &entry->proxy_addr, '\0', sizeof ( struct address_t ) );
+
+    if ( socks5 )
+    {
+        entry->proxy_addr = socks5->addrs[0];
+    }
+
+    entry->proxy_port = socks5 ? socks5->port : 0;
+    strcpy ( entry->hostname, hostname );
+
+    pthread_mutex_unlock ( &pool_mutex );
+}
@@ -0,0 +1,256 @@
+/* ------------------------------------------------------------------
+ * Lget - Progress Reporting
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Get monotonic time in milliseconds
+ */
+static unsigned long progress_now ( void )
+{
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Format byte count with binary unit
+ */
+static void progress_format_size ( char *buffer, size_t size, double bytes )
+{
+    unsigned int unit = 0;
+    static const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+
+    while ( bytes >= 1024.0 && unit + 1 < sizeof ( units ) / sizeof ( units[0] ) )
+    {
+        bytes /= 1024.0;
+        unit++;
+    }
+
+    if ( unit )
+    {
+        snprintf ( buffer, size, "%.1f %s", bytes, units[unit] );
+
+    } else
+    {
+        snprintf ( buffer, size, "%.0f %s", bytes, units[unit] );
+    }
+}
+
+/**
+ * Print progress status line
+ */
+static void progress_print ( struct progress_t *progress, int final )
+{
+    size_t sum;
+    unsigned long now;
+    unsigned long eta;
+    double elapsed;
+    double average;
+    double current;
+    char done_str[32];
+    char decoded_str[32];
+    char total_str[32];
+    char current_str[32];
+    char average_str[32];
+
+    now = progress_now (  );
+    sum = __atomic_load_n ( &progress->sum, __ATOMIC_RELAXED );
+
+    /* Throughput since last report and since start */
+    elapsed = ( now - progress->started ) / 1000.0;
+    average = elapsed > 0 ? ( sum - progress->offset ) / elapsed : 0;
+    current = now > progress->last_time
+        ? ( sum - progress->last_sum ) * 1000.0 / ( now - progress->last_time ) : 0;
+
+    progress->last_time = now;
+    progress->last_sum = sum;
+    progress->printed = 1;
+
+    progress_format_size ( done_str, sizeof ( done_str ), sum );
+    progress_format_size ( decoded_str, sizeof ( decoded_str ),
+        __atomic_load_n ( &progress->decoded, __ATOMIC_RELAXED ) );
+    progress_format_size ( current_str, sizeof ( current_str ), final ? average : current );
+    progress_format_size ( average_str, sizeof ( average_str ), average );
+
+    printf ( progress->tty ? "\r%s: %s" : "%s: %s", progress->name, done_str );
+
+    if ( progress->total )
+    {
+        progress_format_size ( total_str, sizeof ( total_str ), progress->total );
+        printf ( "/%s %3u%%", total_str, ( unsigned int ) ( sum * 100.0 / progress->total ) );
+    }
+
+    /* Wire bytes are followed by decoded bytes of compressed body */
+    if ( __atomic_load_n ( &progress->encoded, __ATOMIC_RELAXED ) )
+    {
+        printf ( ", %s decoded", decoded_str );
+    }
+
+    if ( final )
+    {
+        printf ( " in %.1fs, %s/s - OK\n", elapsed, average_str );
+
+    } else
+    {
+        printf ( ", %s/s, avg %s/s", current_str, average_str );
+
+        /* Remaining time estimated from average throughput */
+        if ( progress->total && average >= 1.0 && sum <= progress->total )
+        {
+            eta = ( progress->total - sum ) / average;
+            printf ( ", ETA %lu:%02lu:%02lu", eta / 3600, eta / 60 % 60, eta % 60 );
+        }
+
+        printf ( progress->tty ? "\033[K" : "\n" );
+    }
+
+    fflush ( stdout );
+}
+
+/**
+ * Progress reporter thread, prints status in fixed intervals
+ */
+static void *progress_thread ( void *arg )
+{
+    unsigned long interval;
+    struct timespec deadline;
+    struct progress_t *progress;
+
+    progress = ( struct progress_t * ) arg;
+    interval = progress->tty ? PROGRESS_INTERVAL_MSEC : PROGRESS_LINE_MSEC;
+
+    pthread_mutex_lock ( &progress->mutex );
+
+    while ( !progress->stop )
+    {
+        clock_gettime ( CLOCK_REALTIME, &deadline );
+        deadline.tv_sec += interval / 1000;
+        deadline.tv_nsec += interval % 1000 * 1000000;
+
+        if ( deadline.tv_nsec >= 1000000000 )
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        if ( pthread_cond_timedwait ( &progress->cond, &progress->mutex,
+                &deadline ) == ETIMEDOUT && !progress->stop )
+        {
+            progress_print ( progress, 0 );
+        }
+    }
+
+    pthread_mutex_unlock ( &progress->mutex );
+
+    return NULL;
+}
+
+/**
+ * Start progress reporting for download
+ */
+void progress_start ( struct progress_t *progress, const char *name, size_t offset,
+    size_t total, int enabled )
+{
+    progress->name = name;
+    progress->offset = offset;
+    progress->total = total;
+    progress->sum = offset;
+    progress->decoded = 0;
+    progress->encoded = 0;
+    progress->started = progress_now (  );
+    progress->last_time = progress->started;
+    progress->last_sum = offset;
+    progress->running = 0;
+    progress->printed = 0;
+    progress->stop = 0;
+    progress->tty = isatty ( STDOUT_FILENO );
+    progress->enabled = enabled;
+
+    if ( !enabled )
+    {
+        return;
+    }
+
+    if ( pthread_mutex_init ( &progress->mutex, NULL ) )
+    {
+        return;
+    }
+
+    if ( pthread_cond_init ( &progress->cond, NULL ) )
+    {
+        pthread_mutex_destroy ( &progress->mutex );
+        return;
+    }
+
+    if ( pthread_create ( &progress->thread, NULL, progress_thread, progress ) )
+    {
+        pthread_cond_destroy ( &progress->cond );
+        pthread_mutex_destroy ( &progress->mutex );
+        return;
+    }
+
+    progress->running = 1;
+}
+
+/**
+ * Set downloaded bytes count, single writer only
+ */
+void progress_set ( struct progress_t *progress, size_t sum )
+{
+    __atomic_store_n ( &progress->sum, sum, __ATOMIC_RELAXED );
+}
+
+/**
+ * Add downloaded bytes count, safe for many writers
+ */
+void progress_add ( struct progress_t *progress, size_t len )
+{
+    __atomic_fetch_add ( &progress->sum, len, __ATOMIC_RELAXED );
+}
+
+/**
+ * Set decoded bytes count of compressed body, single writer only
+ */
+void progress_decoded ( struct progress_t *progress, size_t decoded )
+{
+    __atomic_store_n ( &progress->decoded, decoded, __ATOMIC_RELAXED );
+    __atomic_store_n ( &progress->encoded, 1, __ATOMIC_RELAXED );
+}
+
+/**
+ * Stop progress reporting, print summary if download succeeded
+ */
+void progress_stop ( struct progress_t *progress, int result )
+{
+    if ( progress->running )
+    {
+        pthread_mutex_lock ( &progress->mutex );
+        progress->stop = 1;
+        pthread_cond_signal ( &progress->cond );
+        pthread_mutex_unlock ( &progress->mutex );
+
+        pthread_join ( progress->thread, NULL );
+        pthread_cond_destroy ( &progress->cond );
+        pthread_mutex_destroy ( &progress->mutex );
+        progress->running = 0;
+    }
+
+    if ( !progress->enabled )
+    {
+        return;
+    }
+
+    if ( result >= 0 )
+    {
+        progress_print ( progress, 1 );
+
+    } else if ( progress->tty && progress->printed )
+    {
+        /* Keep last status line visible above error messages */
+        printf ( "\n" );
+    }
+}
@@ -0,0 +1,414 @@
+/* ------------------------------------------------------------------
+ * Lget - Http Response Header Parser
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Response parser states
+ */
+#define RESPONSE_STATUS_LINE 0
+#define RESPONSE_FIELDS 1
+#define RESPONSE_COMPLETE 2
+
+/**
+ * Setup response parser
+ */
+void response_init ( struct response_t *response )
+{
+    memset ( response, '\0', sizeof ( struct response_t ) );
+    response->state = RESPONSE_STATUS_LINE;
+}
+
+/**
+ * Parse decimal number, advance pointer past it
+ */
+static int response_number ( const char **ptr, const char *end, size_t *value )
+{
+    const char *begin;
+
+    *value = 0;
+
+    for ( begin = *ptr; *ptr < end && **ptr >= '0' && **ptr <= '9'; ( *ptr )++ )
+    {
+        /* Reject number overflow */
+        if ( *value > ( ( size_t ) -1 - 9 ) / 10 )
+        {
+            errno = EOVERFLOW;
+            return -1;
+        }
+
+        *value = *value * 10 + ( **ptr - '0' );
+    }
+
+    if ( *ptr == begin )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Check if comma separated header value contains a token
+ */
+static int response_token ( const char *value, size_t len, const char *token )
+{
+    size_t i;
+    size_t token_len;
+    const char *ptr;
+
+    token_len = strlen ( token );
+
+    for ( i = 0; ( ptr = scan_casestr ( value + i, len - i, token, token_len ) ); i++ )
+    {
+        i = ptr - value;
+
+        /* Token must be delimited by list separators */
+        if ( ( !i || value[i - 1] == ',' || value[i - 1] == ' ' ) && ( i + token_len == len
+                || value[i + token_len] == ',' || value[i + token_len] == ' '
+                || value[i + token_len] == ';' ) )
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Parse content range header value
+ */
+static int response_content_range ( struct response_t *response, const char *value,
+    const char *end )
+{
+    if ( end - value < 6 || scan_casecmp ( value, "bytes ", 6 ) )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    value += 6;
+
+    /* Unsatisfied range carries complete length only */
+    if ( value < end && *value == '*' )
+    {
+        value++;
+
+        if ( value >= end || *value++ != '/'
+            || response_number ( &value, end, &response->complete_len ) < 0 )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        response->has_complete = 1;
+        return 0;
+    }
+
+    if ( response_number ( &value, end, &response->range_begin ) < 0 || value >= end
+        || *value++ != '-' || response_number ( &value, end, &response->range_end ) < 0
+        || value >= end || *value++ != '/'
+        || response_number ( &value, end, &response->range_total ) < 0
+        || response->range_begin > response->range_end
+        || response->range_end >= response->range_total )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    response->has_range = 1;
+
+    return 0;
+}
+
+/**
+ * Parse response status line
+ */
+static int response_status_line ( struct response_t *response, const char *line, size_t len )
+{
+    /* Expect HTTP/x.y followed by three digits status */
+    if ( len < 12 || strncmp ( line, "HTTP/", 5 ) || !isdigit ( ( unsigned char ) line[5] )
+        || line[6] != '.' || !isdigit ( ( unsigned char ) line[7] ) || line[8] != ' '
+        || !isdigit ( ( unsigned char ) line[9] ) || !isdigit ( ( unsigned char ) line[10] )
+        || !isdigit ( ( unsigned char ) line[11] ) )
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    response->version = ( line[5] - '0' ) * 10 + ( line[7] - '0' );
+    response->status = ( line[9] - '0' ) * 100 + ( line[10] - '0' ) * 10 + ( line[11] - '0' );
+
+    return 0;
+}
+
+/**
+ * Parse single header field line, values are kept as buffer offsets
+ */
+static int response_field ( struct response_t *response, const char *buffer, size_t offset,
+    size_t len )
+{
+    size_t name_len;
+    size_t value_offset;
+    const char *line;
+    const char *colon;
+    const char *value;
+    const char *end;
+
+    line = buffer + offset;
+
+    /* Lines without colon are folded or broken, ignore them */
+    if ( !( colon = ( const char * ) memchr ( line, ':', len ) ) )
+    {
+        return 0;
+    }
+
+    name_len = colon - line;
+    value = colon + 1;
+    end = line + len;
+
+    /* Trim value whitespace */
+    while ( value < end && ( *value == ' ' || *value == '\t' ) )
+    {
+        value++;
+    }
+
+    while ( end > value && ( end[-1] == ' ' || end[-1] == '\t' ) )
+    {
+        end--;
+    }
+
+    value_offset = value - buffer;
+
+    if ( name_len == 14 && !scan_casecmp ( line, "content-length", 14 ) )
+    {
+        if ( response_number ( &value, end, &response->content_len ) < 0 || value != end )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        response->has_length = 1;
+
+    } else if ( name_len == 17 && !scan_casecmp ( line, "transfer-encoding", 17 ) )
+    {
+        response->chunked = response_token ( value, end - value, "chunked" );
+
+    } else if ( name_len == 10 && !scan_casecmp ( line, "connection", 10 ) )
+    {
+        if ( response_token ( value, end - value, "close" ) )
+        {
+            response->connection = CONNECTION_CLOSE;
+
+        } else if ( response_token ( value, end - value, "keep-alive" ) )
+        {
+            response->connection = CONNECTION_KEEPALIVE;
+        }
+
+    } else if ( name_len == 13 && !scan_casecmp ( line, "content-range", 13 ) )
+    {
+        return response_content_range ( response, value, end );
+
+    } else if ( name_len == 8 && !scan_casecmp ( line, "location", 8 ) )
+    {
+        response->location = value_offset;
+        response->location_len = end - value;
+
+    } else if ( name_len == 4 && !scan_casecmp ( line, "etag", 4 ) )
+    {
+        response->etag = value_offset;
+        response->etag_len = end - value;
+
+    } else if ( name_len == 13 && !scan_casecmp ( line, "last-modified", 13 ) )
+    {
+        response->last_modified = value_offset;
+        response->last_modified_len = end - value;
+
+    } else if ( name_len == 16 && !scan_casecmp ( line, "content-encoding", 16 ) )
+    {
+        response->encoding = value_offset;
+        response->encoding_len = end - value;
+
+    } else if ( name_len == 11 && !scan_casecmp ( line, "retry-after", 11 ) )
+    {
+        /* Http date form is ignored, only delay seconds are used */
+        response->has_retry_after = response_number ( &value, end, &response->retry_after ) >= 0
+            && value == end;
+    }
+
+    return 0;
+}
+
+/**
+ * Feed received bytes to response parser, each byte is scanned once
+ */
+int response_parse ( struct response_t *response, const char *buffer, size_t len )
+{
+    size_t line_len;
+    const char *eol;
+
+    while ( response->state != RESPONSE_COMPLETE )
+    {
+        /* Wait for complete line */
+        if ( !( eol = scan_lf ( buffer + response->pos, len - response->pos ) ) )
+        {
+            response->pos = len;
+            return 0;
+        }
+
+        response->pos = eol - buffer + 1;
+        line_len = eol - ( buffer + response->line );
+
+        if ( line_len && eol[-1] == '\r' )
+        {
+            line_len--;
+        }
+
+        if ( response->state == RESPONSE_STATUS_LINE )
+        {
+            if ( response_status_line ( response, buffer + response->line, line_len ) < 0 )
+            {
+                return -1;
+            }
+
+            response->state = RESPONSE_FIELDS;
+
+        } else if ( !line_len )
+        {
+            /* Empty line terminates header */
+            response->header_len = response->pos;
+            response->state = RESPONSE_COMPLETE;
+
+        } else if ( response_field ( response, buffer, response->line, line_len ) < 0 )
+        {
+            return -1;
+        }
+
+        response->line = response->pos;
+    }
+
+    return 1;
+}
+
+/**
+ * Check if connection persists after response
+ */
+int response_keepalive ( const struct response_t *response )
+{
+    if ( response->connection != CONNECTION_DEFAULT )
+    {
+        return response->connection == CONNECTION_KEEPALIVE;
+    }
+
+    /* Connections are persistent by default since HTTP/1.1 */
+    return response->version >= 11;
+}
+
+/**
+ * Check if response redirects to location
+ */
+int response_redirect ( const struct response_t *response )
+{
+    switch ( response->status )
+    {
+    case 300:
+    case 301:
+    case 302:
+    case 303:
+    case 307:
+    case 308:
+        return response->location_len != 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Check if redirect is permanent and may be cached
+ */
+int response_permanent ( const struct response_t *response )
+{
+    return response->status == 301 || response->status == 308;
+}
+
+/**
+ * Build absolute redirect url from response location relative to request url
+ */
+int response_location ( const struct response_t *response, const char *buffer,
+    const char *base, char *url, size_t size )
+{
+    size_t keep;
+    const char *location;
+    const char *scheme;
+    const char *path;
+    const char *end;
+
+    if ( !response->location_len )
+    {
+        errno = ENODATA;
+        return -1;
+    }
+
+    location = buffer + response->location;
+    end = location + response->location_len;
+
+    /* Scheme and authority of request url are kept for relative locations */
+    path = strchr ( base + 7, '/' );
+    keep = path ? ( size_t ) ( path - base ) : strlen ( base );
+    scheme = ( const char * ) memchr ( location, ':', response->location_len );
+
+    if ( scheme && !memchr ( location, '/', scheme - location ) )
+    {
+        /* Absolute url */
+        keep = 0;
+
+    } else if ( response->location_len >= 2 && location[0] == '/' && location[1] == '/' )
+    {
+        /* Network path reference keeps the scheme */
+        keep = 5;
+
+    } else if ( *location == '?' && path )
+    {
+        /* Query replaces the one of request url */
+        keep += strcspn ( path, "?#" );
+
+    } else if ( *location != '/' && path )
+    {
+        /* Relative path replaces last segment of request path */
+        end = path + strcspn ( path, "?#" );
+
+        while ( end > path && end[-1] != '/' )
+        {
+            end--;
+        }
+
+        keep = end - base;
+        end = location + response->location_len;
+
+    } else if ( *location != '/' )
+    {
+        /* Request url has empty path */
+        if ( ( size_t ) snprintf ( url, size, "%s/%.*s", base,
+                ( int ) response->location_len, location ) >= size )
+        {
+            errno = ENOBUFS;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    if ( keep + ( end - location ) >= size )
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    memcpy ( url, base, keep );
+    memcpy ( url + keep, location, end - location );
+    url[keep + ( end - location )] = '\0';
+
+    return 0;
+}
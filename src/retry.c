@@ -0,0 +1,173 @@
+/* ------------------------------------------------------------------
+ * Lget - Download Retry Policy
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Parse comma separated list of retried http statuses
+ */
+int retry_parse_status ( const char *list, struct options_t *options )
+{
+    unsigned int status;
+    int len;
+
+    options->retry_status_count = 0;
+
+    /* Empty list retries on transport errors only */
+    while ( *list )
+    {
+        if ( options->retry_status_count >= RETRY_STATUS_MAX
+            || sscanf ( list, "%3u%n", &status, &len ) <= 0 || status < 100 || status > 599 )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        options->retry_status[options->retry_status_count++] = status;
+        list += len;
+
+        if ( *list == ',' )
+        {
+            list++;
+
+        } else if ( *list )
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Check if error is likely to go away on its own
+ */
+static int retry_transient ( int error )
+{
+    switch ( error )
+    {
+    case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+    case EWOULDBLOCK:
+#endif
+    case EINTR:
+    case EPIPE:
+    case ETIMEDOUT:
+    case ECONNREFUSED:
+    case ECONNRESET:
+    case ECONNABORTED:
+    case EHOSTUNREACH:
+    case EHOSTDOWN:
+    case ENETUNREACH:
+    case ENETDOWN:
+    case ENETRESET:
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Check if failed download attempt may be retried
+ */
+int retry_allowed ( const struct options_t *options, const struct retry_t *retry, int error )
+{
+    size_t i;
+
+    for ( i = 0; i < options->retry_status_count; i++ )
+    {
+        if ( retry->status == options->retry_status[i] )
+        {
+            return 1;
+        }
+    }
+
+    /* Local errors such as full disk or checksum mismatch are fatal */
+    return retry_transient ( error );
+}
+
+/**
+ * Get jittered delay before next download attempt in milliseconds
+ */
+unsigned long retry_delay ( const struct options_t *options, const struct retry_t *retry,
+    unsigned int attempt )
+{
+    unsigned int seed;
+    unsigned long delay;
+    unsigned long after;
+    struct timespec ts;
+
+    delay = options->retry_delay;
+
+    /* Exponential backoff up to the cap */
+    while ( attempt-- && delay < RETRY_DELAY_MAX_MSEC )
+    {
+        delay *= 2;
+    }
+
+    if ( delay > RETRY_DELAY_MAX_MSEC )
+    {
+        delay = RETRY_DELAY_MAX_MSEC;
+    }
+
+    /* Jitter spreads concurrent downloads over upper half of the delay */
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    seed = ts.tv_nsec ^ ( unsigned int ) ( uintptr_t ) &seed;
+    delay = delay / 2 + ( delay / 2 ? rand_r ( &seed ) % ( delay / 2 + 1 ) : 0 );
+
+    /* Server may ask for a longer pause */
+    if ( retry->has_retry_after )
+    {
+        after = retry->retry_after < RETRY_AFTER_MAX_SEC
+            ? retry->retry_after : RETRY_AFTER_MAX_SEC;
+
+        if ( after * 1000 > delay )
+        {
+            delay = after * 1000;
+        }
+    }
+
+    return delay;
+}
+
+/**
+ * Sleep for given milliseconds
+ */
+void retry_sleep ( unsigned long delay )
+{
+    struct timespec ts;
+
+    ts.tv_sec = delay / 1000;
+    ts.tv_nsec = ( delay % 1000 ) * 1000000;
+
+    /* Sleep is resumed after signals */
+    while ( nanosleep ( &ts, &ts ) < 0 && errno == EINTR )
+    {
+        continue;
+    }
+}
+
+/**
+ * Prepare next attempt to continue after written prefix of failed one
+ */
+int retry_resume ( const char *filepath, const struct options_t *options,
+    const struct retry_t *retry, struct options_t *current )
+{
+    /* Attempts that did not reach the file change nothing */
+    if ( !retry->opened || options->compressed )
+    {
+        return 0;
+    }
+
+    current->resume = retry->resumable;
+
+    if ( retry->resumable && truncate ( filepath, retry->offset ) < 0 )
+    {
+        perror ( "truncate" );
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,286 @@
+/* ------------------------------------------------------------------
+ * Lget - Header Scanning Primitives
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Vector width is selected at build time
+ */
+#ifndef DISABLE_SIMD
+#if defined(__AVX2__)
+#define SCAN_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#define SCAN_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#define SCAN_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/**
+ * Fold ASCII upper case letter to lower case
+ */
+static inline unsigned char scan_fold ( unsigned char c )
+{
+    return ( unsigned int ) ( c - 'A' ) < 26 ? c | 0x20 : c;
+}
+
+#if defined(SCAN_AVX2)
+
+#define SCAN_WIDTH 32
+
+typedef __m256i scan_vec_t;
+
+static inline scan_vec_t scan_load ( const char *ptr )
+{
+    return _mm256_loadu_si256 ( ( const __m256i * ) ptr );
+}
+
+static inline scan_vec_t scan_splat ( unsigned char c )
+{
+    return _mm256_set1_epi8 ( ( char ) c );
+}
+
+/**
+ * Lower case letters, bytes above 0x7f compare as negative and stay intact
+ */
+static inline scan_vec_t scan_vfold ( scan_vec_t v )
+{
+    __m256i upper;
+
+    upper = _mm256_and_si256 ( _mm256_cmpgt_epi8 ( v, _mm256_set1_epi8 ( 'A' - 1 ) ),
+        _mm256_cmpgt_epi8 ( _mm256_set1_epi8 ( 'Z' + 1 ), v ) );
+
+    return _mm256_or_si256 ( v, _mm256_and_si256 ( upper, _mm256_set1_epi8 ( 0x20 ) ) );
+}
+
+/**
+ * Get bit mask of equal bytes, bit i stands for byte i
+ */
+static inline unsigned long long scan_mask ( scan_vec_t a, scan_vec_t b )
+{
+    return ( unsigned int ) _mm256_movemask_epi8 ( _mm256_cmpeq_epi8 ( a, b ) );
+}
+
+#define SCAN_MASK_FULL 0xffffffffull
+#define SCAN_MASK_SHIFT 0
+
+#elif defined(SCAN_SSE2)
+
+#define SCAN_WIDTH 16
+
+typedef __m128i scan_vec_t;
+
+static inline scan_vec_t scan_load ( const char *ptr )
+{
+    return _mm_loadu_si128 ( ( const __m128i * ) ptr );
+}
+
+static inline scan_vec_t scan_splat ( unsigned char c )
+{
+    return _mm_set1_epi8 ( ( char ) c );
+}
+
+/**
+ * Lower case letters, bytes above 0x7f compare as negative and stay intact
+ */
+static inline scan_vec_t scan_vfold ( scan_vec_t v )
+{
+    __m128i upper;
+
+    upper = _mm_and_si128 ( _mm_cmpgt_epi8 ( v, _mm_set1_epi8 ( 'A' - 1 ) ),
+        _mm_cmplt_epi8 ( v, _mm_set1_epi8 ( 'Z' + 1 ) ) );
+
+    return _mm_or_si128 ( v, _mm_and_si128 ( upper, _mm_set1_epi8 ( 0x20 ) ) );
+}
+
+/**
+ * Get bit mask of equal bytes, bit i stands for byte i
+ */
+static inline unsigned long long scan_mask ( scan_vec_t a, scan_vec_t b )
+{
+    return ( unsigned int ) _mm_movemask_epi8 ( _mm_cmpeq_epi8 ( a, b ) );
+}
+
+#define SCAN_MASK_FULL 0xffffull
+#define SCAN_MASK_SHIFT 0
+
+#elif defined(SCAN_NEON)
+
+#define SCAN_WIDTH 16
+#define SCAN_MASK_FULL 0x1111111111111111ull
+#define SCAN_MASK_SHIFT 2
+
+typedef uint8x16_t scan_vec_t;
+
+static inline scan_vec_t scan_load ( const char *ptr )
+{
+    return vld1q_u8 ( ( const uint8_t * ) ptr );
+}
+
+static inline scan_vec_t scan_splat ( unsigned char c )
+{
+    return vdupq_n_u8 ( c );
+}
+
+/**
+ * Lower case letters
+ */
+static inline scan_vec_t scan_vfold ( scan_vec_t v )
+{
+    uint8x16_t upper;
+
+    upper = vcltq_u8 ( vsubq_u8 ( v, vdupq_n_u8 ( 'A' ) ), vdupq_n_u8 ( 26 ) );
+
+    return vorrq_u8 ( v, vandq_u8 ( upper, vdupq_n_u8 ( 0x20 ) ) );
+}
+
+/**
+ * Get bit mask of equal bytes, bit 4 * i stands for byte i
+ */
+static inline unsigned long long scan_mask ( scan_vec_t a, scan_vec_t b )
+{
+    uint8x8_t narrow;
+
+    narrow = vshrn_n_u16 ( vreinterpretq_u16_u8 ( vceqq_u8 ( a, b ) ), 4 );
+
+    return vget_lane_u64 ( vreinterpret_u64_u8 ( narrow ), 0 ) & SCAN_MASK_FULL;
+}
+
+#endif
+
+/**
+ * Find byte within buffer
+ */
+static const char *scan_byte ( const char *ptr, size_t len, unsigned char c )
+{
+    const char *end;
+
+    end = ptr + len;
+
+#ifdef SCAN_WIDTH
+    {
+        unsigned long long mask;
+        scan_vec_t pattern;
+
+        pattern = scan_splat ( c );
+
+        for ( ; end - ptr >= SCAN_WIDTH; ptr += SCAN_WIDTH )
+        {
+            if ( ( mask = scan_mask ( scan_load ( ptr ), pattern ) ) )
+            {
+                return ptr + ( __builtin_ctzll ( mask ) >> SCAN_MASK_SHIFT );
+            }
+        }
+    }
+#endif
+
+    for ( ; ptr < end; ptr++ )
+    {
+        if ( ( unsigned char ) *ptr == c )
+        {
+            return ptr;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Find line feed within buffer
+ */
+const char *scan_lf ( const char *ptr, size_t len )
+{
+    return scan_byte ( ptr, len, '\n' );
+}
+
+/**
+ * Compare buffers of equal length ignoring ASCII letter case
+ */
+int scan_casecmp ( const char *a, const char *b, size_t len )
+{
+    size_t i = 0;
+
+#ifdef SCAN_WIDTH
+    for ( ; i + SCAN_WIDTH <= len; i += SCAN_WIDTH )
+    {
+        if ( scan_mask ( scan_vfold ( scan_load ( a + i ) ),
+                scan_vfold ( scan_load ( b + i ) ) ) != SCAN_MASK_FULL )
+        {
+            break;
+        }
+    }
+#endif
+
+    for ( ; i < len; i++ )
+    {
+        if ( scan_fold ( a[i] ) != scan_fold ( b[i] ) )
+        {
+            return scan_fold ( a[i] ) - scan_fold ( b[i] );
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Find string within buffer ignoring ASCII letter case
+ */
+const char *scan_casestr ( const char *ptr, size_t len, const char *needle, size_t needle_len )
+{
+    size_t i = 0;
+    size_t limit;
+    unsigned char first;
+
+    if ( needle_len > len )
+    {
+        return NULL;
+    }
+
+    if ( !needle_len )
+    {
+        return ptr;
+    }
+
+    limit = len - needle_len + 1;
+    first = scan_fold ( needle[0] );
+
+#ifdef SCAN_WIDTH
+    {
+        unsigned int bit;
+        unsigned long long mask;
+        scan_vec_t pattern;
+
+        pattern = scan_splat ( first );
+
+        /* Positions matching the first byte are verified one by one */
+        for ( ; i + SCAN_WIDTH <= limit; i += SCAN_WIDTH )
+        {
+            for ( mask = scan_mask ( scan_vfold ( scan_load ( ptr + i ) ), pattern ); mask;
+                mask &= mask - 1 )
+            {
+                bit = __builtin_ctzll ( mask ) >> SCAN_MASK_SHIFT;
+
+                if ( !scan_casecmp ( ptr + i + bit + 1, needle + 1, needle_len - 1 ) )
+                {
+                    return ptr + i + bit;
+                }
+            }
+        }
+    }
+#endif
+
+    for ( ; i < limit; i++ )
+    {
+        if ( scan_fold ( ptr[i] ) == first
+            && !scan_casecmp ( ptr + i + 1, needle + 1, needle_len - 1 ) )
+        {
+            return ptr + i;
+        }
+    }
+
+    return NULL;
+}
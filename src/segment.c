@@ -0,0 +1,511 @@
+/* ------------------------------------------------------------------
+ * Lget - Segmented Download Support
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Single download segment details
+ */
+struct segment_t
+{
+    pthread_t thread;
+    struct download_t *download;
+    int started;
+    int result;
+    int error;
+    int sock;
+    size_t begin;
+    size_t end;
+    size_t pos;
+};
+
+/**
+ * Segmented download shared state
+ */
+struct download_t
+{
+    const char *url;
+    const char *basename;
+    const struct options_t *options;
+    int fd;
+    size_t total;
+    size_t count;
+    struct segment_t *segments;
+    struct progress_t progress;
+    struct checksum_t checksum;
+};
+
+/**
+ * Advance segment position and report contiguous file prefix to checksum
+ */
+static void segment_advance ( struct segment_t *segment, size_t len )
+{
+    size_t i;
+    size_t pos;
+    struct download_t *download;
+
+    download = segment->download;
+
+    __atomic_store_n ( &segment->pos, segment->pos + len, __ATOMIC_RELEASE );
+    progress_add ( &download->progress, len );
+
+    if ( !download->checksum.running )
+    {
+        return;
+    }
+
+    /* Prefix ends at the first segment not yet complete */
+    for ( i = 0; i < download->count; i++ )
+    {
+        pos = __atomic_load_n ( &download->segments[i].pos, __ATOMIC_ACQUIRE );
+
+        if ( pos < download->segments[i].end )
+        {
+            break;
+        }
+    }
+
+    checksum_update ( &download->checksum, i < download->count ? pos : download->total );
+}
+
+/**
+ * Write data slice at given file offset
+ */
+static int segment_write ( int fd, const char *data, size_t len, size_t offset )
+{
+    ssize_t ret;
+
+    while ( len )
+    {
+        if ( ( ret = pwrite ( fd, data, len, offset ) ) < 0 )
+        {
+            return -1;
+        }
+
+        data += ret;
+        len -= ret;
+        offset += ret;
+    }
+
+    return 0;
+}
+
+/**
+ * Receive segment data slice, moving it within kernel if possible
+ */
+static ssize_t segment_recv_slice ( struct segment_t *segment, struct splice_t *relay,
+    struct uring_t **ring, char *buffer, size_t limit, size_t offset )
+{
+    ssize_t len;
+    size_t pos = offset;
+
+    if ( *ring )
+    {
+        if ( ( len = uring_recv ( *ring, segment->sock, segment->download->fd, offset,
+                    limit ) ) >= 0 || errno != ENOSYS )
+        {
+            if ( len < 0 )
+            {
+                segment->error = errno;
+                perror ( "io_uring" );
+            }
+            return len;
+        }
+
+        /* Fall back to copy loop */
+        uring_close ( *ring );
+        *ring = NULL;
+    }
+
+    if ( relay->pipe[0] >= 0 )
+    {
+        if ( ( len = splice_recv ( relay, segment->sock, segment->download->fd, &pos,
+                    limit ) ) >= 0 || errno != ENOSYS )
+        {
+            if ( len < 0 )
+            {
+                segment->error = errno;
+                perror ( "splice" );
+            }
+            return len;
+        }
+
+        /* Fall back to copy loop */
+        splice_close ( relay );
+    }
+
+    if ( limit > SEGMENT_BUFFER_SIZE )
+    {
+        limit = SEGMENT_BUFFER_SIZE;
+    }
+
+    if ( ( len = recv ( segment->sock, buffer, limit, 0 ) ) < 0 )
+    {
+        segment->error = errno;
+        perror ( "recv" );
+        return -1;
+    }
+
+    if ( len && segment_write ( segment->download->fd, buffer, len, offset ) < 0 )
+    {
+        segment->error = errno;
+        perror ( "pwrite" );
+        return -1;
+    }
+
+    return len;
+}
+
+/**
+ * Receive segment data into output file
+ */
+static int segment_recv ( struct segment_t *segment, size_t offset )
+{
+    ssize_t len = 0;
+    struct splice_t relay;
+    struct uring_t *ring = NULL;
+    char buffer[SEGMENT_BUFFER_SIZE];
+
+    relay.pipe[0] = -1;
+    relay.pipe[1] = -1;
+
+    if ( segment->download->options->backend == BACKEND_URING )
+    {
+        ring = uring_open (  );
+
+    } else if ( segment->download->options->backend == BACKEND_SPLICE )
+    {
+        splice_open ( &relay );
+    }
+
+    for ( ; offset < segment->end; offset += len )
+    {
+        if ( ( len =
+                segment_recv_slice ( segment, &relay, &ring, buffer, segment->end - offset,
+                    offset ) ) <= 0 )
+        {
+            break;
+        }
+
+        segment_advance ( segment, len );
+    }
+
+    splice_close ( &relay );
+
+    if ( ring )
+    {
+        uring_close ( ring );
+    }
+
+    if ( offset < segment->end )
+    {
+        /* Detect broken pipe */
+        if ( !len )
+        {
+            errno = EPIPE;
+            segment->error = errno;
+            perror ( "recv" );
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Download single segment over new connection
+ */
+static void *segment_thread ( void *arg )
+{
+    int keepalive;
+    unsigned short port;
+    size_t len;
+    size_t size;
+    const char *path;
+    char *buffer;
+    struct response_t response;
+    struct segment_t *segment;
+    struct download_t *download;
+    char hostname[HOSTNAME_SIZE];
+    char range[64];
+
+    segment = ( struct segment_t * ) arg;
+    download = segment->download;
+
+    /* Extract hostname and path from http url */
+    if ( http_parse_url ( download->url, hostname, sizeof ( hostname ), &port, &path ) < 0 )
+    {
+        segment->error = errno;
+        perror ( "parse" );
+        return NULL;
+    }
+
+    /* Request segment byte range */
+    snprintf ( range, sizeof ( range ), "Range: bytes=%lu-%lu\r\n",
+        ( unsigned long ) segment->begin, ( unsigned long ) segment->end - 1 );
+
+    /* Buffer may grow while receiving response header */
+    size = HTTP_BUFFER_SIZE;
+
+    if ( !( buffer = ( char * ) malloc ( size ) ) )
+    {
+        segment->error = errno;
+        perror ( "malloc" );
+        return NULL;
+    }
+
+    if ( ( segment->sock =
+            http_query ( download->url, range, download->options, &buffer, &size, &len,
+                &response ) ) < 0 )
+    {
+        segment->error = errno;
+        free ( buffer );
+        return NULL;
+    }
+
+    /* Connection may be reused if response body is delimited */
+    keepalive = download->options->keepalive && response_keepalive ( &response );
+
+    /* Server must respond with the requested range, wider one would leave body unread */
+    if ( response.status != 206 || !response.has_range
+        || response.range_begin != segment->begin || response.range_end != segment->end - 1
+        || response.range_total != download->total )
+    {
+        errno = EINVAL;
+        segment->error = errno;
+        perror ( "range" );
+        close ( segment->sock );
+        free ( buffer );
+        return NULL;
+    }
+
+    /* Copy first data slice */
+    if ( ( len -= response.header_len ) > segment->end - segment->begin )
+    {
+        len = segment->end - segment->begin;
+        keepalive = 0;
+    }
+
+    if ( len )
+    {
+        if ( segment_write ( download->fd, buffer + response.header_len, len,
+                segment->begin ) < 0 )
+        {
+            segment->error = errno;
+            perror ( "pwrite" );
+            close ( segment->sock );
+            free ( buffer );
+            return NULL;
+        }
+
+        segment_advance ( segment, len );
+    }
+
+    free ( buffer );
+
+    /* Further data receive */
+    if ( segment_recv ( segment, segment->begin + len ) < 0 )
+    {
+        close ( segment->sock );
+        return NULL;
+    }
+
+    /* Keep connection for following downloads */
+    if ( keepalive )
+    {
+        pool_release ( segment->sock, hostname, port, download->options->socks5 );
+
+    } else
+    {
+        close ( segment->sock );
+    }
+
+    segment->result = 0;
+
+    return NULL;
+}
+
+/**
+ * Download file in segments over parallel connections
+ */
+int segment_get ( int sock, const char *url, const char *filepath, const char *data,
+    size_t len, size_t offset, size_t total, const struct options_t *options )
+{
+    int ret = 0;
+    int error = 0;
+    size_t i;
+    size_t count;
+    struct download_t download;
+    struct segment_t segments[SEGMENTS_MAX];
+
+    /* Calculate segments count */
+    count = options->connections;
+
+    if ( count > SEGMENTS_MAX )
+    {
+        count = SEGMENTS_MAX;
+    }
+
+    if ( count > ( total - offset ) / SEGMENT_SIZE_MIN )
+    {
+        count = ( total - offset ) / SEGMENT_SIZE_MIN;
+    }
+
+    if ( !count )
+    {
+        count = 1;
+    }
+
+    /* Prepare shared state */
+    download.url = url;
+    download.basename = get_basename ( filepath );
+    download.options = options;
+    download.total = total;
+    download.count = count;
+    download.segments = segments;
+
+    /* Open output file, keep partial data if resuming */
+    if ( ( download.fd =
+            open ( filepath, O_CREAT | O_WRONLY | ( offset ? 0 : O_TRUNC ), 0644 ) ) < 0 )
+    {
+        perror ( "open" );
+        return -1;
+    }
+
+    /* Reserve disk space, then set final file size upfront */
+    if ( file_preallocate ( download.fd, offset, total ) < 0 )
+    {
+        perror ( "fallocate" );
+        close ( download.fd );
+        return -1;
+    }
+
+    if ( ftruncate ( download.fd, total ) < 0 )
+    {
+        perror ( "ftruncate" );
+        close ( download.fd );
+        return -1;
+    }
+
+    /* Checksum thread follows contiguous prefix of the file, partial data included */
+    if ( checksum_start ( &download.checksum, options->checksum, filepath, offset ) < 0 )
+    {
+        perror ( "checksum" );
+        close ( download.fd );
+        return -1;
+    }
+
+    /* Segments only add to the shared counter, reporter prints in intervals */
+    progress_start ( &download.progress, download.basename, offset, total, options->progress );
+
+    /* Split remaining bytes into ranges */
+    for ( i = 0; i < count; i++ )
+    {
+        segments[i].download = &download;
+        segments[i].started = 0;
+        segments[i].result = -1;
+        segments[i].error = 0;
+        segments[i].sock = -1;
+        segments[i].begin = offset + ( total - offset ) / count * i;
+        segments[i].end = i + 1 < count ? offset + ( total - offset ) / count * ( i + 1 ) : total;
+        segments[i].pos = segments[i].begin;
+    }
+
+    /* Start remaining segments in background */
+    for ( i = 1; i < count; i++ )
+    {
+        if ( pthread_create ( &segments[i].thread, NULL, segment_thread, &segments[i] ) )
+        {
+            perror ( "pthread_create" );
+            ret = -1;
+            break;
+        }
+        segments[i].started = 1;
+    }
+
+    /* First segment reuses probe connection */
+    segments[0].sock = sock;
+
+    if ( !ret )
+    {
+        if ( len > segments[0].end - offset )
+        {
+            len = segments[0].end - offset;
+        }
+
+        if ( len && segment_write ( download.fd, data, len, offset ) < 0 )
+        {
+            error = errno;
+            perror ( "pwrite" );
+            ret = -1;
+
+        } else
+        {
+            segment_advance ( &segments[0], len );
+            segments[0].result = segment_recv ( &segments[0], offset + len );
+        }
+    }
+
+    /* Wait for all segments to complete */
+    for ( i = 0; i < count; i++ )
+    {
+        if ( segments[i].started )
+        {
+            pthread_join ( segments[i].thread, NULL );
+        }
+
+        /* First failed segment decides whether download is retried */
+        if ( segments[i].result < 0 )
+        {
+            error = error ? error : segments[i].error;
+            ret = -1;
+        }
+    }
+
+    /* Keep only contiguous data so the download can be continued */
+    if ( ret < 0 )
+    {
+        checksum_cancel ( &download.checksum );
+        progress_stop ( &download.progress, -1 );
+
+        for ( i = 0; i < count; i++ )
+        {
+            if ( segments[i].pos < segments[i].end )
+            {
+                if ( ftruncate ( download.fd, segments[i].pos ) < 0 )
+                {
+                    perror ( "ftruncate" );
+                }
+                break;
+            }
+        }
+
+        close ( download.fd );
+        errno = error;
+        return -1;
+    }
+
+    /* Mismatching file is removed, so it is not mistaken for a partial one */
+    if ( checksum_finish ( &download.checksum, total ) < 0 )
+    {
+        progress_stop ( &download.progress, -1 );
+        perror ( "checksum" );
+        unlink ( filepath );
+        close ( download.fd );
+        return -1;
+    }
+
+    if ( file_finish ( download.fd, total, options ) < 0 )
+    {
+        progress_stop ( &download.progress, -1 );
+        perror ( "verify" );
+        close ( download.fd );
+        return -1;
+    }
+
+    progress_stop ( &download.progress, 0 );
+    close ( download.fd );
+
+    return 0;
+}
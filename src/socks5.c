@@ -4,31 +4,24 @@
 
 #include "lget.h"
 
-/*
- * Perform Socks5 handshake
+/**
+ * Format Socks5 greeting message
  */
-int socks5_handshake ( int sock )
+size_t socks5_format_greeting ( char *buffer )
 {
-    ssize_t len;
-    char buffer[32];
-
     /* Version 5, one method: no authentication */
     buffer[0] = 5;      /* socks version */
     buffer[1] = 1;      /* one method */
     buffer[2] = 0;      /* no auth */
 
-    /* Estabilish session with proxy server */
-    if ( send ( sock, buffer, 3, MSG_NOSIGNAL ) <= 0 )
-    {
-        return -1;
-    }
-
-    /* Receive operation status */
-    if ( ( len = recv ( sock, buffer, sizeof ( buffer ) - 1, 0 ) ) <= 0 )
-    {
-        return -1;
-    }
+    return 3;
+}
 
+/**
+ * Validate Socks5 greeting response
+ */
+int socks5_check_greeting ( const char *buffer, size_t len )
+{
     /* Detect broken pipe */
     if ( !len )
     {
@@ -43,24 +36,19 @@ int socks5_handshake ( int sock )
         return -1;
     }
 
-    /* Handshake success */
     return 0;
 }
 
 /**
- * Request new Socks5 connection
+ * Format Socks5 connect request with hostname
  */
-int socks5_request_hostname ( int sock, const char *hostname, unsigned short port )
+ssize_t socks5_format_request_hostname ( char *buffer, size_t size, const char *hostname,
+    unsigned short port )
 {
-    ssize_t len;
     size_t hostlen;
-    char buffer[HOSTNAME_SIZE + 32];
-
-    /* Put port number into network byte order */
-    port = htons ( port );
 
     /* Get hostname string length */
-    if ( ( hostlen = strlen ( hostname ) ) > HOSTNAME_SIZE )
+    if ( ( hostlen = strlen ( hostname ) ) > 255 || hostlen + 7 > size )
     {
         errno = ENOBUFS;
         return -1;
@@ -70,6 +58,26 @@ int socks5_request_hostname ( int sock, const char *hostname, unsigned short por
     buffer[0] = 5;      /* socks version */
     buffer[1] = 1;      /* connect */
     buffer[2] = 0;      /* reserved */
+
+#ifndef DISABLE_INET_PTON
+    /* Address literals are sent as IPv4 or IPv6 address */
+    if ( size >= 22 && inet_pton ( AF_INET, hostname, buffer + 4 ) > 0 )
+    {
+        buffer[3] = 1;  /* IPv4 address */
+        buffer[8] = port >> 8;
+        buffer[9] = port & 0xff;
+        return 10;
+    }
+
+    if ( size >= 22 && inet_pton ( AF_INET6, hostname, buffer + 4 ) > 0 )
+    {
+        buffer[3] = 4;  /* IPv6 address */
+        buffer[20] = port >> 8;
+        buffer[21] = port & 0xff;
+        return 22;
+    }
+#endif
+
     buffer[3] = 3;      /* hostname */
 
     buffer[4] = hostlen;        /* hostname length */
@@ -77,18 +85,38 @@ int socks5_request_hostname ( int sock, const char *hostname, unsigned short por
     buffer[5 + hostlen] = port >> 8;    /* port number 1'st byte */
     buffer[6 + hostlen] = port & 0xff;  /* port number 2'nd byte */
 
-    /* Send request to SOCK5 proxy server */
-    if ( send ( sock, buffer, hostlen + 7, MSG_NOSIGNAL ) <= 0 )
+    return hostlen + 7;
+}
+
+/**
+ * Get Socks5 connect response length, zero if more data is needed
+ */
+size_t socks5_reply_len ( const char *buffer, size_t len )
+{
+    /* Address type and first address byte are needed */
+    if ( len < 5 )
     {
-        return -1;
+        return 0;
     }
 
-    /* Receive operation status */
-    if ( ( len = recv ( sock, buffer, sizeof ( buffer ) - 1, 0 ) ) < 0 )
+    switch ( buffer[3] )
     {
-        return -1;
+    case 1:
+        return 10;      /* IPv4 address */
+    case 3:
+        return 7 + ( unsigned char ) buffer[4]; /* hostname */
+    case 4:
+        return 22;      /* IPv6 address */
     }
 
+    return len;
+}
+
+/**
+ * Validate Socks5 connect response
+ */
+int socks5_check_reply ( const char *buffer, size_t len )
+{
     /* Detect broken pipe */
     if ( !len )
     {
@@ -97,12 +125,67 @@ int socks5_request_hostname ( int sock, const char *hostname, unsigned short por
     }
 
     /* Analyse received response */
-    if ( len < 4 || buffer[0] != 5 || buffer[1] != 0 || buffer[3] != 1 )
+    if ( len < 4 || buffer[0] != 5 || buffer[1] != 0
+        || ( buffer[3] != 1 && buffer[3] != 3 && buffer[3] != 4 ) )
     {
         errno = EINVAL;
         return -1;
     }
 
-    /* Request success */
     return 0;
 }
+
+/*
+ * Perform Socks5 handshake
+ */
+int socks5_handshake ( int sock )
+{
+    ssize_t len;
+    char buffer[32];
+
+    /* Estabilish session with proxy server */
+    if ( send ( sock, buffer, socks5_format_greeting ( buffer ), MSG_NOSIGNAL ) <= 0 )
+    {
+        return -1;
+    }
+
+    /* Receive operation status */
+    if ( ( len = recv ( sock, buffer, sizeof ( buffer ) - 1, 0 ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Handshake success */
+    return socks5_check_greeting ( buffer, len );
+}
+
+/**
+ * Request new Socks5 connection
+ */
+int socks5_request_hostname ( int sock, const char *hostname, unsigned short port )
+{
+    ssize_t len;
+    char buffer[HOSTNAME_SIZE + 32];
+
+    /* Prepare request for SOCK5 proxy server */
+    if ( ( len =
+            socks5_format_request_hostname ( buffer, sizeof ( buffer ), hostname, port ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Send request to SOCK5 proxy server */
+    if ( send ( sock, buffer, len, MSG_NOSIGNAL ) <= 0 )
+    {
+        return -1;
+    }
+
+    /* Receive operation status */
+    if ( ( len = recv ( sock, buffer, sizeof ( buffer ) - 1, 0 ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Request success */
+    return socks5_check_reply ( buffer, len );
+}
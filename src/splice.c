@@ -0,0 +1,184 @@
+/* ------------------------------------------------------------------
+ * Lget - Zero Copy Receive Support
+ * ------------------------------------------------------------------ */
+
+#ifndef DISABLE_SPLICE
+#define _GNU_SOURCE
+#endif
+
+#include "lget.h"
+
+/**
+ * Setup pipe for moving data from socket into file
+ */
+int splice_open ( struct splice_t *relay )
+{
+#ifdef DISABLE_SPLICE
+    relay->pipe[0] = -1;
+    relay->pipe[1] = -1;
+    errno = ENOSYS;
+    return -1;
+#else
+    int size;
+
+    relay->broken = 0;
+
+    if ( pipe ( relay->pipe ) < 0 )
+    {
+        relay->pipe[0] = -1;
+        relay->pipe[1] = -1;
+        return -1;
+    }
+
+    /* Larger pipe means fewer system calls, kernel may refuse the size though */
+    fcntl ( relay->pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE );
+
+    if ( ( size = fcntl ( relay->pipe[1], F_GETPIPE_SZ ) ) <= 0 )
+    {
+        splice_close ( relay );
+        errno = ENOSYS;
+        return -1;
+    }
+
+    relay->size = size;
+
+    return 0;
+#endif
+}
+
+/**
+ * Release pipe used for moving data
+ */
+void splice_close ( struct splice_t *relay )
+{
+    if ( relay->pipe[0] >= 0 )
+    {
+        close ( relay->pipe[0] );
+        relay->pipe[0] = -1;
+    }
+
+    if ( relay->pipe[1] >= 0 )
+    {
+        close ( relay->pipe[1] );
+        relay->pipe[1] = -1;
+    }
+}
+
+#ifndef DISABLE_SPLICE
+
+/**
+ * Copy data stuck in pipe into file when file does not support splicing
+ */
+static int splice_drain ( struct splice_t *relay, int fd, size_t *offset, size_t len )
+{
+    ssize_t ret;
+    ssize_t written;
+    const char *ptr;
+    char buffer[4096];
+
+    while ( len )
+    {
+        if ( ( ret = read ( relay->pipe[0], buffer,
+                    len < sizeof ( buffer ) ? len : sizeof ( buffer ) ) ) <= 0 )
+        {
+            return -1;
+        }
+
+        len -= ret;
+
+        for ( ptr = buffer; ret; ptr += written, ret -= written )
+        {
+            if ( ( written =
+                    offset ? pwrite ( fd, ptr, ret, *offset ) : write ( fd, ptr, ret ) ) < 0 )
+            {
+                return -1;
+            }
+
+            if ( offset )
+            {
+                *offset += written;
+            }
+        }
+    }
+
+    return 0;
+}
+
+#endif
+
+/**
+ * Move data from socket into file at offset or current position, zero means connection closed
+ */
+ssize_t splice_recv ( struct splice_t *relay, int sock, int fd, size_t *offset, size_t len )
+{
+#ifdef DISABLE_SPLICE
+    ( void ) relay;
+    ( void ) sock;
+    ( void ) fd;
+    ( void ) offset;
+    ( void ) len;
+    errno = ENOSYS;
+    return -1;
+#else
+    ssize_t ret;
+    ssize_t moved;
+    size_t left;
+    loff_t pos;
+
+    if ( relay->broken )
+    {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    if ( len > relay->size )
+    {
+        len = relay->size;
+    }
+
+    /* Fill pipe from socket, nothing is consumed if socket is not supported */
+    if ( ( moved = splice ( sock, NULL, relay->pipe[1], NULL, len, SPLICE_F_MOVE ) ) < 0 )
+    {
+        if ( errno == EINVAL || errno == EOPNOTSUPP )
+        {
+            relay->broken = 1;
+            errno = ENOSYS;
+        }
+        return -1;
+    }
+
+    /* Empty pipe into file */
+    for ( left = moved; left; left -= ret )
+    {
+        pos = offset ? *offset : 0;
+
+        if ( ( ret =
+                splice ( relay->pipe[0], NULL, fd, offset ? &pos : NULL, left,
+                    SPLICE_F_MOVE ) ) <= 0 )
+        {
+            /* Data already left the socket, copy it through user space */
+            if ( ret < 0 && ( errno == EINVAL || errno == EOPNOTSUPP ) )
+            {
+                relay->broken = 1;
+                return splice_drain ( relay, fd, offset, left ) < 0 ? -1 : moved;
+            }
+
+            /* Pipe is left dirty, do not use it anymore */
+            relay->broken = 1;
+
+            if ( !ret )
+            {
+                errno = EIO;
+            }
+            return -1;
+        }
+
+        if ( offset )
+        {
+            *offset += ret;
+        }
+    }
+
+    return moved;
+#endif
+}
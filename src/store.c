@@ -0,0 +1,212 @@
+/* ------------------------------------------------------------------
+ * Lget - Content Addressed Store
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Build path of blob named by digest, algorithm directory is created if requested
+ */
+static int store_path ( const char *dir, const struct digest_t *digest, char *path, size_t size,
+    int create )
+{
+    char hex[DIGEST_SIZE_MAX * 2 + 1];
+
+    if ( ( size_t ) snprintf ( path, size, "%s/%s", dir,
+            digest_name ( digest->algorithm ) ) >= size )
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if ( create && mkdir ( path, 0755 ) < 0 && errno != EEXIST )
+    {
+        return -1;
+    }
+
+    digest_hex ( digest, hex );
+
+    if ( ( size_t ) snprintf ( path, size, "%s/%s/%s", dir, digest_name ( digest->algorithm ),
+            hex ) >= size )
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Hash whole file with given algorithm
+ */
+static int store_hash ( const char *filepath, int algorithm, struct digest_t *digest )
+{
+    int fd;
+    ssize_t len;
+    struct hash_t hash;
+    char buffer[FILE_COPY_BUFFER_SIZE];
+
+    if ( ( fd = open ( filepath, O_RDONLY ) ) < 0 )
+    {
+        return -1;
+    }
+
+    hash_init ( &hash, algorithm );
+
+    /* Fresh download is still in page cache */
+    while ( ( len = read ( fd, buffer, sizeof ( buffer ) ) ) > 0 )
+    {
+        hash_update ( &hash, buffer, len );
+    }
+
+    close ( fd );
+
+    if ( len < 0 )
+    {
+        return -1;
+    }
+
+    digest->algorithm = algorithm;
+    digest->len = hash_final ( &hash, digest->value );
+
+    return 0;
+}
+
+/**
+ * Check stored blob still holds content of given digest
+ */
+static int store_verify ( const char *path, const struct digest_t *digest )
+{
+    struct digest_t actual;
+
+    if ( store_hash ( path, digest->algorithm, &actual ) < 0 )
+    {
+        return 0;
+    }
+
+    return actual.len == digest->len && !memcmp ( actual.value, digest->value, digest->len );
+}
+
+/**
+ * Place stored blob with expected digest at output path, so download may be skipped
+ */
+int store_fetch ( const char *filepath, const struct options_t *options )
+{
+    struct stat st;
+    struct checksum_t checksum;
+    char path[PATH_MAX];
+
+    if ( !options->checksum
+        || store_path ( options->store, options->checksum, path, sizeof ( path ), 0 ) < 0
+        || stat ( path, &st ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Blob shared through hard links may have been modified in place */
+    if ( checksum_start ( &checksum, options->checksum, path, st.st_size ) < 0
+        || checksum_finish ( &checksum, st.st_size ) < 0 )
+    {
+        perror ( "store" );
+        unlink ( path );
+        return -1;
+    }
+
+    if ( file_place ( path, filepath ) < 0 )
+    {
+        perror ( "store" );
+        return -1;
+    }
+
+    if ( options->progress )
+    {
+        printf ( "%s: %lu/%lu - stored\n", get_basename ( filepath ),
+            ( unsigned long ) st.st_size, ( unsigned long ) st.st_size );
+    }
+
+    return 0;
+}
+
+/**
+ * Store completed download under its digest, output of known content links to stored blob
+ */
+int store_put ( const char *filepath, const struct options_t *options )
+{
+    int error;
+    struct stat st;
+    struct stat st_blob;
+    struct digest_t digest;
+    char path[PATH_MAX];
+    char alias[PATH_MAX];
+    char tmp[PATH_MAX];
+
+    /* Devices and pipes keep nothing to store */
+    if ( stat ( filepath, &st ) < 0 || !S_ISREG ( st.st_mode ) )
+    {
+        return 0;
+    }
+
+    /* Verified expected digest saves hashing */
+    if ( options->checksum && options->checksum->algorithm == DIGEST_SHA256 )
+    {
+        digest = *options->checksum;
+
+    } else if ( store_hash ( filepath, DIGEST_SHA256, &digest ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( store_path ( options->store, &digest, path, sizeof ( path ), 1 ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Blob shared through hard links may have been modified in place, it is replaced then */
+    if ( !stat ( path, &st_blob )
+        && ( ( st_blob.st_dev == st.st_dev && st_blob.st_ino == st.st_ino )
+            || store_verify ( path, &digest ) ) )
+    {
+        /* Identical content stored before, output is replaced by link to it */
+        if ( ( st_blob.st_dev != st.st_dev || st_blob.st_ino != st.st_ino )
+            && file_place ( path, filepath ) < 0 )
+        {
+            return -1;
+        }
+
+    } else
+    {
+        /* Temporary names are unique among concurrent downloads */
+        if ( ( size_t ) snprintf ( tmp, sizeof ( tmp ), "%s.%lu.%lx.tmp", path,
+                ( unsigned long ) getpid (  ), ( unsigned long ) pthread_self (  ) )
+            >= sizeof ( tmp ) )
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+
+        if ( file_clone ( filepath, tmp ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( rename ( tmp, path ) < 0 )
+        {
+            error = errno;
+            unlink ( tmp );
+            errno = error;
+            return -1;
+        }
+    }
+
+    /* Blob is also found by expected digest of another algorithm */
+    if ( options->checksum && options->checksum->algorithm != DIGEST_SHA256 )
+    {
+        if ( store_path ( options->store, options->checksum, alias, sizeof ( alias ), 1 ) < 0
+            || ( access ( alias, F_OK ) < 0 && file_clone ( path, alias ) < 0 && errno != EEXIST ) )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
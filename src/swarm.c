@@ -0,0 +1,696 @@
+/* ------------------------------------------------------------------
+ * Lget - Multi-Source Download Support
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+/**
+ * Swarm worker details, range is guarded by swarm mutex
+ */
+struct worker_t
+{
+    pthread_t thread;
+    struct swarm_t *swarm;
+    const char *url;
+    int started;
+    int failed;
+    size_t pos;
+    size_t end;
+    size_t reserved;
+    size_t received;
+    unsigned long busy;
+    unsigned long since;
+};
+
+/**
+ * Multi-source download shared state
+ */
+struct swarm_t
+{
+    const char *basename;
+    struct options_t options;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int fd;
+    size_t next;
+    size_t total;
+    size_t count;
+    struct worker_t *workers;
+    struct progress_t progress;
+    struct checksum_t checksum;
+};
+
+/**
+ * Get monotonic time in milliseconds
+ */
+static unsigned long swarm_now ( void )
+{
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Get worker throughput while fetching in bytes per second, zero if not measured yet
+ */
+static size_t swarm_rate ( const struct worker_t *worker )
+{
+    unsigned long elapsed;
+
+    elapsed = worker->busy + ( worker->since ? swarm_now (  ) - worker->since : 0 );
+
+    return elapsed ? worker->received * 1000 / elapsed : 0;
+}
+
+/**
+ * Check if any worker still fetches a range, called with mutex held
+ */
+static int swarm_busy ( const struct swarm_t *swarm )
+{
+    size_t i;
+
+    for ( i = 0; i < swarm->count; i++ )
+    {
+        if ( !swarm->workers[i].failed && swarm->workers[i].pos < swarm->workers[i].end )
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Get end of contiguous file prefix, called with mutex held
+ */
+static size_t swarm_prefix ( const struct swarm_t *swarm )
+{
+    size_t i;
+    size_t prefix;
+
+    /* Bytes below next are written or held by an unfinished range */
+    prefix = swarm->next;
+
+    for ( i = 0; i < swarm->count; i++ )
+    {
+        if ( swarm->workers[i].pos < swarm->workers[i].end && swarm->workers[i].pos < prefix )
+        {
+            prefix = swarm->workers[i].pos;
+        }
+    }
+
+    return prefix;
+}
+
+/**
+ * Get lowest offset of worker range that may be taken over, slice in flight is kept
+ */
+static size_t swarm_floor ( const struct worker_t *worker )
+{
+    return worker->reserved > worker->pos ? worker->reserved : worker->pos;
+}
+
+/**
+ * Take over part of a range, failed workers first, then the latest finishing one
+ */
+static int swarm_steal ( struct swarm_t *swarm, struct worker_t *worker )
+{
+    size_t i;
+    size_t left;
+    size_t rate;
+    size_t rate_victim;
+    size_t share;
+    double eta;
+    double eta_victim = 0.0;
+    struct worker_t *victim = NULL;
+
+    rate = swarm_rate ( worker );
+
+    for ( i = 0; i < swarm->count; i++ )
+    {
+        if ( &swarm->workers[i] == worker
+            || swarm->workers[i].pos >= swarm->workers[i].end )
+        {
+            continue;
+        }
+
+        /* Range of failed worker is taken whole */
+        if ( swarm->workers[i].failed )
+        {
+            worker->pos = swarm->workers[i].pos;
+            worker->end = swarm->workers[i].end;
+            swarm->workers[i].end = swarm->workers[i].pos;
+            return 1;
+        }
+
+        left = swarm->workers[i].end - swarm_floor ( &swarm->workers[i] );
+        rate_victim = swarm_rate ( &swarm->workers[i] );
+
+        /* Split is worth it only for a range long enough and a faster thief */
+        if ( left < 2 * SWARM_CHUNK_MIN || ( rate_victim && rate <= rate_victim ) )
+        {
+            continue;
+        }
+
+        eta = rate_victim ? ( double ) left / rate_victim : ( double ) left;
+
+        if ( !victim || eta > eta_victim )
+        {
+            victim = &swarm->workers[i];
+            eta_victim = eta;
+        }
+    }
+
+    if ( !victim )
+    {
+        return 0;
+    }
+
+    /* Tail is split, so that both workers finish at the same time */
+    left = victim->end - swarm_floor ( victim );
+    rate_victim = swarm_rate ( victim );
+    share = rate_victim ? ( size_t ) ( ( double ) left * rate / ( rate + rate_victim ) ) : left / 2;
+
+    if ( share < SWARM_CHUNK_MIN )
+    {
+        share = SWARM_CHUNK_MIN;
+    }
+
+    worker->end = victim->end;
+    worker->pos = victim->end - share;
+    victim->end = worker->pos;
+
+    return 1;
+}
+
+/**
+ * Assign next range to worker sized by its throughput, called with mutex held
+ */
+static int swarm_assign ( struct swarm_t *swarm, struct worker_t *worker )
+{
+    size_t size;
+
+    worker->reserved = 0;
+
+    if ( swarm->next >= swarm->total )
+    {
+        return swarm_steal ( swarm, worker );
+    }
+
+    /* Faster sources fetch larger ranges, so request overhead stays small */
+    size = swarm_rate ( worker ) * SWARM_CHUNK_MSEC / 1000;
+
+    if ( size < SWARM_CHUNK_MIN )
+    {
+        size = SWARM_CHUNK_MIN;
+
+    } else if ( size > SWARM_CHUNK_MAX )
+    {
+        size = SWARM_CHUNK_MAX;
+    }
+
+    worker->pos = swarm->next;
+    worker->end = swarm->total - swarm->next > size ? swarm->next + size : swarm->total;
+    swarm->next = worker->end;
+
+    return 1;
+}
+
+/**
+ * Record received slice and report contiguous prefix to checksum
+ */
+static void swarm_advance ( struct worker_t *worker, size_t len )
+{
+    size_t prefix;
+    struct swarm_t *swarm;
+
+    swarm = worker->swarm;
+
+    pthread_mutex_lock ( &swarm->mutex );
+    worker->pos += len;
+    worker->received += len;
+    prefix = swarm_prefix ( swarm );
+    pthread_mutex_unlock ( &swarm->mutex );
+
+    progress_add ( &swarm->progress, len );
+    checksum_update ( &swarm->checksum, prefix );
+}
+
+/**
+ * Reserve next slice of worker range, range may shrink when stolen, but not below slice
+ */
+static size_t swarm_reserve ( struct worker_t *worker, size_t max )
+{
+    size_t left;
+
+    pthread_mutex_lock ( &worker->swarm->mutex );
+    left = worker->end - worker->pos < max ? worker->end - worker->pos : max;
+    worker->reserved = worker->pos + left;
+    pthread_mutex_unlock ( &worker->swarm->mutex );
+
+    return left;
+}
+
+/**
+ * Write data slice at given file offset
+ */
+static int swarm_write ( int fd, const char *data, size_t len, size_t offset )
+{
+    ssize_t ret;
+
+    while ( len )
+    {
+        if ( ( ret = pwrite ( fd, data, len, offset ) ) < 0 )
+        {
+            return -1;
+        }
+
+        data += ret;
+        len -= ret;
+        offset += ret;
+    }
+
+    return 0;
+}
+
+/**
+ * Fetch assigned range from worker source
+ */
+static int swarm_fetch ( struct worker_t *worker, char **buffer, size_t *size,
+    struct splice_t *relay )
+{
+    int sock;
+    int keepalive;
+    unsigned short port;
+    ssize_t ret;
+    size_t len;
+    size_t left;
+    size_t pos;
+    size_t requested;
+    const char *path;
+    struct swarm_t *swarm;
+    struct response_t response;
+    struct stall_t stall;
+    char hostname[HOSTNAME_SIZE];
+    char range[64];
+
+    swarm = worker->swarm;
+
+    if ( http_parse_url ( worker->url, hostname, sizeof ( hostname ), &port, &path ) < 0 )
+    {
+        perror ( "parse" );
+        return -1;
+    }
+
+    pthread_mutex_lock ( &swarm->mutex );
+    pos = worker->pos;
+    requested = worker->end;
+    pthread_mutex_unlock ( &swarm->mutex );
+
+    snprintf ( range, sizeof ( range ), "Range: bytes=%lu-%lu\r\n", ( unsigned long ) pos,
+        ( unsigned long ) requested - 1 );
+
+    if ( ( sock = http_query ( worker->url, range, &swarm->options, buffer, size, &len,
+                &response ) ) < 0 )
+    {
+        return -1;
+    }
+
+    keepalive = response_keepalive ( &response );
+
+    /* Every source must serve the requested range of the same file */
+    if ( response.status != 206 || !response.has_range || response.range_begin != pos
+        || response.range_end != requested - 1 || response.range_total != swarm->total )
+    {
+        errno = EINVAL;
+        perror ( "range" );
+        close ( sock );
+        return -1;
+    }
+
+    /* Copy first data slice */
+    len -= response.header_len;
+
+    if ( ( left = swarm_reserve ( worker, len ) ) < len )
+    {
+        len = left;
+        keepalive = 0;
+    }
+
+    if ( len )
+    {
+        if ( swarm_write ( swarm->fd, *buffer + response.header_len, len, pos ) < 0 )
+        {
+            perror ( "pwrite" );
+            close ( sock );
+            return -1;
+        }
+
+        pos += len;
+        swarm_advance ( worker, len );
+    }
+
+    mirror_stall_start ( &stall, pos, swarm->options.min_speed );
+
+    /* Further data receive, up to the end of range which may shrink meanwhile */
+    while ( ( left = swarm_reserve ( worker, relay->pipe[0] >= 0 ? relay->size : *size ) ) )
+    {
+        if ( relay->pipe[0] >= 0 )
+        {
+            if ( ( ret = splice_recv ( relay, sock, swarm->fd, &pos, left ) ) < 0
+                && errno == ENOSYS )
+            {
+                /* Fall back to copy loop */
+                splice_close ( relay );
+                continue;
+            }
+
+        } else if ( ( ret = recv ( sock, *buffer, left < *size ? left : *size, 0 ) ) > 0 )
+        {
+            if ( swarm_write ( swarm->fd, *buffer, ret, pos ) < 0 )
+            {
+                perror ( "pwrite" );
+                close ( sock );
+                return -1;
+            }
+
+            pos += ret;
+        }
+
+        if ( ret <= 0 )
+        {
+            if ( !ret )
+            {
+                errno = EPIPE;
+
+            } else if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                errno = ETIMEDOUT;
+            }
+
+            perror ( "recv" );
+            close ( sock );
+            return -1;
+        }
+
+        swarm_advance ( worker, ret );
+
+        /* Slow source gives its range up to the others */
+        if ( mirror_stall_check ( &stall, pos ) < 0 )
+        {
+            perror ( "stall" );
+            close ( sock );
+            return -1;
+        }
+    }
+
+    /* Rest of a stolen range is still in flight */
+    if ( keepalive && pos == requested )
+    {
+        pool_release ( sock, hostname, port, swarm->options.socks5 );
+
+    } else
+    {
+        close ( sock );
+    }
+
+    return 0;
+}
+
+/**
+ * Worker thread, fetches ranges from its source until none is left
+ */
+static void *swarm_thread ( void *arg )
+{
+    int ret;
+    size_t size;
+    char *buffer;
+    unsigned long now;
+    struct timespec ts;
+    struct splice_t relay;
+    struct worker_t *worker;
+    struct swarm_t *swarm;
+
+    worker = ( struct worker_t * ) arg;
+    swarm = worker->swarm;
+
+    /* Buffer may grow while receiving response header */
+    size = HTTP_BUFFER_SIZE;
+
+    if ( !( buffer = ( char * ) malloc ( size ) ) )
+    {
+        perror ( "malloc" );
+        pthread_mutex_lock ( &swarm->mutex );
+        worker->failed = 1;
+        pthread_cond_broadcast ( &swarm->cond );
+        pthread_mutex_unlock ( &swarm->mutex );
+        return NULL;
+    }
+
+    relay.pipe[0] = -1;
+    relay.pipe[1] = -1;
+
+    if ( swarm->options.backend == BACKEND_SPLICE )
+    {
+        splice_open ( &relay );
+    }
+
+    pthread_mutex_lock ( &swarm->mutex );
+
+    for ( ;; )
+    {
+        /* Idle worker stays around, a failed or slowed down one may leave work behind */
+        while ( !( ret = swarm_assign ( swarm, worker ) ) && swarm_busy ( swarm ) )
+        {
+            clock_gettime ( CLOCK_REALTIME, &ts );
+            ts.tv_sec += SWARM_STEAL_MSEC / 1000;
+            ts.tv_nsec += ( SWARM_STEAL_MSEC % 1000 ) * 1000000;
+
+            if ( ts.tv_nsec >= 1000000000 )
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+
+            pthread_cond_timedwait ( &swarm->cond, &swarm->mutex, &ts );
+        }
+
+        if ( !ret )
+        {
+            break;
+        }
+
+        worker->since = swarm_now (  );
+        pthread_mutex_unlock ( &swarm->mutex );
+
+        ret = swarm_fetch ( worker, &buffer, &size, &relay );
+
+        pthread_mutex_lock ( &swarm->mutex );
+        now = swarm_now (  );
+        worker->busy += now - worker->since;
+        worker->since = 0;
+        pthread_cond_broadcast ( &swarm->cond );
+
+        /* Remaining range is left for the others */
+        if ( ret < 0 )
+        {
+            worker->failed = 1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock ( &swarm->mutex );
+
+    splice_close ( &relay );
+    free ( buffer );
+
+    return NULL;
+}
+
+/**
+ * Download file ranges from several sources at once
+ */
+int swarm_get ( const char *const *urls, size_t sources, size_t total, const char *filepath,
+    const struct options_t *options )
+{
+    int ret = 0;
+    size_t i;
+    size_t j;
+    size_t sum;
+    size_t offset = 0;
+    struct stat st;
+    struct swarm_t swarm;
+    struct worker_t workers[SEGMENTS_MAX];
+
+    /* Continue from the end of partial file if requested */
+    if ( options->resume && !stat ( filepath, &st ) && S_ISREG ( st.st_mode )
+        && ( size_t ) st.st_size <= total )
+    {
+        offset = st.st_size;
+    }
+
+    /* Every source gets its connections, ranges travel plain over persistent ones */
+    swarm.basename = get_basename ( filepath );
+    swarm.options = *options;
+    swarm.options.keepalive = 1;
+    swarm.options.compressed = 0;
+    swarm.next = offset;
+    swarm.total = total;
+    swarm.count = sources * options->connections;
+    swarm.workers = workers;
+
+    if ( swarm.count > SEGMENTS_MAX )
+    {
+        swarm.count = SEGMENTS_MAX;
+    }
+
+    for ( i = 0; i < swarm.count; i++ )
+    {
+        memset ( &workers[i], '\0', sizeof ( struct worker_t ) );
+        workers[i].swarm = &swarm;
+        workers[i].url = urls[i % sources];
+    }
+
+    /* Copy shared with cache or store is never written through, resumed prefix is kept */
+    if ( ( options->cache || options->store ) && file_detach ( filepath, offset != 0 ) < 0 )
+    {
+        perror ( "detach" );
+        return -1;
+    }
+
+    /* Open output file, keep partial data if resuming */
+    if ( ( swarm.fd = open ( filepath, O_CREAT | O_WRONLY | ( offset ? 0 : O_TRUNC ), 0644 ) ) < 0 )
+    {
+        perror ( "open" );
+        return -1;
+    }
+
+    /* Reserve disk space, then set final file size upfront */
+    if ( file_preallocate ( swarm.fd, offset, total ) < 0 )
+    {
+        perror ( "fallocate" );
+        close ( swarm.fd );
+        return -1;
+    }
+
+    if ( ftruncate ( swarm.fd, total ) < 0 )
+    {
+        perror ( "ftruncate" );
+        close ( swarm.fd );
+        return -1;
+    }
+
+    if ( pthread_mutex_init ( &swarm.mutex, NULL ) )
+    {
+        perror ( "pthread_mutex_init" );
+        close ( swarm.fd );
+        return -1;
+    }
+
+    if ( pthread_cond_init ( &swarm.cond, NULL ) )
+    {
+        perror ( "pthread_cond_init" );
+        pthread_mutex_destroy ( &swarm.mutex );
+        close ( swarm.fd );
+        return -1;
+    }
+
+    /* Checksum thread follows contiguous prefix of the file, partial data included */
+    if ( checksum_start ( &swarm.checksum, options->checksum, filepath, offset ) < 0 )
+    {
+        perror ( "checksum" );
+        pthread_cond_destroy ( &swarm.cond );
+        pthread_mutex_destroy ( &swarm.mutex );
+        close ( swarm.fd );
+        return -1;
+    }
+
+    progress_start ( &swarm.progress, swarm.basename, offset, total, options->progress );
+
+    for ( i = 0; i < swarm.count; i++ )
+    {
+        if ( pthread_create ( &workers[i].thread, NULL, swarm_thread, &workers[i] ) )
+        {
+            perror ( "pthread_create" );
+            break;
+        }
+        workers[i].started = 1;
+    }
+
+    for ( i = 0; i < swarm.count; i++ )
+    {
+        if ( workers[i].started )
+        {
+            pthread_join ( workers[i].thread, NULL );
+        }
+    }
+
+    /* Ranges are left over once every source failed */
+    if ( swarm_prefix ( &swarm ) < total )
+    {
+        ret = -1;
+    }
+
+    if ( ret < 0 )
+    {
+        checksum_cancel ( &swarm.checksum );
+        progress_stop ( &swarm.progress, -1 );
+
+        /* Keep only contiguous data so the download can be continued */
+        if ( ftruncate ( swarm.fd, swarm_prefix ( &swarm ) ) < 0 )
+        {
+            perror ( "ftruncate" );
+        }
+
+        errno = EIO;
+        pthread_cond_destroy ( &swarm.cond );
+        pthread_mutex_destroy ( &swarm.mutex );
+        close ( swarm.fd );
+        return -1;
+    }
+
+    /* Mismatching file is removed, so it is not mistaken for a partial one */
+    if ( checksum_finish ( &swarm.checksum, total ) < 0 )
+    {
+        progress_stop ( &swarm.progress, -1 );
+        perror ( "checksum" );
+        unlink ( filepath );
+        pthread_cond_destroy ( &swarm.cond );
+        pthread_mutex_destroy ( &swarm.mutex );
+        close ( swarm.fd );
+        return -1;
+    }
+
+    if ( file_finish ( swarm.fd, total, options ) < 0 )
+    {
+        progress_stop ( &swarm.progress, -1 );
+        perror ( "verify" );
+        pthread_cond_destroy ( &swarm.cond );
+        pthread_mutex_destroy ( &swarm.mutex );
+        close ( swarm.fd );
+        return -1;
+    }
+
+    progress_stop ( &swarm.progress, 0 );
+    pthread_cond_destroy ( &swarm.cond );
+    pthread_mutex_destroy ( &swarm.mutex );
+    close ( swarm.fd );
+
+    /* Share of each source shows how work was balanced */
+    if ( options->progress )
+    {
+        for ( i = 0; i < sources; i++ )
+        {
+            for ( j = i, sum = 0; j < swarm.count; j += sources )
+            {
+                sum += workers[j].received;
+            }
+
+            printf ( "swarm: %s - %lu KiB\n", urls[i], ( unsigned long ) sum / 1024 );
+        }
+    }
+
+    return 0;
+}
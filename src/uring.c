@@ -0,0 +1,425 @@
+/* ------------------------------------------------------------------
+ * Lget - Io_uring Receive Backend
+ * ------------------------------------------------------------------ */
+
+#include "lget.h"
+
+#ifndef DISABLE_URING
+
+/**
+ * Io_uring instance with registered buffers
+ */
+struct uring_t
+{
+    int fd;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring;
+    size_t cq_ring_len;
+    size_t sqes_len;
+    char *buffers;
+};
+
+/**
+ * Release io_uring instance
+ */
+void uring_close ( struct uring_t *ring )
+{
+    if ( ring->sqes )
+    {
+        munmap ( ring->sqes, ring->sqes_len );
+    }
+
+    if ( ring->cq_ring && ring->cq_ring != ring->sq_ring )
+    {
+        munmap ( ring->cq_ring, ring->cq_ring_len );
+    }
+
+    if ( ring->sq_ring )
+    {
+        munmap ( ring->sq_ring, ring->sq_ring_len );
+    }
+
+    if ( ring->fd >= 0 )
+    {
+        close ( ring->fd );
+    }
+
+    free ( ring->buffers );
+    free ( ring );
+}
+
+/**
+ * Map io_uring submission and completion rings
+ */
+static int uring_map ( struct uring_t *ring, const struct io_uring_params *params )
+{
+    char *sq;
+    char *cq;
+
+    ring->sq_ring_len = params->sq_off.array + params->sq_entries * sizeof ( unsigned int );
+    ring->cq_ring_len = params->cq_off.cqes + params->cq_entries * sizeof ( struct io_uring_cqe );
+
+    /* Both rings may share single mapping */
+    if ( params->features & IORING_FEAT_SINGLE_MMAP && ring->cq_ring_len > ring->sq_ring_len )
+    {
+        ring->sq_ring_len = ring->cq_ring_len;
+    }
+
+    if ( ( ring->sq_ring =
+            mmap ( NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring->fd, IORING_OFF_SQ_RING ) ) == MAP_FAILED )
+    {
+        ring->sq_ring = NULL;
+        return -1;
+    }
+
+    if ( params->features & IORING_FEAT_SINGLE_MMAP )
+    {
+        ring->cq_ring = ring->sq_ring;
+
+    } else if ( ( ring->cq_ring =
+            mmap ( NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring->fd, IORING_OFF_CQ_RING ) ) == MAP_FAILED )
+    {
+        ring->cq_ring = NULL;
+        return -1;
+    }
+
+    ring->sqes_len = params->sq_entries * sizeof ( struct io_uring_sqe );
+
+    if ( ( ring->sqes =
+            ( struct io_uring_sqe * ) mmap ( NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES ) ) == MAP_FAILED )
+    {
+        ring->sqes = NULL;
+        return -1;
+    }
+
+    sq = ( char * ) ring->sq_ring;
+    cq = ( char * ) ring->cq_ring;
+
+    ring->sq_tail = ( unsigned int * ) ( sq + params->sq_off.tail );
+    ring->sq_mask = ( unsigned int * ) ( sq + params->sq_off.ring_mask );
+    ring->sq_array = ( unsigned int * ) ( sq + params->sq_off.array );
+    ring->cq_head = ( unsigned int * ) ( cq + params->cq_off.head );
+    ring->cq_tail = ( unsigned int * ) ( cq + params->cq_off.tail );
+    ring->cq_mask = ( unsigned int * ) ( cq + params->cq_off.ring_mask );
+    ring->cqes = ( struct io_uring_cqe * ) ( cq + params->cq_off.cqes );
+
+    return 0;
+}
+
+/**
+ * Setup io_uring instance with registered buffers
+ */
+struct uring_t *uring_open ( void )
+{
+    unsigned int i;
+    struct uring_t *ring;
+    struct io_uring_params params;
+    struct iovec iov[URING_BUFFERS];
+
+    if ( !( ring = ( struct uring_t * ) calloc ( 1, sizeof ( struct uring_t ) ) ) )
+    {
+        return NULL;
+    }
+
+    ring->fd = -1;
+    memset ( &params, '\0', sizeof ( params ) );
+
+    if ( ( ring->fd = syscall ( __NR_io_uring_setup, URING_BUFFERS * 3, &params ) ) < 0
+        || uring_map ( ring, &params ) < 0
+        || posix_memalign ( ( void ** ) &ring->buffers, 4096,
+            URING_BUFFERS * URING_BUFFER_SIZE ) )
+    {
+        uring_close ( ring );
+        return NULL;
+    }
+
+    /* Register buffers once, so writes skip page pinning */
+    for ( i = 0; i < URING_BUFFERS; i++ )
+    {
+        iov[i].iov_base = ring->buffers + i * URING_BUFFER_SIZE;
+        iov[i].iov_len = URING_BUFFER_SIZE;
+    }
+
+    if ( syscall ( __NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov,
+            URING_BUFFERS ) < 0 )
+    {
+        uring_close ( ring );
+        return NULL;
+    }
+
+    return ring;
+}
+
+/**
+ * Queue single submission entry
+ */
+static void uring_push ( struct uring_t *ring, unsigned int *tail, int opcode, int fd,
+    unsigned int index, size_t len, size_t offset, int flags )
+{
+    unsigned int slot;
+    struct io_uring_sqe *sqe;
+
+    slot = *tail & *ring->sq_mask;
+    sqe = &ring->sqes[slot];
+
+    memset ( sqe, '\0', sizeof ( *sqe ) );
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = ( unsigned long ) ( ring->buffers + index * URING_BUFFER_SIZE );
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->flags = flags;
+    sqe->buf_index = index;
+    sqe->user_data = ( index << 2 ) | ( opcode != IORING_OP_RECV );
+
+    /* Socket recv must not return before the buffer is full */
+    if ( opcode == IORING_OP_RECV )
+    {
+        sqe->msg_flags = MSG_WAITALL;
+    }
+
+    ring->sq_array[slot] = slot;
+    ( *tail )++;
+}
+
+/**
+ * Queue timeout linked to previous recv, so stalled socket cancels it
+ */
+static void uring_push_timeout ( struct uring_t *ring, unsigned int *tail, unsigned int index,
+    const struct __kernel_timespec *timeout )
+{
+    unsigned int slot;
+    struct io_uring_sqe *sqe;
+
+    slot = *tail & *ring->sq_mask;
+    sqe = &ring->sqes[slot];
+
+    memset ( sqe, '\0', sizeof ( *sqe ) );
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = ( unsigned long ) timeout;
+    sqe->len = 1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = ( index << 2 ) | 2;
+
+    ring->sq_array[slot] = slot;
+    ( *tail )++;
+}
+
+/**
+ * Write data slice at given file offset
+ */
+static int uring_pwrite ( int fd, const char *data, size_t len, size_t offset )
+{
+    ssize_t ret;
+
+    while ( len )
+    {
+        if ( ( ret = pwrite ( fd, data, len, offset ) ) < 0 )
+        {
+            return -1;
+        }
+
+        data += ret;
+        len -= ret;
+        offset += ret;
+    }
+
+    return 0;
+}
+
+/**
+ * Move data from socket into file at offset, zero means connection closed
+ */
+ssize_t uring_recv ( struct uring_t *ring, int sock, int fd, size_t offset, size_t len )
+{
+    int res;
+    int error = 0;
+    int timed = 0;
+    int expired = 0;
+    unsigned int i;
+    unsigned int count;
+    unsigned int tail;
+    unsigned int head;
+    unsigned int pending;
+    unsigned int index;
+    size_t slice;
+    size_t expect[URING_BUFFERS];
+    ssize_t received[URING_BUFFERS];
+    ssize_t written[URING_BUFFERS];
+    size_t start = offset;
+    socklen_t optlen;
+    struct timeval tv;
+    struct __kernel_timespec timeout;
+    struct io_uring_cqe *cqe;
+
+    /* Ring waits for socket data without socket receive timeout, each recv gets it linked */
+    optlen = sizeof ( tv );
+
+    if ( !getsockopt ( sock, SOL_SOCKET, SO_RCVTIMEO, &tv, &optlen )
+        && ( tv.tv_sec || tv.tv_usec ) )
+    {
+        timeout.tv_sec = tv.tv_sec;
+        timeout.tv_nsec = tv.tv_usec * 1000;
+        timed = 1;
+    }
+
+    tail = *ring->sq_tail;
+
+    /* Chain recv and write pairs over buffers, so they run in order */
+    for ( count = 0; count < URING_BUFFERS && len; count++ )
+    {
+        slice = len < URING_BUFFER_SIZE ? len : URING_BUFFER_SIZE;
+        expect[count] = slice;
+        received[count] = 0;
+        written[count] = 0;
+
+        uring_push ( ring, &tail, IORING_OP_RECV, sock, count, slice, 0, IOSQE_IO_LINK );
+
+        if ( timed )
+        {
+            uring_push_timeout ( ring, &tail, count, &timeout );
+        }
+
+        uring_push ( ring, &tail, IORING_OP_WRITE_FIXED, fd, count, slice, offset,
+            len > slice && count + 1 < URING_BUFFERS ? IOSQE_IO_LINK : 0 );
+
+        offset += slice;
+        len -= slice;
+    }
+
+    __atomic_store_n ( ring->sq_tail, tail, __ATOMIC_RELEASE );
+
+    /* Submit whole batch and wait for all completions with single call */
+    for ( pending = count * ( 2 + timed ), i = pending; pending; i = 0 )
+    {
+        if ( syscall ( __NR_io_uring_enter, ring->fd, i, pending, IORING_ENTER_GETEVENTS,
+                NULL, 0 ) < 0 && errno != EINTR )
+        {
+            return -1;
+        }
+
+        head = *ring->cq_head;
+
+        while ( head != __atomic_load_n ( ring->cq_tail, __ATOMIC_ACQUIRE ) )
+        {
+            cqe = &ring->cqes[head & *ring->cq_mask];
+            index = cqe->user_data >> 2;
+            res = cqe->res;
+
+            if ( cqe->user_data & 2 )
+            {
+                expired |= res == -ETIME;
+
+            } else if ( cqe->user_data & 1 )
+            {
+                written[index] = res;
+
+            } else
+            {
+                received[index] = res;
+            }
+
+            head++;
+            pending--;
+        }
+
+        __atomic_store_n ( ring->cq_head, head, __ATOMIC_RELEASE );
+    }
+
+    /* Sum up completed pairs, short recv breaks the chain */
+    for ( i = 0, len = 0; i < count; i++ )
+    {
+        /* Data taken by timed out recv is unknown, so stream may not continue */
+        if ( received[i] < 0 && expired )
+        {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
+        if ( received[i] < 0 )
+        {
+            error = -received[i];
+            break;
+        }
+
+        if ( written[i] == ( ssize_t ) expect[i] )
+        {
+            len += expect[i];
+            continue;
+        }
+
+        /* Write for short recv was cancelled, store received part directly */
+        if ( written[i] == -ECANCELED && received[i] < ( ssize_t ) expect[i] )
+        {
+            if ( uring_pwrite ( fd, ring->buffers + i * URING_BUFFER_SIZE, received[i],
+                    start + len ) < 0 )
+            {
+                error = errno;
+                break;
+            }
+
+            len += received[i];
+            break;
+        }
+
+        error = written[i] < 0 ? -written[i] : EIO;
+        break;
+    }
+
+    if ( !len && error )
+    {
+        /* Kernel without socket recv support */
+        errno = error == EINVAL ? ENOSYS : error;
+        return -1;
+    }
+
+    return len;
+}
+
+#else
+
+/**
+ * Setup io_uring instance with registered buffers
+ */
+struct uring_t *uring_open ( void )
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+/**
+ * Release io_uring instance
+ */
+void uring_close ( struct uring_t *ring )
+{
+    ( void ) ring;
+}
+
+/**
+ * Move data from socket into file at offset, zero means connection closed
+ */
+ssize_t uring_recv ( struct uring_t *ring, int sock, int fd, size_t offset, size_t len )
+{
+    ( void ) ring;
+    ( void ) sock;
+    ( void ) fd;
+    ( void ) offset;
+    ( void ) len;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
@@ -13,12 +13,29 @@ int parse_host ( const char *input, char *host, size_t host_len, unsigned short
     size_t len;
     const char *ptr;
 
-    if ( !( ptr = strchr ( input, ':' ) ) )
+    /* IPv6 literal is bracketed */
+    if ( *input == '[' )
     {
-        return -1;
+        if ( !( ptr = strchr ( input, ']' ) ) || ptr[1] != ':' )
+        {
+            return -1;
+        }
+
+        input++;
+        len = ptr - input;
+        ptr++;
+
+    } else
+    {
+        if ( !( ptr = strchr ( input, ':' ) ) )
+        {
+            return -1;
+        }
+
+        len = ptr - input;
     }
 
-    if ( ( len = ptr - input ) >= host_len )
+    if ( len >= host_len )
     {
         return -1;
     }
@@ -37,6 +54,37 @@ int parse_host ( const char *input, char *host, size_t host_len, unsigned short
     return 0;
 }
 
+/**
+ * Format host with optional port, IPv6 literals are bracketed
+ */
+int format_host ( char *buffer, size_t size, const char *hostname, unsigned short port )
+{
+    int len;
+    const char *left;
+    const char *right;
+
+    left = strchr ( hostname, ':' ) ? "[" : "";
+    right = *left ? "]" : "";
+
+    /* Default port is omitted */
+    if ( port != 80 )
+    {
+        len = snprintf ( buffer, size, "%s%s%s:%u", left, hostname, right, port );
+
+    } else
+    {
+        len = snprintf ( buffer, size, "%s%s%s", left, hostname, right );
+    }
+
+    if ( len < 0 || ( size_t ) len >= size )
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    return len;
+}
+
 /**
  * Get basename of file path
  */
@@ -53,86 +101,400 @@ const char *get_basename ( const char *path )
  * Find substring with case ignored
  */
 char *lget_strcasestr ( const char *haystack, const char *needle )
+{
+    return ( char * ) scan_casestr ( haystack, strlen ( haystack ), needle, strlen ( needle ) );
+}
+
+/**
+ * Resolved hostname cache entry
+ */
+struct resolve_cache_t
+{
+    char hostname[HOSTNAME_SIZE];
+    int family;
+    struct address_t addrs[RESOLVE_ADDRS_MAX];
+    size_t count;
+};
+
+/**
+ * Resolved hostnames cache shared between downloads
+ */
+static struct resolve_cache_t resolve_cache[RESOLVE_CACHE_SIZE];
+static size_t resolve_cache_next = 0;
+static pthread_mutex_t resolve_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Look up hostname in resolved hostnames cache
+ */
+static int resolve_cache_lookup ( const char *hostname, int family, struct address_t *addrs,
+    size_t size )
 {
     size_t i;
-    size_t j;
-    size_t haystack_len;
-    size_t needle_len;
+    int ret = -1;
 
-    haystack_len = strlen ( haystack );
-    needle_len = strlen ( needle );
+    pthread_mutex_lock ( &resolve_cache_mutex );
 
-    if ( needle_len > haystack_len )
+    for ( i = 0; i < RESOLVE_CACHE_SIZE; i++ )
     {
-        return NULL;
+        if ( resolve_cache[i].family == family && !strcmp ( resolve_cache[i].hostname, hostname ) )
+        {
+            ret = resolve_cache[i].count < size ? resolve_cache[i].count : size;
+            memcpy ( addrs, resolve_cache[i].addrs, ret * sizeof ( struct address_t ) );
+            break;
+        }
     }
 
-    haystack_len -= needle_len;
+    pthread_mutex_unlock ( &resolve_cache_mutex );
+
+    return ret;
+}
+
+/**
+ * Store hostname in resolved hostnames cache
+ */
+static void resolve_cache_store ( const char *hostname, int family,
+    const struct address_t *addrs, size_t count )
+{
+    struct resolve_cache_t *entry;
 
-    for ( i = 0; i <= haystack_len; i++ )
+    if ( strlen ( hostname ) >= HOSTNAME_SIZE )
     {
-        for ( j = 0; j < needle_len; j++ )
+        return;
+    }
+
+    pthread_mutex_lock ( &resolve_cache_mutex );
+
+    /* Replace oldest entry */
+    entry = &resolve_cache[resolve_cache_next];
+    resolve_cache_next = ( resolve_cache_next + 1 ) % RESOLVE_CACHE_SIZE;
+
+    strcpy ( entry->hostname, hostname );
+    entry->family = family;
+    entry->count = count < RESOLVE_ADDRS_MAX ? count : RESOLVE_ADDRS_MAX;
+    memcpy ( entry->addrs, addrs, entry->count * sizeof ( struct address_t ) );
+
+    pthread_mutex_unlock ( &resolve_cache_mutex );
+}
+
+#ifndef SYSTEM_RESOLVER
+/**
+ * AAAA records query running aside the A records one
+ */
+struct resolve_job_t
+{
+    const char *hostname;
+    int ret;
+    struct in6_addr addrs[RESOLVE_ADDRS_MAX];
+};
+
+/**
+ * Query AAAA records of hostname
+ */
+static void *resolve_thread ( void *arg )
+{
+    struct resolve_job_t *job;
+
+    job = ( struct resolve_job_t * ) arg;
+    job->ret = nsaddr6 ( job->hostname, job->addrs, RESOLVE_ADDRS_MAX );
+
+    return NULL;
+}
+#endif
+
+/**
+ * Query hostname addresses of allowed families, returns addresses count
+ */
+static int resolve_query ( const char *hostname, int family, struct address_t *addrs,
+    size_t size )
+{
+    size_t count = 0;
+#ifdef SYSTEM_RESOLVER
+    int ret;
+    struct addrinfo hints;
+    struct addrinfo *result;
+    struct addrinfo *info;
+
+    memset ( &hints, '\0', sizeof ( hints ) );
+    hints.ai_family = family == FAMILY_IPV4 ? AF_INET : family == FAMILY_IPV6 ? AF_INET6 : AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    /* Query host addresses */
+    if ( ( ret = getaddrinfo ( hostname, NULL, &hints, &result ) ) )
+    {
+        errno = ret == EAI_SYSTEM ? errno : ENODATA;
+        return -1;
+    }
+
+    /* Collect host addresses */
+    for ( info = result; info && count < size; info = info->ai_next )
+    {
+        memset ( &addrs[count], '\0', sizeof ( struct address_t ) );
+
+        if ( info->ai_family == AF_INET )
+        {
+            addrs[count].family = AF_INET;
+            addrs[count].addr.v4 = ( ( struct sockaddr_in * ) info->ai_addr )->sin_addr;
+            count++;
+
+        } else if ( info->ai_family == AF_INET6 )
         {
-            if ( tolower ( haystack[i + j] ) != tolower ( needle[j] ) )
-            {
-                break;
-            }
+            addrs[count].family = AF_INET6;
+            addrs[count].addr.v6 = ( ( struct sockaddr_in6 * ) info->ai_addr )->sin6_addr;
+            count++;
         }
+    }
+
+    freeaddrinfo ( result );
+#else
+    int ret;
+    int started = 0;
+    size_t i;
+    pthread_t thread;
+    unsigned int addrs4[RESOLVE_ADDRS_MAX];
+    struct resolve_job_t job;
+
+    job.hostname = hostname;
+    job.ret = -1;
 
-        if ( j == needle_len )
+    /* Both families are resolved at once, so lookup takes as long as the slower one */
+    if ( family != FAMILY_IPV4 && family != FAMILY_IPV6 )
+    {
+        started = !pthread_create ( &thread, NULL, resolve_thread, &job );
+    }
+
+    /* Query A records */
+    if ( family != FAMILY_IPV6 && ( ret = nsaddr ( hostname, addrs4, RESOLVE_ADDRS_MAX ) ) > 0 )
+    {
+        for ( i = 0; i < ( size_t ) ret && count < size; i++, count++ )
         {
-            return ( char * ) ( haystack + i );
+            memset ( &addrs[count], '\0', sizeof ( struct address_t ) );
+            addrs[count].family = AF_INET;
+            addrs[count].addr.v4.s_addr = addrs4[i];
         }
     }
 
-    return NULL;
+    /* Query AAAA records, unless already queried aside */
+    if ( started )
+    {
+        pthread_join ( thread, NULL );
+
+    } else if ( family != FAMILY_IPV4 )
+    {
+        resolve_thread ( &job );
+    }
+
+    if ( job.ret > 0 )
+    {
+        for ( i = 0; i < ( size_t ) job.ret && count < size; i++, count++ )
+        {
+            memset ( &addrs[count], '\0', sizeof ( struct address_t ) );
+            addrs[count].family = AF_INET6;
+            addrs[count].addr.v6 = job.addrs[i];
+        }
+    }
+#endif
+
+    /* At least one address required */
+    if ( !count )
+    {
+        errno = ENODATA;
+        return -1;
+    }
+
+    return count;
 }
 
 /**
- * Resolve hostname into IPv4 address
+ * Order addresses by family policy, families are interleaved starting with preferred one
  */
-int resolve_ipv4 ( const char *hostname, unsigned int *addr )
+static size_t resolve_order ( struct address_t *addrs, size_t count, int family )
 {
-#ifdef SYSTEM_RESOLVER
-    struct hostent *he;
-    struct in_addr **addr_list;
+    size_t i;
+    size_t n4 = 0;
+    size_t n6 = 0;
+    size_t i4 = 0;
+    size_t i6 = 0;
+    size_t len = 0;
+    int prefer6;
+    struct address_t addrs4[RESOLVE_ADDRS_MAX];
+    struct address_t addrs6[RESOLVE_ADDRS_MAX];
+
+    for ( i = 0; i < count; i++ )
+    {
+        if ( addrs[i].family == AF_INET && family != FAMILY_IPV6 && n4 < RESOLVE_ADDRS_MAX )
+        {
+            addrs4[n4++] = addrs[i];
+
+        } else if ( addrs[i].family == AF_INET6 && family != FAMILY_IPV4
+            && n6 < RESOLVE_ADDRS_MAX )
+        {
+            addrs6[n6++] = addrs[i];
+        }
+    }
+
+    /* Families take turns, preferred one goes first */
+    prefer6 = family != FAMILY_PREFER_IPV4;
+
+    while ( i4 < n4 || i6 < n6 )
+    {
+        if ( i6 < n6 && ( prefer6 || i4 >= n4 ) )
+        {
+            addrs[len++] = addrs6[i6++];
+            prefer6 = 0;
+
+        } else
+        {
+            addrs[len++] = addrs4[i4++];
+            prefer6 = 1;
+        }
+    }
+
+    return len;
+}
+
+/**
+ * Resolve hostname into addresses ordered by family policy, returns addresses count
+ */
+int resolve_host ( const char *hostname, int family, struct address_t *addrs, size_t size )
+{
+    int count;
+    struct address_t resolved[RESOLVE_ADDRS_MAX];
+
+    if ( !size )
+    {
+        errno = EINVAL;
+        return -1;
+    }
 
 #ifndef DISABLE_INET_PTON
-    if ( inet_pton ( AF_INET, hostname, addr ) > 0 )
+    /* Address literals are used as they are */
+    memset ( addrs, '\0', sizeof ( struct address_t ) );
+
+    if ( inet_pton ( AF_INET, hostname, &addrs->addr.v4 ) > 0 )
+    {
+        addrs->family = AF_INET;
+        return 1;
+    }
+
+    if ( inet_pton ( AF_INET6, hostname, &addrs->addr.v6 ) > 0 )
     {
-        return 0;
+        addrs->family = AF_INET6;
+        return 1;
     }
 #endif
 
-    /* Query host addess */
-    if ( !( he = gethostbyname ( hostname ) ) )
+    /* Reuse addresses resolved by previous download */
+    if ( ( count = resolve_cache_lookup ( hostname, family, resolved, RESOLVE_ADDRS_MAX ) ) <= 0 )
+    {
+        if ( ( count = resolve_query ( hostname, family, resolved, RESOLVE_ADDRS_MAX ) ) <= 0 )
+        {
+            return -1;
+        }
+
+        resolve_cache_store ( hostname, family, resolved, count );
+    }
+
+    if ( !( count = resolve_order ( resolved, count, family ) ) )
     {
+        errno = EAFNOSUPPORT;
         return -1;
     }
 
-    /* Assign list pointer */
-    addr_list = ( struct in_addr ** ) he->h_addr_list;
+    if ( ( size_t ) count > size )
+    {
+        count = size;
+    }
 
-    /* At least one address required */
-    if ( !addr_list[0] )
+    memcpy ( addrs, resolved, count * sizeof ( struct address_t ) );
+
+    return count;
+}
+
+/**
+ * Permanent redirect cache entry
+ */
+struct redirect_cache_t
+{
+    char *url;
+    char *target;
+};
+
+/**
+ * Permanent redirects shared between downloads
+ */
+static struct redirect_cache_t redirect_cache[REDIRECT_CACHE_SIZE];
+static size_t redirect_cache_next = 0;
+static pthread_mutex_t redirect_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Look up redirect target of url in permanent redirects cache
+ */
+int redirect_cache_lookup ( const char *url, char *target, size_t size )
+{
+    size_t i;
+    int ret = -1;
+
+    pthread_mutex_lock ( &redirect_cache_mutex );
+
+    for ( i = 0; i < REDIRECT_CACHE_SIZE; i++ )
     {
-        errno = ENODATA;
-        return -1;
+        if ( redirect_cache[i].url && !strcmp ( redirect_cache[i].url, url )
+            && strlen ( redirect_cache[i].target ) < size )
+        {
+            strcpy ( target, redirect_cache[i].target );
+            ret = 0;
+            break;
+        }
     }
 
-    /* Assign host address */
-    *addr = ( *addr_list )[0].s_addr;
+    pthread_mutex_unlock ( &redirect_cache_mutex );
 
-    return 0;
-#else
+    return ret;
+}
 
-#ifndef DISABLE_INET_PTON
-    if ( inet_pton ( AF_INET, hostname, addr ) > 0 )
+/**
+ * Store permanent redirect in cache
+ */
+void redirect_cache_store ( const char *url, const char *target )
+{
+    size_t i;
+    char *url_copy;
+    char *target_copy;
+    struct redirect_cache_t *entry = NULL;
+
+    if ( !( url_copy = strdup ( url ) ) )
     {
-        return 0;
+        return;
     }
-#endif
 
-    return nsaddr ( hostname, addr );
-#endif
+    if ( !( target_copy = strdup ( target ) ) )
+    {
+        free ( url_copy );
+        return;
+    }
+
+    pthread_mutex_lock ( &redirect_cache_mutex );
+
+    /* Update existing entry or replace oldest one */
+    for ( i = 0; i < REDIRECT_CACHE_SIZE; i++ )
+    {
+        if ( redirect_cache[i].url && !strcmp ( redirect_cache[i].url, url ) )
+        {
+            entry = &redirect_cache[i];
+            break;
+        }
+    }
+
+    if ( !entry )
+    {
+        entry = &redirect_cache[redirect_cache_next];
+        redirect_cache_next = ( redirect_cache_next + 1 ) % REDIRECT_CACHE_SIZE;
+    }
+
+    free ( entry->url );
+    free ( entry->target );
+    entry->url = url_copy;
+    entry->target = target_copy;
+
+    pthread_mutex_unlock ( &redirect_cache_mutex );
 }